@@ -1,6 +1,23 @@
 @group(0) @binding(0) var<uniform> projectionMatrix: mat4x4<f32>;
 @group(0) @binding(1) var texture: texture_2d<f32>;
 @group(0) @binding(2) var textureSampler: sampler;
+// Only bound for texture array batches, which don't bind texture.
+@group(0) @binding(3) var textureArray: texture_2d_array<f32>;
+
+// Only bound by the culling pass of instanced batches.
+@group(0) @binding(4) var<storage, read> cullInstances: array<SpriteInstance>;
+@group(0) @binding(5) var<storage, read_write> visibleInstances:
+    array<SpriteInstance>;
+@group(0) @binding(6) var<storage, read_write> drawArgs: DrawIndexedArgs;
+@group(0) @binding(7) var<uniform> cullParams: CullParams;
+
+// Only bound for tilemaps, which use texture as their tileset.
+@group(0) @binding(8) var tileIds: texture_2d<u32>;
+@group(0) @binding(9) var<uniform> tilemapParams: TilemapParams;
+
+// Only bound when presenting the over-allocated target of a renderer with
+// bucketed targets.
+@group(0) @binding(10) var presentSource: texture_2d<f32>;
 
 struct VertexInput {
     @location(0) position: vec3<f32>,
@@ -9,11 +26,85 @@ struct VertexInput {
     @location(3) textureCoords: vec2<f32>,
 };
 
+struct InstanceInput {
+    @location(0) position: vec3<f32>,
+    @location(1) size: vec2<f32>,
+    @location(2) textureRect: vec4<f32>,
+    @location(3) color: vec4<f32>,
+    @location(4) blend: f32,
+    @location(5) layer: u32,
+};
+
+// Matches SpriteInstance in spriteModel.h.
+struct SpriteInstance {
+    x: f32,
+    y: f32,
+    z: f32,
+    width: f32,
+    height: f32,
+    texX: f32,
+    texY: f32,
+    texWidth: f32,
+    texHeight: f32,
+    color: u32,
+    blend: f32,
+    layer: u32,
+};
+
+// Arguments of wgpuRenderPassEncoderDrawIndexedIndirect.
+struct DrawIndexedArgs {
+    indexCount: u32,
+    instanceCount: atomic<u32>,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+struct CullParams {
+    spriteCount: u32,
+};
+
+// Matches TilemapParams in tilemap.c.
+struct TilemapParams {
+    // World position of the map's bottom left corner.
+    origin: vec2<f32>,
+    // World size of one tile.
+    tileSize: vec2<f32>,
+    // World area to cover with the map's quad.
+    quadMin: vec2<f32>,
+    quadMax: vec2<f32>,
+    // Size of one tile in the tileset, in texels.
+    tileTextureSize: vec2<f32>,
+    z: f32,
+    tilesetColumns: u32,
+};
+
+struct TilemapVertexOutput {
+    @builtin(position) position: vec4<f32>,
+    @location(0) worldPosition: vec2<f32>,
+};
+
+struct PackedVertexInput {
+    @location(0) position: vec3<f32>,
+    @location(1) color: vec4<f32>,
+    @location(2) blend: vec4<f32>,
+    @location(3) textureCoords: vec2<f32>,
+};
+
+struct ShortPackedVertexInput {
+    // The blend is stored in w as 0-255.
+    @location(0) position: vec4<i32>,
+    @location(1) color: vec4<f32>,
+    @location(2) textureCoords: vec2<f32>,
+};
+
 struct VertexOutput {
     @builtin(position) position: vec4<f32>,
     @location(0) color: vec4<f32>,
     @location(1) blend: f32,
     @location(2) textureCoords: vec2<f32>,
+    // Texture array layer, only set for instanced sprites.
+    @location(3) @interpolate(flat) layer: u32,
 }
 
 @vertex
@@ -28,6 +119,46 @@ fn vs_main(in: VertexInput) -> VertexOutput {
 
 }
 
+@vertex
+fn vs_instanced(@builtin(vertex_index) vertexIndex: u32,
+    in: InstanceInput) -> VertexOutput {
+    // Corners are generated in the same order as spriteVertexData:
+    // (0, 0), (1, 0), (1, 1), (0, 1).
+    let corner = vec2<f32>(f32(((vertexIndex + 1u) & 2u) >> 1u),
+        f32(vertexIndex >> 1u));
+
+    var out: VertexOutput;
+    out.position = projectionMatrix * vec4<f32>(
+        in.position.xy + corner * in.size, in.position.z, 1.0);
+    out.color = in.color;
+    out.blend = in.blend;
+    out.textureCoords = in.textureRect.xy +
+        vec2<f32>(corner.x, 1.0 - corner.y) * in.textureRect.zw;
+    out.layer = in.layer;
+    return out;
+}
+
+@vertex
+fn vs_packed(in: PackedVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    out.position = projectionMatrix * vec4<f32>(in.position, 1.0);
+    out.color = in.color;
+    out.blend = in.blend.x;
+    out.textureCoords = in.textureCoords;
+    return out;
+}
+
+@vertex
+fn vs_packed_short(in: ShortPackedVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    out.position = projectionMatrix * vec4<f32>(vec3<f32>(in.position.xyz),
+        1.0);
+    out.color = in.color;
+    out.blend = f32(in.position.w) / 255.0;
+    out.textureCoords = in.textureCoords;
+    return out;
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
     let textureColor = textureSample(texture, textureSampler, in.textureCoords);
@@ -37,4 +168,128 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
     }
 
     return mix(textureColor, in.color, in.blend);
-}
\ No newline at end of file
+}
+
+@fragment
+fn fs_array(in: VertexOutput) -> @location(0) vec4<f32> {
+    let textureColor = textureSample(textureArray, textureSampler,
+        in.textureCoords, in.layer);
+
+    if (textureColor.a == 0.0) {
+        discard;
+    }
+
+    return mix(textureColor, in.color, in.blend);
+}
+
+// Copies the sprites that overlap the view into visibleInstances and counts
+// them in drawArgs.instanceCount, which must start at 0.
+@compute @workgroup_size(64)
+fn cs_cull(@builtin(global_invocation_id) id: vec3<u32>) {
+    if (id.x >= cullParams.spriteCount) {
+        return;
+    }
+
+    let sprite = cullInstances[id.x];
+    let corner0 = projectionMatrix * vec4<f32>(sprite.x, sprite.y, sprite.z,
+        1.0);
+    let corner1 = projectionMatrix * vec4<f32>(sprite.x + sprite.width,
+        sprite.y + sprite.height, sprite.z, 1.0);
+    let low = min(corner0.xy, corner1.xy);
+    let high = max(corner0.xy, corner1.xy);
+
+    if (any(high < vec2<f32>(-1.0)) || any(low > vec2<f32>(1.0))) {
+        return;
+    }
+
+    let visibleI = atomicAdd(&drawArgs.instanceCount, 1u);
+    visibleInstances[visibleI] = sprite;
+}
+
+// Covers the visible part of a tilemap with one quad, the tiles are looked up
+// per pixel in fs_tilemap.
+@vertex
+fn vs_tilemap(@builtin(vertex_index) vertexIndex: u32) -> TilemapVertexOutput {
+    // Two triangles: (0, 0), (1, 0), (1, 1) and (0, 0), (1, 1), (0, 1).
+    var quadIndices = array<u32, 6>(0u, 1u, 2u, 0u, 2u, 3u);
+    let quadIndex = quadIndices[vertexIndex];
+    let corner = vec2<f32>(f32(((quadIndex + 1u) & 2u) >> 1u),
+        f32(quadIndex >> 1u));
+    let worldPosition = mix(tilemapParams.quadMin, tilemapParams.quadMax,
+        corner);
+
+    var out: TilemapVertexOutput;
+    out.position = projectionMatrix * vec4<f32>(worldPosition, tilemapParams.z,
+        1.0);
+    out.worldPosition = worldPosition;
+    return out;
+}
+
+@fragment
+fn fs_tilemap(in: TilemapVertexOutput) -> @location(0) vec4<f32> {
+    let mapPosition = (in.worldPosition - tilemapParams.origin) /
+        tilemapParams.tileSize;
+    let tilesetSize = vec2<f32>(textureDimensions(texture));
+
+    // Tiles are picked per pixel, but the position in the map is continuous,
+    // so its derivatives give the tileset texels covered by each pixel. They
+    // are taken before any discard, which derivatives don't allow.
+    let tilesetPosition = vec2<f32>(mapPosition.x, -mapPosition.y) *
+        tilemapParams.tileTextureSize;
+    let gradientX = dpdx(tilesetPosition);
+    let gradientY = dpdy(tilesetPosition);
+
+    let mapSize = vec2<i32>(textureDimensions(tileIds));
+    let tile = clamp(vec2<i32>(floor(mapPosition)), vec2<i32>(0),
+        mapSize - vec2<i32>(1));
+
+    // Tile 0 is empty, the others are tileset tiles starting from 1.
+    let tileId = textureLoad(tileIds, tile, 0).r;
+    if (tileId == 0u) {
+        discard;
+    }
+
+    let tileIndex = tileId - 1u;
+    let tileOrigin = vec2<f32>(
+        f32(tileIndex % tilemapParams.tilesetColumns),
+        f32(tileIndex / tilemapParams.tilesetColumns)) *
+        tilemapParams.tileTextureSize;
+
+    // Tileset images have their top row first, world space goes up. Samples
+    // are kept half a texel of the sampled mip level inside the tile so
+    // filtering doesn't bleed into its neighbours. Once that texel is larger
+    // than the tile, the coarse levels bleed anyway, since they have already
+    // blended neighbouring tiles together.
+    let footprint = max(max(length(gradientX), length(gradientY)), 1.0);
+    let margin = min(vec2<f32>(0.5 * footprint),
+        tilemapParams.tileTextureSize * 0.5);
+    let inTile = fract(mapPosition);
+    let texel = clamp(
+        vec2<f32>(inTile.x, 1.0 - inTile.y) * tilemapParams.tileTextureSize,
+        margin, tilemapParams.tileTextureSize - margin);
+
+    let textureColor = textureSampleGrad(texture, textureSampler,
+        (tileOrigin + texel) / tilesetSize, gradientX / tilesetSize,
+        gradientY / tilesetSize);
+
+    if (textureColor.a == 0.0) {
+        discard;
+    }
+
+    return textureColor;
+}
+
+// One triangle that covers the window.
+@vertex
+fn vs_present(@builtin(vertex_index) vertexIndex: u32) ->
+    @builtin(position) vec4<f32> {
+    let corner = vec2<f32>(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+    return vec4<f32>(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+// The window's pixels line up with the top left of the target, so each one
+// copies the texel under it.
+@fragment
+fn fs_present(@builtin(position) position: vec4<f32>) -> @location(0) vec4<f32> {
+    return textureLoad(presentSource, vec2<i32>(position.xy), 0);
+}
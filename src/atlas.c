@@ -0,0 +1,351 @@
+#include "atlas.h"
+
+#include <limits.h>
+
+#include "texture.h"
+#include "wgpuHelper.h"
+
+#define defaultAtlasPageSize 2048
+
+// The skyline is the top edge of everything packed into a page so far, stored
+// as horizontal segments from left to right. Images are placed on top of it.
+typedef struct {
+    int x;
+    int y;
+    int width;
+} SkylineNode;
+
+typedef struct {
+    SkylineNode *nodes;
+    int nodeCount;
+} Skyline;
+
+typedef struct {
+    int page;
+    int x;
+    int y;
+} AtlasPlacement;
+
+static Skyline skylineCreate(int pageWidth) {
+    // Every node is at least one pixel wide, so the page width bounds the node
+    // count.
+    Skyline skyline = (Skyline){
+        .nodes = malloc((pageWidth + 1) * sizeof(SkylineNode)),
+        .nodeCount = 1,
+    };
+    skyline.nodes[0] = (SkylineNode){.x = 0, .y = 0, .width = pageWidth};
+
+    return skyline;
+}
+
+// Returns the lowest y a width x height rectangle can be placed at when its
+// left edge is at node nodeI, or -1 if it doesn't fit there.
+static int skylineFit(const Skyline *skyline, int nodeI, int width, int height,
+                      int pageWidth, int pageHeight) {
+    int x = skyline->nodes[nodeI].x;
+    if (x + width > pageWidth) {
+        return -1;
+    }
+
+    int y = 0;
+    int widthLeft = width;
+    for (int i = nodeI; widthLeft > 0; ++i) {
+        if (skyline->nodes[i].y > y) {
+            y = skyline->nodes[i].y;
+        }
+
+        if (y + height > pageHeight) {
+            return -1;
+        }
+
+        widthLeft -= skyline->nodes[i].width;
+    }
+
+    return y;
+}
+
+// Finds the position that keeps the skyline lowest, preferring narrower
+// nodes to break ties. Returns the node to place at, or -1 if nothing fits.
+static int skylineFindPosition(const Skyline *skyline, int width, int height,
+                               int pageWidth, int pageHeight, int *x, int *y) {
+    int bestNodeI = -1;
+    int bestBottom = INT_MAX;
+    int bestWidth = INT_MAX;
+
+    for (int i = 0; i < skyline->nodeCount; ++i) {
+        int fitY = skylineFit(skyline, i, width, height, pageWidth, pageHeight);
+        if (fitY < 0) {
+            continue;
+        }
+
+        int bottom = fitY + height;
+        if (bottom < bestBottom ||
+            (bottom == bestBottom && skyline->nodes[i].width < bestWidth)) {
+            bestNodeI = i;
+            bestBottom = bottom;
+            bestWidth = skyline->nodes[i].width;
+            *x = skyline->nodes[i].x;
+            *y = fitY;
+        }
+    }
+
+    return bestNodeI;
+}
+
+static void skylineRemoveNode(Skyline *skyline, int nodeI) {
+    memmove(&skyline->nodes[nodeI], &skyline->nodes[nodeI + 1],
+            (skyline->nodeCount - nodeI - 1) * sizeof(SkylineNode));
+    --skyline->nodeCount;
+}
+
+static void skylineAdd(Skyline *skyline, int nodeI, int x, int y, int width,
+                       int height) {
+    memmove(&skyline->nodes[nodeI + 1], &skyline->nodes[nodeI],
+            (skyline->nodeCount - nodeI) * sizeof(SkylineNode));
+    ++skyline->nodeCount;
+    skyline->nodes[nodeI] = (SkylineNode){.x = x, .y = y + height, .width = width};
+
+    // Trim or remove the nodes now covered by the new one.
+    int right = x + width;
+    for (int i = nodeI + 1; i < skyline->nodeCount;) {
+        SkylineNode *node = &skyline->nodes[i];
+        if (node->x >= right) {
+            break;
+        }
+
+        int overlap = right - node->x;
+        if (overlap < node->width) {
+            node->x += overlap;
+            node->width -= overlap;
+            break;
+        }
+
+        skylineRemoveNode(skyline, i);
+    }
+
+    // Merge neighbours at the same height.
+    for (int i = 0; i < skyline->nodeCount - 1;) {
+        if (skyline->nodes[i].y == skyline->nodes[i + 1].y) {
+            skyline->nodes[i].width += skyline->nodes[i + 1].width;
+            skylineRemoveNode(skyline, i + 1);
+        } else {
+            ++i;
+        }
+    }
+}
+
+typedef struct {
+    int index;
+    int width;
+    int height;
+} AtlasPackItem;
+
+// Packing tall images first keeps the skyline flat.
+static int comparePackItems(const void *a, const void *b) {
+    const AtlasPackItem *itemA = a;
+    const AtlasPackItem *itemB = b;
+
+    if (itemA->height != itemB->height) {
+        return itemB->height - itemA->height;
+    }
+
+    return itemB->width - itemA->width;
+}
+
+static uint32_t hashName(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c; ++c) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void copySurface(SDL_Surface *page, SDL_Surface *surface, int x,
+                        int y) {
+    SDL_Surface *converted = surface;
+    if (surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+        converted =
+            SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+    }
+
+    SDL_LockSurface(converted);
+    for (int row = 0; row < converted->h; ++row) {
+        memcpy((uint8_t *)page->pixels + (y + row) * page->pitch + x * 4,
+               (uint8_t *)converted->pixels + row * converted->pitch,
+               converted->w * 4);
+    }
+    SDL_UnlockSurface(converted);
+
+    if (converted != surface) {
+        SDL_FreeSurface(converted);
+    }
+}
+
+Atlas atlasCreate(const char **names, SDL_Surface **surfaces, int count,
+                  AtlasOptions options) {
+    int pageWidth =
+        options.pageWidth > 0 ? options.pageWidth : defaultAtlasPageSize;
+    int pageHeight =
+        options.pageHeight > 0 ? options.pageHeight : defaultAtlasPageSize;
+    int padding = options.padding;
+
+    AtlasPackItem *items = malloc(count * sizeof(AtlasPackItem));
+    for (int i = 0; i < count; ++i) {
+        items[i] = (AtlasPackItem){
+            .index = i,
+            .width = surfaces[i]->w + padding * 2,
+            .height = surfaces[i]->h + padding * 2,
+        };
+    }
+    qsort(items, count, sizeof(AtlasPackItem), comparePackItems);
+
+    AtlasPlacement *placements = malloc(count * sizeof(AtlasPlacement));
+    Skyline *skylines = NULL;
+    int pageCount = 0;
+
+    for (int itemI = 0; itemI < count; ++itemI) {
+        int i = items[itemI].index;
+        int width = items[itemI].width;
+        int height = items[itemI].height;
+
+        if (width > pageWidth || height > pageHeight) {
+            printf("Image %s is too large for a %dx%d atlas page\n", names[i],
+                   pageWidth, pageHeight);
+            exit(-1);
+        }
+
+        // Earlier pages are fuller, so try them first to fill their gaps.
+        int x, y;
+        int nodeI = -1;
+        int page = 0;
+        for (; page < pageCount; ++page) {
+            nodeI = skylineFindPosition(&skylines[page], width, height,
+                                        pageWidth, pageHeight, &x, &y);
+            if (nodeI >= 0) {
+                break;
+            }
+        }
+
+        if (nodeI < 0) {
+            skylines = realloc(skylines, (pageCount + 1) * sizeof(Skyline));
+            skylines[pageCount] = skylineCreate(pageWidth);
+            page = pageCount++;
+            nodeI = skylineFindPosition(&skylines[page], width, height,
+                                        pageWidth, pageHeight, &x, &y);
+        }
+
+        skylineAdd(&skylines[page], nodeI, x, y, width, height);
+        placements[i] = (AtlasPlacement){
+            .page = page,
+            .x = x + padding,
+            .y = y + padding,
+        };
+    }
+
+    for (int i = 0; i < pageCount; ++i) {
+        free(skylines[i].nodes);
+    }
+    free(skylines);
+    free(items);
+
+    // New surfaces start out cleared, so padding stays transparent.
+    SDL_Surface **pages = malloc(pageCount * sizeof(SDL_Surface *));
+    for (int i = 0; i < pageCount; ++i) {
+        pages[i] = SDL_CreateRGBSurfaceWithFormat(0, pageWidth, pageHeight, 32,
+                                                  SDL_PIXELFORMAT_RGBA32);
+    }
+
+    int regionSlotCount = 16;
+    while (regionSlotCount < count * 2) {
+        regionSlotCount *= 2;
+    }
+
+    int *regionSlots = malloc(regionSlotCount * sizeof(int));
+    for (int i = 0; i < regionSlotCount; ++i) {
+        regionSlots[i] = -1;
+    }
+
+    AtlasRegion *regions = malloc(count * sizeof(AtlasRegion));
+    for (int i = 0; i < count; ++i) {
+        AtlasPlacement placement = placements[i];
+        copySurface(pages[placement.page], surfaces[i], placement.x,
+                    placement.y);
+
+        regions[i] = (AtlasRegion){
+            .name = copyString(names[i]),
+            .page = placement.page,
+            .texX = (float)placement.x,
+            .texY = (float)placement.y,
+            .texWidth = (float)surfaces[i]->w,
+            .texHeight = (float)surfaces[i]->h,
+        };
+
+        uint32_t slotI = hashName(names[i]) & (regionSlotCount - 1);
+        while (regionSlots[slotI] >= 0) {
+            slotI = (slotI + 1) & (regionSlotCount - 1);
+        }
+        regionSlots[slotI] = i;
+    }
+
+    free(placements);
+
+    return (Atlas){
+        .pageWidth = pageWidth,
+        .pageHeight = pageHeight,
+        .pages = pages,
+        .pageCount = pageCount,
+        .regions = regions,
+        .regionCount = count,
+        .regionSlots = regionSlots,
+        .regionSlotCount = regionSlotCount,
+    };
+}
+
+Atlas atlasCreateFromPaths(const char **paths, int count, AtlasOptions options) {
+    SDL_Surface **surfaces = malloc(count * sizeof(SDL_Surface *));
+    for (int i = 0; i < count; ++i) {
+        surfaces[i] = loadSurface(paths[i]);
+    }
+
+    Atlas atlas = atlasCreate(paths, surfaces, count, options);
+
+    for (int i = 0; i < count; ++i) {
+        SDL_FreeSurface(surfaces[i]);
+    }
+    free(surfaces);
+
+    return atlas;
+}
+
+const AtlasRegion *atlasFind(const Atlas *atlas, const char *name) {
+    uint32_t slotI = hashName(name) & (atlas->regionSlotCount - 1);
+
+    while (atlas->regionSlots[slotI] >= 0) {
+        const AtlasRegion *region = &atlas->regions[atlas->regionSlots[slotI]];
+        if (strcmp(region->name, name) == 0) {
+            return region;
+        }
+
+        slotI = (slotI + 1) & (atlas->regionSlotCount - 1);
+    }
+
+    return NULL;
+}
+
+void atlasDestroy(Atlas *atlas) {
+    for (int i = 0; i < atlas->pageCount; ++i) {
+        SDL_FreeSurface(atlas->pages[i]);
+    }
+
+    for (int i = 0; i < atlas->regionCount; ++i) {
+        free(atlas->regions[i].name);
+    }
+
+    free(atlas->pages);
+    free(atlas->regions);
+    free(atlas->regionSlots);
+    *atlas = (Atlas){0};
+}
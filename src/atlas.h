@@ -0,0 +1,58 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <SDL2/SDL.h>
+
+// The area of an atlas page holding one packed image. The texture coordinates
+// are in pixels, like Sprite.texX, texY, texWidth and texHeight.
+typedef struct {
+    char *name;
+    int page;
+
+    float texX;
+    float texY;
+    float texWidth;
+    float texHeight;
+} AtlasRegion;
+
+typedef struct {
+    // Size of each page, 2048x2048 if 0.
+    int pageWidth;
+    int pageHeight;
+    // Empty pixels left around every image so filtering doesn't bleed between
+    // neighbours.
+    int padding;
+} AtlasOptions;
+
+typedef struct {
+    int pageWidth;
+    int pageHeight;
+
+    // RGBA32 surfaces holding the packed images. Pass them to
+    // textureCreateFromSurface to use them with spriteBatchCreateFromTexture.
+    SDL_Surface **pages;
+    int pageCount;
+
+    AtlasRegion *regions;
+    int regionCount;
+
+    // Open addressing hash table of region indices, -1 marks empty slots.
+    int *regionSlots;
+    int regionSlotCount;
+} Atlas;
+
+// Packs count RGBA32 surfaces into as few pages as possible. Each surface's
+// region can then be found by its name. The surfaces are only read, so the
+// caller still owns them.
+Atlas atlasCreate(const char **names, SDL_Surface **surfaces, int count,
+                  AtlasOptions options);
+
+// Loads and packs count images, naming each region after its path.
+Atlas atlasCreateFromPaths(const char **paths, int count, AtlasOptions options);
+
+// Returns NULL if no region has the given name.
+const AtlasRegion *atlasFind(const Atlas *atlas, const char *name);
+
+void atlasDestroy(Atlas *atlas);
+
+#endif
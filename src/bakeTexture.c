@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bakedTexture.h"
+#include "texture.h"
+
+// Converts images to baked textures ahead of time:
+// BakeTexture [--no-mips] input.png output.w2dt
+int main(int argc, char *argv[]) {
+    bool generateMips = true;
+    int argI = 1;
+    if (argI < argc && strcmp(argv[argI], "--no-mips") == 0) {
+        generateMips = false;
+        ++argI;
+    }
+
+    if (argc - argI != 2) {
+        printf("Usage: %s [--no-mips] input output\n", argv[0]);
+        return -1;
+    }
+
+    SDL_Surface *surface = loadSurface(argv[argI]);
+    bakedTextureWrite(argv[argI + 1], surface, generateMips);
+    SDL_FreeSurface(surface);
+
+    return 0;
+}
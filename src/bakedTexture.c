@@ -0,0 +1,310 @@
+#include "bakedTexture.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} FileMapping;
+
+static bool mapFile(const char *path, FileMapping *fileMapping) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    const uint8_t *data = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mapping) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!data) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+
+    *fileMapping = (FileMapping){
+        .data = data,
+        .size = (size_t)size.QuadPart,
+        .file = file,
+        .mapping = mapping,
+    };
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    void *data = MAP_FAILED;
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) {
+        data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    // The mapping keeps the file alive on its own.
+    close(file);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    *fileMapping = (FileMapping){
+        .data = data,
+        .size = (size_t)fileStat.st_size,
+    };
+#endif
+
+    return true;
+}
+
+static void unmapFile(FileMapping *fileMapping) {
+#ifdef _WIN32
+    UnmapViewOfFile(fileMapping->data);
+    CloseHandle(fileMapping->mapping);
+    CloseHandle(fileMapping->file);
+#else
+    munmap((void *)fileMapping->data, fileMapping->size);
+#endif
+    *fileMapping = (FileMapping){0};
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Averages each 2x2 block of source into one texel of destination. Odd
+// source sizes repeat their last row or column.
+static void downsample(const uint8_t *source, uint32_t sourceWidth,
+                       uint32_t sourceHeight, uint32_t sourceBytesPerRow,
+                       uint8_t *destination, uint32_t width, uint32_t height,
+                       uint32_t bytesPerRow) {
+    for (uint32_t y = 0; y < height; ++y) {
+        uint32_t y0 = y * 2 < sourceHeight ? y * 2 : sourceHeight - 1;
+        uint32_t y1 = y * 2 + 1 < sourceHeight ? y * 2 + 1 : y0;
+        const uint8_t *row0 = source + y0 * sourceBytesPerRow;
+        const uint8_t *row1 = source + y1 * sourceBytesPerRow;
+        uint8_t *destinationRow = destination + y * bytesPerRow;
+
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t x0 = x * 2 < sourceWidth ? x * 2 : sourceWidth - 1;
+            uint32_t x1 = x * 2 + 1 < sourceWidth ? x * 2 + 1 : x0;
+
+            for (int channel = 0; channel < 4; ++channel) {
+                uint32_t sum = row0[x0 * 4 + channel] + row0[x1 * 4 + channel] +
+                               row1[x0 * 4 + channel] + row1[x1 * 4 + channel];
+                destinationRow[x * 4 + channel] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+// Converts a header between the file's little endian layout and the host's
+// byte order, in either direction.
+static BakedTextureHeader swapHeader(BakedTextureHeader header) {
+    return (BakedTextureHeader){
+        .magic = SDL_SwapLE32(header.magic),
+        .version = SDL_SwapLE32(header.version),
+        .width = SDL_SwapLE32(header.width),
+        .height = SDL_SwapLE32(header.height),
+        .mipLevelCount = SDL_SwapLE32(header.mipLevelCount),
+        .flags = SDL_SwapLE32(header.flags),
+    };
+}
+
+static BakedTextureMip swapMip(BakedTextureMip mip) {
+    return (BakedTextureMip){
+        .offset = SDL_SwapLE64(mip.offset),
+        .width = SDL_SwapLE32(mip.width),
+        .height = SDL_SwapLE32(mip.height),
+        .bytesPerRow = SDL_SwapLE32(mip.bytesPerRow),
+        .padding = SDL_SwapLE32(mip.padding),
+    };
+}
+
+void bakedTextureWrite(const char *path, SDL_Surface *surface,
+                       bool generateMips) {
+    uint32_t width = (uint32_t)surface->w;
+    uint32_t height = (uint32_t)surface->h;
+    uint32_t mipLevelCount =
+        generateMips ? textureMipLevelCount(width, height) : 1;
+    // Textures too large for the mip table keep their largest levels.
+    if (mipLevelCount > maxBakedTextureMips) {
+        mipLevelCount = maxBakedTextureMips;
+    }
+
+    // Lay out every level after the header and mip table.
+    BakedTextureMip mips[maxBakedTextureMips];
+    uint64_t offset = sizeof(BakedTextureHeader) +
+                      mipLevelCount * sizeof(BakedTextureMip);
+    for (uint32_t level = 0; level < mipLevelCount; ++level) {
+        uint32_t mipWidth = width >> level > 0 ? width >> level : 1;
+        uint32_t mipHeight = height >> level > 0 ? height >> level : 1;
+        offset = alignUp(offset, bakedTextureRowAlignment);
+
+        mips[level] = (BakedTextureMip){
+            .offset = offset,
+            .width = mipWidth,
+            .height = mipHeight,
+            .bytesPerRow =
+                (uint32_t)alignUp(mipWidth * 4, bakedTextureRowAlignment),
+        };
+        offset += (uint64_t)mips[level].bytesPerRow * mipHeight;
+    }
+
+    // Build the whole file in memory, the padding stays zeroed.
+    uint8_t *file = calloc(offset, 1);
+
+    SDL_LockSurface(surface);
+    uint32_t flags = 0;
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t *row = (uint8_t *)surface->pixels + y * surface->pitch;
+        memcpy(file + mips[0].offset + y * mips[0].bytesPerRow, row,
+               width * 4);
+
+        for (uint32_t x = 0; x < width; ++x) {
+            uint8_t alpha = row[x * 4 + 3];
+            if (alpha != 0 && alpha != 255) {
+                flags |= bakedTextureFlagTranslucent;
+            }
+        }
+    }
+    SDL_UnlockSurface(surface);
+
+    for (uint32_t level = 1; level < mipLevelCount; ++level) {
+        downsample(file + mips[level - 1].offset, mips[level - 1].width,
+                   mips[level - 1].height, mips[level - 1].bytesPerRow,
+                   file + mips[level].offset, mips[level].width,
+                   mips[level].height, mips[level].bytesPerRow);
+    }
+
+    BakedTextureHeader header = (BakedTextureHeader){
+        .magic = bakedTextureMagic,
+        .version = bakedTextureVersion,
+        .width = width,
+        .height = height,
+        .mipLevelCount = mipLevelCount,
+        .flags = flags,
+    };
+    header = swapHeader(header);
+    memcpy(file, &header, sizeof(BakedTextureHeader));
+    for (uint32_t level = 0; level < mipLevelCount; ++level) {
+        BakedTextureMip mip = swapMip(mips[level]);
+        memcpy(file + sizeof(BakedTextureHeader) +
+                   level * sizeof(BakedTextureMip),
+               &mip, sizeof(BakedTextureMip));
+    }
+
+    FILE *output = fopen(path, "wb");
+    if (!output || fwrite(file, 1, offset, output) != offset) {
+        printf("Failed to write baked texture at path: %s\n", path);
+        exit(-1);
+    }
+
+    fclose(output);
+    free(file);
+}
+
+TextureInfo bakedTextureCreate(WGPUDevice device, WGPUQueue queue,
+                               ObjectCache *objectCache, const char *path,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips) {
+    FileMapping fileMapping;
+    if (!mapFile(path, &fileMapping)) {
+        printf("Failed to load file at path: %s\n", path);
+        exit(-1);
+    }
+
+    BakedTextureHeader header;
+    if (fileMapping.size < sizeof(BakedTextureHeader)) {
+        printf("Baked texture %s is truncated\n", path);
+        exit(-1);
+    }
+    memcpy(&header, fileMapping.data, sizeof(BakedTextureHeader));
+    header = swapHeader(header);
+
+    if (header.magic != bakedTextureMagic ||
+        header.version != bakedTextureVersion || header.width == 0 ||
+        header.height == 0 || header.mipLevelCount < 1 ||
+        header.mipLevelCount > maxBakedTextureMips ||
+        header.mipLevelCount >
+            textureMipLevelCount(header.width, header.height)) {
+        printf("%s isn't a supported baked texture\n", path);
+        exit(-1);
+    }
+
+    // Check every level against the file size before handing the mapped
+    // memory to WebGPU.
+    TextureMipLevel mipLevels[maxBakedTextureMips];
+    size_t mipTableEnd = sizeof(BakedTextureHeader) +
+                         header.mipLevelCount * sizeof(BakedTextureMip);
+    if (fileMapping.size < mipTableEnd) {
+        printf("Baked texture %s is truncated\n", path);
+        exit(-1);
+    }
+
+    for (uint32_t level = 0; level < header.mipLevelCount; ++level) {
+        BakedTextureMip mip;
+        memcpy(&mip,
+               fileMapping.data + sizeof(BakedTextureHeader) +
+                   level * sizeof(BakedTextureMip),
+               sizeof(BakedTextureMip));
+        mip = swapMip(mip);
+
+        // Each level has to halve the previous one, like the levels of the
+        // texture it is uploaded to, and keep the rows WebGPU copies aligned.
+        uint32_t expectedWidth =
+            header.width >> level > 0 ? header.width >> level : 1;
+        uint32_t expectedHeight =
+            header.height >> level > 0 ? header.height >> level : 1;
+        if (mip.width != expectedWidth || mip.height != expectedHeight ||
+            mip.bytesPerRow % bakedTextureRowAlignment != 0) {
+            printf("%s isn't a supported baked texture\n", path);
+            exit(-1);
+        }
+
+        uint64_t levelSize = (uint64_t)mip.bytesPerRow * mip.height;
+        if (mip.bytesPerRow < (uint64_t)mip.width * 4 ||
+            mip.offset > fileMapping.size ||
+            levelSize > fileMapping.size - mip.offset) {
+            printf("Baked texture %s is truncated\n", path);
+            exit(-1);
+        }
+
+        mipLevels[level] = (TextureMipLevel){
+            .data = fileMapping.data + mip.offset,
+            .width = mip.width,
+            .height = mip.height,
+            .bytesPerRow = mip.bytesPerRow,
+        };
+    }
+
+    // wgpuQueueWriteTexture copies the texels before returning, so the file
+    // can be unmapped right away.
+    TextureInfo textureInfo = textureCreateFromMips(
+        device, queue, objectCache, mipLevels, header.mipLevelCount,
+        (header.flags & bakedTextureFlagTranslucent) != 0, wrapMode,
+        filteringMode, generateMips);
+    unmapFile(&fileMapping);
+
+    return textureInfo;
+}
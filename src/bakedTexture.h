@@ -0,0 +1,57 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "texture.h"
+
+// Baked textures hold RGBA8 texels that can be uploaded without decoding or
+// converting them. A file starts with a BakedTextureHeader, followed by one
+// BakedTextureMip per mip level and then the texels of each level. Rows are
+// padded to bakedTextureRowAlignment bytes, the alignment WebGPU uses for
+// texture copies, so the mapped file is handed to wgpuQueueWriteTexture
+// as is. Header and mip table values are little endian.
+
+// "W2DT" read as a little endian integer.
+#define bakedTextureMagic 0x54443257u
+#define bakedTextureVersion 1
+#define bakedTextureRowAlignment 256
+#define maxBakedTextureMips 16
+
+// Set when any texel is partly transparent, see TextureInfo.hasTranslucency.
+#define bakedTextureFlagTranslucent 1u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevelCount;
+    uint32_t flags;
+} BakedTextureHeader;
+
+typedef struct {
+    // From the start of the file, aligned to bakedTextureRowAlignment.
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t padding;
+} BakedTextureMip;
+
+// Writes an RGBA32 surface to path, with every mip level down to 1x1 if
+// generateMips is set.
+void bakedTextureWrite(const char *path, SDL_Surface *surface,
+                       bool generateMips);
+
+// Maps the baked texture at path into memory and uploads it from there. With
+// generateMips, textures baked without mip levels get them generated on the
+// GPU, baked mip levels are used as they are.
+TextureInfo bakedTextureCreate(WGPUDevice device, WGPUQueue queue,
+                               ObjectCache *objectCache, const char *path,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips);
+
+#endif
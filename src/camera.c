@@ -0,0 +1,59 @@
+#include "camera.h"
+
+#include <math.h>
+
+Camera cameraCreate(float x, float y, float zoom) {
+    return (Camera){
+        .x = x,
+        .y = y,
+        .isCentered = true,
+        .zoom = zoom,
+    };
+}
+
+CameraViewport cameraViewport(const Camera *camera, float targetWidth,
+                              float targetHeight) {
+    if (camera->viewportWidth <= 0.0f || camera->viewportHeight <= 0.0f) {
+        return (CameraViewport){
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = targetWidth,
+            .height = targetHeight,
+        };
+    }
+
+    // Render passes reject viewports that leave the target, which can happen
+    // after the window shrinks.
+    float x = fminf(fmaxf(camera->viewportX, 0.0f), targetWidth);
+    float y = fminf(fmaxf(camera->viewportY, 0.0f), targetHeight);
+
+    return (CameraViewport){
+        .x = x,
+        .y = y,
+        .width = fminf(camera->viewportWidth, targetWidth - x),
+        .height = fminf(camera->viewportHeight, targetHeight - y),
+    };
+}
+
+CameraRect cameraVisibleRect(const Camera *camera, float targetWidth,
+                             float targetHeight) {
+    CameraViewport viewport =
+        cameraViewport(camera, targetWidth, targetHeight);
+    float zoom = camera->zoom > 0.0f ? camera->zoom : 1.0f;
+    float width = viewport.width / zoom;
+    float height = viewport.height / zoom;
+
+    float left = 0.0f;
+    float bottom = 0.0f;
+    if (camera->isCentered) {
+        left = camera->x - width * 0.5f;
+        bottom = camera->y - height * 0.5f;
+    }
+
+    return (CameraRect){
+        .left = left,
+        .bottom = bottom,
+        .right = left + width,
+        .top = bottom + height,
+    };
+}
@@ -0,0 +1,56 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stdbool.h>
+
+// A rectangle in world units, from (left, bottom) to (right, top).
+typedef struct {
+    float left;
+    float bottom;
+    float right;
+    float top;
+} CameraRect;
+
+// An area of a render target in pixels, from the top left corner.
+typedef struct {
+    float x;
+    float y;
+    float width;
+    float height;
+} CameraViewport;
+
+// Describes which part of the world is drawn and where. A zero initialized
+// camera shows the world from (0, 0) at one unit per pixel over the whole
+// render target, like the renderer did without a camera.
+typedef struct {
+    // World position shown at the center of the viewport. Ignored while
+    // isCentered is false, then the world origin is at the viewport's
+    // bottom left corner.
+    float x;
+    float y;
+    bool isCentered;
+    // Pixels per world unit, 1 if 0.
+    float zoom;
+
+    // Area of the render target to draw into, in pixels from the top left
+    // corner. The whole target is used if the width or height is 0.
+    float viewportX;
+    float viewportY;
+    float viewportWidth;
+    float viewportHeight;
+} Camera;
+
+// Returns a camera centered on (x, y).
+Camera cameraCreate(float x, float y, float zoom);
+
+// Returns the area of the viewport for a target of the given size, clamped to
+// the target.
+CameraViewport cameraViewport(const Camera *camera, float targetWidth,
+                              float targetHeight);
+
+// Returns the part of the world that is visible on a target of the given
+// size.
+CameraRect cameraVisibleRect(const Camera *camera, float targetWidth,
+                             float targetHeight);
+
+#endif
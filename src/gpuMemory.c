@@ -0,0 +1,142 @@
+#include "gpuMemory.h"
+
+#include <SDL2/SDL.h>
+
+#include "wgpuHelper.h"
+
+#define initialTrackedCapacity 256
+
+typedef struct {
+    const void *resource;
+    uint64_t bytes;
+    GpuMemoryCategory category;
+} TrackedResource;
+
+// Open addressing hash table from resources to their sizes, NULL marks empty
+// slots. Resources are created and released on different threads, so every
+// access holds the lock.
+static SDL_SpinLock trackedLock;
+static TrackedResource *trackedResources;
+static int trackedCapacity;
+static GpuMemoryStats stats;
+
+static uint32_t hashResource(const void *resource) {
+    return (uint32_t)hashPointer(resource);
+}
+
+static void insertResource(TrackedResource tracked) {
+    uint32_t slotI = hashResource(tracked.resource) & (trackedCapacity - 1);
+    while (trackedResources[slotI].resource) {
+        slotI = (slotI + 1) & (trackedCapacity - 1);
+    }
+
+    trackedResources[slotI] = tracked;
+}
+
+static void growTrackedResources(void) {
+    TrackedResource *oldResources = trackedResources;
+    int oldCapacity = trackedCapacity;
+
+    trackedCapacity =
+        trackedCapacity > 0 ? trackedCapacity * 2 : initialTrackedCapacity;
+    trackedResources = calloc(trackedCapacity, sizeof(TrackedResource));
+
+    for (int i = 0; i < oldCapacity; ++i) {
+        if (oldResources[i].resource) {
+            insertResource(oldResources[i]);
+        }
+    }
+
+    free(oldResources);
+}
+
+void gpuMemoryTrack(const void *resource, GpuMemoryCategory category,
+                    uint64_t bytes) {
+    if (!resource) {
+        return;
+    }
+
+    SDL_AtomicLock(&trackedLock);
+
+    // Stay at most half full to keep probes short.
+    if ((stats.resourceCount + 1) * 2 > trackedCapacity) {
+        growTrackedResources();
+    }
+
+    insertResource((TrackedResource){
+        .resource = resource,
+        .bytes = bytes,
+        .category = category,
+    });
+    ++stats.resourceCount;
+    stats.bytes[category] += bytes;
+    stats.totalBytes += bytes;
+
+    SDL_AtomicUnlock(&trackedLock);
+}
+
+void gpuMemoryUntrack(const void *resource) {
+    if (!resource) {
+        return;
+    }
+
+    SDL_AtomicLock(&trackedLock);
+
+    if (trackedCapacity == 0) {
+        SDL_AtomicUnlock(&trackedLock);
+        return;
+    }
+
+    uint32_t mask = trackedCapacity - 1;
+    uint32_t slotI = hashResource(resource) & mask;
+    while (trackedResources[slotI].resource &&
+           trackedResources[slotI].resource != resource) {
+        slotI = (slotI + 1) & mask;
+    }
+
+    TrackedResource tracked = trackedResources[slotI];
+    if (!tracked.resource) {
+        SDL_AtomicUnlock(&trackedLock);
+        return;
+    }
+
+    --stats.resourceCount;
+    stats.bytes[tracked.category] -= tracked.bytes;
+    stats.totalBytes -= tracked.bytes;
+
+    // Shift later entries of the probe sequence back into the hole, so
+    // lookups never stop early at it.
+    uint32_t holeI = slotI;
+    for (uint32_t i = (holeI + 1) & mask; trackedResources[i].resource;
+         i = (i + 1) & mask) {
+        uint32_t homeI = hashResource(trackedResources[i].resource) & mask;
+        if (((i - homeI) & mask) >= ((i - holeI) & mask)) {
+            trackedResources[holeI] = trackedResources[i];
+            holeI = i;
+        }
+    }
+    trackedResources[holeI] = (TrackedResource){0};
+
+    SDL_AtomicUnlock(&trackedLock);
+}
+
+GpuMemoryStats gpuMemoryGetStats(void) {
+    SDL_AtomicLock(&trackedLock);
+    GpuMemoryStats currentStats = stats;
+    SDL_AtomicUnlock(&trackedLock);
+
+    return currentStats;
+}
+
+uint64_t gpuMemoryTextureSize(uint32_t width, uint32_t height,
+                              uint32_t layerCount, uint32_t mipLevelCount,
+                              uint32_t bytesPerTexel) {
+    uint64_t size = 0;
+    for (uint32_t level = 0; level < mipLevelCount; ++level) {
+        size += (uint64_t)width * height * bytesPerTexel;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    return size * layerCount;
+}
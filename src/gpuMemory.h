@@ -0,0 +1,39 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+#include <inttypes.h>
+
+typedef enum {
+    GpuMemoryVertex,
+    GpuMemoryIndex,
+    GpuMemoryUniform,
+    // Buffers the CPU maps to upload or read back data.
+    GpuMemoryStaging,
+    GpuMemoryTexture,
+    GpuMemoryDepth,
+    // Indirect draw arguments, query results and other small buffers.
+    GpuMemoryOther,
+    GpuMemoryCategoryCount,
+} GpuMemoryCategory;
+
+typedef struct {
+    uint64_t bytes[GpuMemoryCategoryCount];
+    uint64_t totalBytes;
+    int resourceCount;
+} GpuMemoryStats;
+
+// Counts the bytes held by a buffer or texture until it is untracked. Sizes are
+// what was requested, drivers may round them up. Safe to call from any thread.
+void gpuMemoryTrack(const void *resource, GpuMemoryCategory category,
+                    uint64_t bytes);
+// Stops counting a resource, resources that aren't tracked are ignored.
+void gpuMemoryUntrack(const void *resource);
+// Returns the bytes held by every tracked resource that is still alive.
+GpuMemoryStats gpuMemoryGetStats(void);
+
+// Returns the size of a texture with the given number of mip levels.
+uint64_t gpuMemoryTextureSize(uint32_t width, uint32_t height,
+                              uint32_t layerCount, uint32_t mipLevelCount,
+                              uint32_t bytesPerTexel);
+
+#endif
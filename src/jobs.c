@@ -0,0 +1,257 @@
+#include "jobs.h"
+
+#define jobQueueCapacity 4096
+
+// Keeps the indices from growing forever. Must be called with the lock held.
+static void resetIfEmpty(JobQueue *queue) {
+    if (queue->top == queue->bottom) {
+        queue->top = 0;
+        queue->bottom = 0;
+    }
+}
+
+static bool jobQueuePush(JobQueue *queue, Job job) {
+    SDL_AtomicLock(&queue->lock);
+
+    bool isFull = queue->bottom - queue->top >= queue->capacity;
+    if (!isFull) {
+        queue->jobs[queue->bottom % queue->capacity] = job;
+        ++queue->bottom;
+    }
+
+    SDL_AtomicUnlock(&queue->lock);
+
+    return !isFull;
+}
+
+static bool jobQueuePop(JobQueue *queue, Job *job) {
+    SDL_AtomicLock(&queue->lock);
+
+    bool isEmpty = queue->bottom == queue->top;
+    if (!isEmpty) {
+        --queue->bottom;
+        *job = queue->jobs[queue->bottom % queue->capacity];
+        resetIfEmpty(queue);
+    }
+
+    SDL_AtomicUnlock(&queue->lock);
+
+    return !isEmpty;
+}
+
+static bool jobQueueSteal(JobQueue *queue, Job *job) {
+    // Skip queues that are busy instead of waiting on them, another queue
+    // probably has work too.
+    if (!SDL_AtomicTryLock(&queue->lock)) {
+        return false;
+    }
+
+    bool isEmpty = queue->bottom == queue->top;
+    if (!isEmpty) {
+        *job = queue->jobs[queue->top % queue->capacity];
+        ++queue->top;
+        resetIfEmpty(queue);
+    }
+
+    SDL_AtomicUnlock(&queue->lock);
+
+    return !isEmpty;
+}
+
+static void runJob(Job job) {
+    job.function(job.data);
+
+    if (job.counter) {
+        SDL_AtomicAdd(&job.counter->remaining, -1);
+    }
+}
+
+// Returns the index of the worker running on the calling thread, or -1 if it
+// isn't one of the job system's workers.
+static int currentWorkerI(JobSystem *jobSystem) {
+    SDL_threadID threadId = SDL_ThreadID();
+
+    for (int i = 0; i < jobSystem->workerCount; ++i) {
+        if (jobSystem->workers[i].threadId == threadId) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Runs one job, preferring the given worker's own queue before stealing from
+// the others. Returns false if no job was found.
+static bool runNextJob(JobSystem *jobSystem, int workerI) {
+    Job job;
+
+    if (workerI >= 0 && jobQueuePop(&jobSystem->queues[workerI], &job)) {
+        runJob(job);
+        return true;
+    }
+
+    int start = workerI >= 0 ? workerI + 1 : 0;
+    for (int i = 0; i < jobSystem->workerCount; ++i) {
+        int victimI = (start + i) % jobSystem->workerCount;
+
+        if (jobQueueSteal(&jobSystem->queues[victimI], &job)) {
+            runJob(job);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int workerMain(void *data) {
+    JobWorker *worker = data;
+    JobSystem *jobSystem = worker->jobSystem;
+
+    while (SDL_AtomicGet(&jobSystem->isRunning)) {
+        if (!runNextJob(jobSystem, worker->workerI)) {
+            SDL_SemWaitTimeout(jobSystem->wakeSemaphore, 1);
+        }
+    }
+
+    return 0;
+}
+
+JobSystem *jobSystemCreate(int workerCount) {
+    if (workerCount <= 0) {
+        workerCount = SDL_GetCPUCount() - 1;
+    }
+
+    if (workerCount < 1) {
+        workerCount = 1;
+    }
+
+    JobSystem *jobSystem = calloc(1, sizeof(JobSystem));
+    jobSystem->workerCount = workerCount;
+    jobSystem->workers = calloc(workerCount, sizeof(JobWorker));
+    jobSystem->queues = calloc(workerCount, sizeof(JobQueue));
+    jobSystem->wakeSemaphore = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&jobSystem->isRunning, 1);
+
+    for (int i = 0; i < workerCount; ++i) {
+        jobSystem->queues[i] = (JobQueue){
+            .jobs = malloc(jobQueueCapacity * sizeof(Job)),
+            .capacity = jobQueueCapacity,
+        };
+    }
+
+    for (int i = 0; i < workerCount; ++i) {
+        JobWorker *worker = &jobSystem->workers[i];
+        worker->jobSystem = jobSystem;
+        worker->workerI = i;
+        worker->thread = SDL_CreateThread(workerMain, "Job Worker", worker);
+
+        if (!worker->thread) {
+            printf("Cannot create job worker thread: %s\n", SDL_GetError());
+            exit(-1);
+        }
+
+        worker->threadId = SDL_GetThreadID(worker->thread);
+    }
+
+    return jobSystem;
+}
+
+void jobSystemDestroy(JobSystem *jobSystem) {
+    SDL_AtomicSet(&jobSystem->isRunning, 0);
+
+    for (int i = 0; i < jobSystem->workerCount; ++i) {
+        SDL_SemPost(jobSystem->wakeSemaphore);
+    }
+
+    for (int i = 0; i < jobSystem->workerCount; ++i) {
+        SDL_WaitThread(jobSystem->workers[i].thread, NULL);
+        free(jobSystem->queues[i].jobs);
+    }
+
+    SDL_DestroySemaphore(jobSystem->wakeSemaphore);
+    free(jobSystem->queues);
+    free(jobSystem->workers);
+    free(jobSystem);
+}
+
+void jobSystemSubmit(JobSystem *jobSystem, JobFunction function, void *data,
+                     JobCounter *counter) {
+    Job job = (Job){
+        .function = function,
+        .data = data,
+        .counter = counter,
+    };
+
+    if (counter) {
+        SDL_AtomicAdd(&counter->remaining, 1);
+    }
+
+    int queueI = currentWorkerI(jobSystem);
+    if (queueI < 0) {
+        queueI = (unsigned int)SDL_AtomicAdd(&jobSystem->nextQueue, 1) %
+                 jobSystem->workerCount;
+    }
+
+    // Run the job right away when its queue is full rather than growing it.
+    if (!jobQueuePush(&jobSystem->queues[queueI], job)) {
+        runJob(job);
+        return;
+    }
+
+    SDL_SemPost(jobSystem->wakeSemaphore);
+}
+
+void jobSystemWait(JobSystem *jobSystem, JobCounter *counter) {
+    int workerI = currentWorkerI(jobSystem);
+
+    while (SDL_AtomicGet(&counter->remaining) > 0) {
+        if (!runNextJob(jobSystem, workerI)) {
+            SDL_Delay(0);
+        }
+    }
+}
+
+typedef struct {
+    JobRangeFunction function;
+    void *data;
+    int start;
+    int end;
+} JobRange;
+
+static void runJobRange(void *data) {
+    JobRange *range = data;
+    range->function(range->data, range->start, range->end);
+}
+
+void jobSystemParallelFor(JobSystem *jobSystem, int count, int rangeSize,
+                          JobRangeFunction function, void *data) {
+    if (count <= 0) {
+        return;
+    }
+
+    // A few ranges per thread lets workers that finish early steal the rest.
+    if (rangeSize <= 0) {
+        int threadCount = jobSystem->workerCount + 1;
+        rangeSize = (count + threadCount * 4 - 1) / (threadCount * 4);
+    }
+
+    int rangeCount = (count + rangeSize - 1) / rangeSize;
+    JobRange *ranges = malloc(rangeCount * sizeof(JobRange));
+    JobCounter counter = {0};
+
+    for (int i = 0; i < rangeCount; ++i) {
+        int start = i * rangeSize;
+        int end = start + rangeSize < count ? start + rangeSize : count;
+
+        ranges[i] = (JobRange){
+            .function = function,
+            .data = data,
+            .start = start,
+            .end = end,
+        };
+        jobSystemSubmit(jobSystem, runJobRange, &ranges[i], &counter);
+    }
+
+    jobSystemWait(jobSystem, &counter);
+    free(ranges);
+}
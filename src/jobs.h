@@ -0,0 +1,72 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <SDL2/SDL.h>
+
+typedef void (*JobFunction)(void *data);
+typedef void (*JobRangeFunction)(void *data, int start, int end);
+
+// Tracks how many jobs submitted with it haven't finished yet. Must be zero
+// initialized before its first use.
+typedef struct {
+    SDL_atomic_t remaining;
+} JobCounter;
+
+typedef struct {
+    JobFunction function;
+    void *data;
+    JobCounter *counter;
+} Job;
+
+// A double ended queue of jobs owned by one worker. The owner pushes and pops
+// at the bottom, other threads steal from the top.
+typedef struct {
+    SDL_SpinLock lock;
+    Job *jobs;
+    int capacity;
+    int top;
+    int bottom;
+} JobQueue;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct {
+    JobSystem *jobSystem;
+    int workerI;
+    SDL_Thread *thread;
+    SDL_threadID threadId;
+} JobWorker;
+
+struct JobSystem {
+    JobWorker *workers;
+    JobQueue *queues;
+    int workerCount;
+
+    // Posted once per submitted job so idle workers can sleep.
+    SDL_sem *wakeSemaphore;
+    SDL_atomic_t isRunning;
+    SDL_atomic_t nextQueue;
+};
+
+// Starts workerCount worker threads, or one less than the number of CPU cores
+// if workerCount is 0, since threads waiting on jobs help run them.
+JobSystem *jobSystemCreate(int workerCount);
+void jobSystemDestroy(JobSystem *jobSystem);
+
+// Queues a job, which may run on any worker. Jobs submitted from a worker are
+// queued on that worker first. If counter isn't NULL it is incremented now and
+// decremented once the job has finished.
+void jobSystemSubmit(JobSystem *jobSystem, JobFunction function, void *data,
+                     JobCounter *counter);
+
+// Runs queued jobs on the calling thread until every job submitted with
+// counter has finished.
+void jobSystemWait(JobSystem *jobSystem, JobCounter *counter);
+
+// Calls function for consecutive ranges covering 0 to count, spread across
+// all workers, and waits for them to finish. Ranges hold up to rangeSize
+// elements, or a size picked from the worker count if rangeSize is 0.
+void jobSystemParallelFor(JobSystem *jobSystem, int count, int rangeSize,
+                          JobRangeFunction function, void *data);
+
+#endif
@@ -19,7 +19,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    Renderer renderer = rendererCreate(window, "shader.wgsl");
+    Renderer renderer =
+        rendererCreate(window, "shader.wgsl", (RendererOptions){
+                           .presentMode = RendererPresentModeFifo,
+                           .maxFramesInFlight = 2,
+                       });
 
     SpriteBatch spriteBatch =
         spriteBatchCreate(10, "test.png", &renderer, (SpriteBatchOptions){
@@ -64,6 +68,9 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    spriteBatchDestroy(&spriteBatch, &renderer);
+    rendererDestroy(&renderer);
+    SDL_DestroyWindow(window);
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,401 @@
+#include "objectCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wgpuHelper.h"
+
+#define initialTableCapacity 16
+
+// Descriptor fields are appended one at a time, so struct padding and
+// pointers that don't affect the result never end up in the key.
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} CacheKey;
+
+static void keyAppend(CacheKey *key, const void *data, size_t size) {
+    if (key->size + size > key->capacity) {
+        key->capacity = key->capacity * 2 + size;
+        key->data = realloc(key->data, key->capacity);
+    }
+
+    memcpy(key->data + key->size, data, size);
+    key->size += size;
+}
+
+static void keyAppendU32(CacheKey *key, uint32_t value) {
+    keyAppend(key, &value, sizeof(value));
+}
+
+static void keyAppendU64(CacheKey *key, uint64_t value) {
+    keyAppend(key, &value, sizeof(value));
+}
+
+static void keyAppendFloat(CacheKey *key, float value) {
+    keyAppend(key, &value, sizeof(value));
+}
+
+static void keyAppendPointer(CacheKey *key, const void *pointer) {
+    keyAppendU64(key, (uint64_t)(uintptr_t)pointer);
+}
+
+static void keyAppendString(CacheKey *key, const char *string) {
+    if (!string) {
+        keyAppendU64(key, UINT64_MAX);
+        return;
+    }
+
+    size_t length = strlen(string);
+    keyAppendU64(key, length);
+    keyAppend(key, string, length);
+}
+
+static uint64_t hashKey(const CacheKey *key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < key->size; ++i) {
+        hash ^= key->data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static ObjectCacheEntry *tableSlot(ObjectCacheEntry *entries, int capacity,
+                                   uint64_t hash, const CacheKey *key) {
+    int slotI = (int)(hash & (uint64_t)(capacity - 1));
+
+    while (entries[slotI].key) {
+        ObjectCacheEntry *entry = &entries[slotI];
+        if (entry->hash == hash && entry->keySize == key->size &&
+            memcmp(entry->key, key->data, key->size) == 0) {
+            break;
+        }
+
+        slotI = (slotI + 1) & (capacity - 1);
+    }
+
+    return &entries[slotI];
+}
+
+static void tableGrow(ObjectCacheTable *table) {
+    int capacity =
+        table->capacity > 0 ? table->capacity * 2 : initialTableCapacity;
+    ObjectCacheEntry *entries = calloc(capacity, sizeof(ObjectCacheEntry));
+
+    for (int i = 0; i < table->capacity; ++i) {
+        ObjectCacheEntry *entry = &table->entries[i];
+        if (!entry->key) {
+            continue;
+        }
+
+        CacheKey key = {.data = entry->key, .size = entry->keySize};
+        *tableSlot(entries, capacity, entry->hash, &key) = *entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// Returns the cached object for key, or NULL after counting a miss. The key
+// is freed on a hit, otherwise it must be passed on to tableInsert.
+static void *tableFind(ObjectCacheTable *table, CacheKey *key) {
+    if (table->capacity > 0) {
+        ObjectCacheEntry *entry =
+            tableSlot(table->entries, table->capacity, hashKey(key), key);
+
+        if (entry->key) {
+            ++table->hitCount;
+            free(key->data);
+            return entry->object;
+        }
+    }
+
+    ++table->missCount;
+    return NULL;
+}
+
+// Takes ownership of the key's data.
+static void tableInsert(ObjectCacheTable *table, CacheKey *key, void *object) {
+    // Keep the table at most half full so probe sequences stay short.
+    if ((table->entryCount + 1) * 2 > table->capacity) {
+        tableGrow(table);
+    }
+
+    uint64_t hash = hashKey(key);
+    *tableSlot(table->entries, table->capacity, hash, key) = (ObjectCacheEntry){
+        .hash = hash,
+        .key = key->data,
+        .keySize = key->size,
+        .object = object,
+    };
+    ++table->entryCount;
+}
+
+typedef void (*DropFunction)(void *object);
+
+static void tableDestroy(ObjectCacheTable *table, DropFunction drop) {
+    for (int i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].key) {
+            drop(table->entries[i].object);
+            free(table->entries[i].key);
+        }
+    }
+
+    free(table->entries);
+    *table = (ObjectCacheTable){0};
+}
+
+static void dropSampler(void *object) { wgpuSamplerDrop(object); }
+static void dropBindGroupLayout(void *object) {
+    wgpuBindGroupLayoutDrop(object);
+}
+static void dropShaderModule(void *object) { wgpuShaderModuleDrop(object); }
+static void dropPipeline(void *object) { wgpuRenderPipelineDrop(object); }
+
+ObjectCache objectCacheCreate(WGPUDevice device) {
+    return (ObjectCache){
+        .device = device,
+    };
+}
+
+void objectCacheDestroy(ObjectCache *objectCache) {
+    // Pipelines may reference the other objects, so release them first.
+    tableDestroy(&objectCache->pipelines, dropPipeline);
+    tableDestroy(&objectCache->bindGroupLayouts, dropBindGroupLayout);
+    tableDestroy(&objectCache->samplers, dropSampler);
+    tableDestroy(&objectCache->shaderModules, dropShaderModule);
+}
+
+WGPUSampler objectCacheGetSampler(ObjectCache *objectCache,
+                                  const WGPUSamplerDescriptor *descriptor) {
+    CacheKey key = {0};
+    keyAppendU32(&key, descriptor->addressModeU);
+    keyAppendU32(&key, descriptor->addressModeV);
+    keyAppendU32(&key, descriptor->addressModeW);
+    keyAppendU32(&key, descriptor->magFilter);
+    keyAppendU32(&key, descriptor->minFilter);
+    keyAppendU32(&key, descriptor->mipmapFilter);
+    keyAppendFloat(&key, descriptor->lodMinClamp);
+    keyAppendFloat(&key, descriptor->lodMaxClamp);
+    keyAppendU32(&key, descriptor->compare);
+    keyAppendU32(&key, descriptor->maxAnisotropy);
+
+    WGPUSampler sampler = tableFind(&objectCache->samplers, &key);
+    if (!sampler) {
+        sampler = wgpuDeviceCreateSampler(objectCache->device, descriptor);
+        tableInsert(&objectCache->samplers, &key, sampler);
+    }
+
+    return sampler;
+}
+
+WGPUBindGroupLayout objectCacheGetBindGroupLayout(
+    ObjectCache *objectCache, const WGPUBindGroupLayoutDescriptor *descriptor) {
+    CacheKey key = {0};
+    keyAppendU64(&key, descriptor->entryCount);
+
+    for (size_t i = 0; i < descriptor->entryCount; ++i) {
+        const WGPUBindGroupLayoutEntry *entry = &descriptor->entries[i];
+        keyAppendU32(&key, entry->binding);
+        keyAppendU32(&key, entry->visibility);
+        keyAppendU32(&key, entry->buffer.type);
+        keyAppendU32(&key, entry->buffer.hasDynamicOffset);
+        keyAppendU64(&key, entry->buffer.minBindingSize);
+        keyAppendU32(&key, entry->sampler.type);
+        keyAppendU32(&key, entry->texture.sampleType);
+        keyAppendU32(&key, entry->texture.viewDimension);
+        keyAppendU32(&key, entry->texture.multisampled);
+        keyAppendU32(&key, entry->storageTexture.access);
+        keyAppendU32(&key, entry->storageTexture.format);
+        keyAppendU32(&key, entry->storageTexture.viewDimension);
+    }
+
+    WGPUBindGroupLayout bindGroupLayout =
+        tableFind(&objectCache->bindGroupLayouts, &key);
+    if (!bindGroupLayout) {
+        bindGroupLayout =
+            wgpuDeviceCreateBindGroupLayout(objectCache->device, descriptor);
+        tableInsert(&objectCache->bindGroupLayouts, &key, bindGroupLayout);
+    }
+
+    return bindGroupLayout;
+}
+
+WGPUShaderModule objectCacheGetShaderModuleFromSource(ObjectCache *objectCache,
+                                                      const char *label,
+                                                      const char *source) {
+    CacheKey key = {0};
+    keyAppendString(&key, source);
+
+    WGPUShaderModule shader = tableFind(&objectCache->shaderModules, &key);
+    if (!shader) {
+        WGPUShaderModuleWGSLDescriptor wgslDescriptor = {
+            .chain =
+                (WGPUChainedStruct){
+                    .next = NULL,
+                    .sType = WGPUSType_ShaderModuleWGSLDescriptor,
+                },
+            .code = source,
+        };
+        shader = wgpuDeviceCreateShaderModule(
+            objectCache->device,
+            &(WGPUShaderModuleDescriptor){
+                .nextInChain = (const WGPUChainedStruct *)&wgslDescriptor,
+                .label = label,
+            });
+        tableInsert(&objectCache->shaderModules, &key, shader);
+    }
+
+    return shader;
+}
+
+WGPUShaderModule objectCacheGetShaderModule(ObjectCache *objectCache,
+                                            const char *path) {
+    WGPUShaderModuleDescriptor shaderSource = loadWgsl(path);
+    WGPUShaderModuleWGSLDescriptor *wgslDescriptor =
+        (WGPUShaderModuleWGSLDescriptor *)shaderSource.nextInChain;
+
+    WGPUShaderModule shader = objectCacheGetShaderModuleFromSource(
+        objectCache, path, wgslDescriptor->code);
+
+    free((char *)wgslDescriptor->code);
+    free(wgslDescriptor);
+
+    return shader;
+}
+
+static const WGPUBlendState alphaBlendState = {
+    .color =
+        {
+            .srcFactor = WGPUBlendFactor_SrcAlpha,
+            .dstFactor = WGPUBlendFactor_OneMinusSrcAlpha,
+            .operation = WGPUBlendOperation_Add,
+        },
+    .alpha =
+        {
+            .srcFactor = WGPUBlendFactor_One,
+            .dstFactor = WGPUBlendFactor_Zero,
+            .operation = WGPUBlendOperation_Add,
+        },
+};
+
+static const WGPUBlendState additiveBlendState = {
+    .color =
+        {
+            .srcFactor = WGPUBlendFactor_SrcAlpha,
+            .dstFactor = WGPUBlendFactor_One,
+            .operation = WGPUBlendOperation_Add,
+        },
+    .alpha =
+        {
+            .srcFactor = WGPUBlendFactor_One,
+            .dstFactor = WGPUBlendFactor_Zero,
+            .operation = WGPUBlendOperation_Add,
+        },
+};
+
+static const WGPUBlendState *blendState(BlendMode blendMode) {
+    switch (blendMode) {
+        case BlendModeAdditive:
+            return &additiveBlendState;
+        case BlendModeNone:
+            return NULL;
+        default:
+            return &alphaBlendState;
+    }
+}
+
+static WGPURenderPipeline createPipeline(WGPUDevice device,
+                                         const PipelineOptions *options) {
+    // Pipelines for passes without a depth attachment have no depth state.
+    WGPUDepthStencilState depthStencilState = {
+        .depthCompare = options->depthCompare,
+        .depthWriteEnabled = options->depthWriteEnabled,
+        .format = options->depthTextureFormat,
+        .stencilReadMask = 0,
+        .stencilWriteMask = 0,
+        .stencilFront =
+            (WGPUStencilFaceState){
+                .compare = WGPUCompareFunction_Always,
+                .failOp = WGPUStencilOperation_Keep,
+                .depthFailOp = WGPUStencilOperation_Keep,
+                .passOp = WGPUStencilOperation_Keep,
+            },
+        .stencilBack =
+            (WGPUStencilFaceState){
+                .compare = WGPUCompareFunction_Always,
+                .failOp = WGPUStencilOperation_Keep,
+                .depthFailOp = WGPUStencilOperation_Keep,
+                .passOp = WGPUStencilOperation_Keep,
+            },
+    };
+    const WGPUDepthStencilState *depthStencil = NULL;
+    if (options->depthTextureFormat != WGPUTextureFormat_Undefined) {
+        depthStencil = &depthStencilState;
+    }
+
+    return wgpuDeviceCreateRenderPipeline(
+        device,
+        &(WGPURenderPipelineDescriptor){
+            .label = "Render pipeline",
+            .vertex =
+                (WGPUVertexState){
+                    .module = options->shader,
+                    .entryPoint = options->vertexEntryPoint,
+                    .bufferCount = options->vertexBufferLayout ? 1 : 0,
+                    .buffers = options->vertexBufferLayout,
+                },
+            .primitive =
+                (WGPUPrimitiveState){
+                    .topology = WGPUPrimitiveTopology_TriangleList,
+                    .stripIndexFormat = WGPUIndexFormat_Undefined,
+                    .frontFace = WGPUFrontFace_CCW,
+                    .cullMode = WGPUCullMode_None},
+            .multisample =
+                (WGPUMultisampleState){
+                    .count = 1,
+                    .mask = (uint32_t)(~0),
+                    .alphaToCoverageEnabled = false,
+                },
+            .fragment =
+                &(WGPUFragmentState){
+                    .module = options->shader,
+                    .entryPoint = options->fragmentEntryPoint,
+                    .targetCount = 1,
+                    .targets =
+                        &(WGPUColorTargetState){
+                            .format = options->colorFormat,
+                            .blend = blendState(options->blendMode),
+                            .writeMask = WGPUColorWriteMask_All,
+                        },
+                },
+            .depthStencil = depthStencil,
+        });
+}
+
+WGPURenderPipeline objectCacheGetPipeline(ObjectCache *objectCache,
+                                          const PipelineOptions *options) {
+    CacheKey key = {0};
+    keyAppendPointer(&key, options->shader);
+    keyAppendString(&key, options->vertexEntryPoint);
+    keyAppendString(&key, options->fragmentEntryPoint);
+    keyAppendPointer(&key, options->vertexBufferLayout);
+    keyAppendU32(&key, options->colorFormat);
+    keyAppendU32(&key, options->depthTextureFormat);
+    keyAppendU32(&key, options->blendMode);
+    keyAppendU32(&key, options->depthWriteEnabled);
+    keyAppendU32(&key, options->depthCompare);
+
+    WGPURenderPipeline pipeline = tableFind(&objectCache->pipelines, &key);
+    if (!pipeline) {
+        pipeline = createPipeline(objectCache->device, options);
+        tableInsert(&objectCache->pipelines, &key, pipeline);
+    }
+
+    return pipeline;
+}
@@ -0,0 +1,78 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../webgpu-headers/webgpu.h"
+
+typedef struct {
+    uint64_t hash;
+    uint8_t *key;
+    size_t keySize;
+    void *object;
+} ObjectCacheEntry;
+
+// Open addressing hash table from descriptor keys to WebGPU objects.
+typedef struct {
+    ObjectCacheEntry *entries;
+    int entryCount;
+    int capacity;
+
+    uint64_t hitCount;
+    uint64_t missCount;
+} ObjectCacheTable;
+
+typedef enum {
+    BlendModeAlpha,
+    BlendModeAdditive,
+    BlendModeNone,
+} BlendMode;
+
+// Everything that distinguishes one render pipeline variant from another.
+// Entry point strings are compared by value, but the vertex buffer layout is
+// compared by address, so it must stay alive as long as the cache.
+typedef struct {
+    WGPUShaderModule shader;
+    const char *vertexEntryPoint;
+    const char *fragmentEntryPoint;
+    const WGPUVertexBufferLayout *vertexBufferLayout;
+
+    WGPUTextureFormat colorFormat;
+    // WGPUTextureFormat_Undefined for passes without a depth attachment.
+    WGPUTextureFormat depthTextureFormat;
+    BlendMode blendMode;
+    bool depthWriteEnabled;
+    WGPUCompareFunction depthCompare;
+} PipelineOptions;
+
+// Reuses WebGPU objects created from identical descriptors. Objects returned
+// by the cache are owned by it and shouldn't be released by the caller.
+typedef struct {
+    WGPUDevice device;
+
+    ObjectCacheTable samplers;
+    ObjectCacheTable bindGroupLayouts;
+    ObjectCacheTable shaderModules;
+    ObjectCacheTable pipelines;
+} ObjectCache;
+
+ObjectCache objectCacheCreate(WGPUDevice device);
+void objectCacheDestroy(ObjectCache *objectCache);
+
+WGPUSampler objectCacheGetSampler(ObjectCache *objectCache,
+                                  const WGPUSamplerDescriptor *descriptor);
+WGPUBindGroupLayout objectCacheGetBindGroupLayout(
+    ObjectCache *objectCache, const WGPUBindGroupLayoutDescriptor *descriptor);
+// Loads the WGSL file at path, modules are keyed by their source code.
+WGPUShaderModule objectCacheGetShaderModule(ObjectCache *objectCache,
+                                            const char *path);
+// Like objectCacheGetShaderModule, for WGSL that is embedded in the program.
+WGPUShaderModule objectCacheGetShaderModuleFromSource(ObjectCache *objectCache,
+                                                      const char *label,
+                                                      const char *source);
+WGPURenderPipeline objectCacheGetPipeline(ObjectCache *objectCache,
+                                          const PipelineOptions *options);
+
+#endif
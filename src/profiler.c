@@ -0,0 +1,321 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpuMemory.h"
+#include "wgpuHelper.h"
+
+#define queriesPerFrame (maxProfiledPasses * 2)
+// WebGPU defines timestamps in nanoseconds.
+#define timestampToMs 1e-6
+
+static void frameMapped(WGPUBufferMapAsyncStatus status, void *userdata) {
+    ProfilerFrame *frame = userdata;
+    frame->isMapPending = false;
+    frame->isMapped = status == WGPUBufferMapAsyncStatus_Success;
+
+    // The slot can be reused right away if there is nothing to read.
+    if (!frame->isMapped) {
+        frame->passCount = 0;
+    }
+}
+
+Profiler *profilerCreate(WGPUDevice device, bool hasTimestamps) {
+    Profiler *profiler = calloc(1, sizeof(Profiler));
+    profiler->device = device;
+    profiler->hasTimestamps = hasTimestamps;
+
+    profilerGetScope(profiler, "frame");
+
+    if (!hasTimestamps) {
+        return profiler;
+    }
+
+    profiler->querySet = wgpuDeviceCreateQuerySet(
+        device, &(WGPUQuerySetDescriptor){
+                    .label = "Profiler query set",
+                    .type = WGPUQueryType_Timestamp,
+                    .count = profilerFrameCount * queriesPerFrame,
+                });
+
+    // Each frame's slice of the resolve buffer starts 256 byte aligned, since
+    // queriesPerFrame timestamps take a multiple of 256 bytes.
+    size_t frameSize = queriesPerFrame * sizeof(uint64_t);
+    profiler->resolveBuffer = wgpuDeviceCreateBuffer(
+        device, &(WGPUBufferDescriptor){
+                    .label = "Profiler resolve buffer",
+                    .size = profilerFrameCount * frameSize,
+                    .usage = WGPUBufferUsage_QueryResolve |
+                             WGPUBufferUsage_CopySrc,
+                    .mappedAtCreation = false,
+                });
+    gpuMemoryTrack(profiler->resolveBuffer, GpuMemoryOther,
+                   profilerFrameCount * frameSize);
+
+    for (int i = 0; i < profilerFrameCount; ++i) {
+        profiler->frames[i] = (ProfilerFrame){
+            .profiler = profiler,
+            .readbackBuffer = wgpuDeviceCreateBuffer(
+                device, &(WGPUBufferDescriptor){
+                            .label = "Profiler readback buffer",
+                            .size = frameSize,
+                            .usage = WGPUBufferUsage_CopyDst |
+                                     WGPUBufferUsage_MapRead,
+                            .mappedAtCreation = false,
+                        }),
+        };
+        gpuMemoryTrack(profiler->frames[i].readbackBuffer, GpuMemoryStaging,
+                       frameSize);
+    }
+
+    return profiler;
+}
+
+void profilerDestroy(Profiler *profiler) {
+    if (profiler->hasTimestamps) {
+        for (int i = 0; i < profilerFrameCount; ++i) {
+            gpuMemoryUntrack(profiler->frames[i].readbackBuffer);
+            wgpuBufferDrop(profiler->frames[i].readbackBuffer);
+        }
+
+        gpuMemoryUntrack(profiler->resolveBuffer);
+        wgpuBufferDrop(profiler->resolveBuffer);
+        wgpuQuerySetDrop(profiler->querySet);
+    }
+
+    for (int i = 0; i < profiler->scopeCount; ++i) {
+        free(profiler->scopes[i].name);
+    }
+
+    free(profiler);
+}
+
+int profilerGetScope(Profiler *profiler, const char *name) {
+    for (int i = 0; i < profiler->scopeCount; ++i) {
+        if (strcmp(profiler->scopes[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (profiler->scopeCount >= maxProfilerScopes) {
+        return -1;
+    }
+
+    profiler->scopes[profiler->scopeCount] = (ProfilerScope){
+        .name = copyString(name),
+    };
+
+    return profiler->scopeCount++;
+}
+
+void profilerAddSample(Profiler *profiler, int scope, double ms) {
+    if (scope < 0 || scope >= profiler->scopeCount) {
+        return;
+    }
+
+    ProfilerScope *profilerScope = &profiler->scopes[scope];
+    profilerScope->samples[profilerScope->nextSample] = (float)ms;
+    profilerScope->nextSample =
+        (profilerScope->nextSample + 1) % profilerSampleCount;
+    if (profilerScope->sampleCount < profilerSampleCount) {
+        ++profilerScope->sampleCount;
+    }
+}
+
+static void readFrame(Profiler *profiler, ProfilerFrame *frame) {
+    const uint64_t *timestamps = wgpuBufferGetMappedRange(
+        frame->readbackBuffer, 0, frame->passCount * 2 * sizeof(uint64_t));
+
+    double scopeMs[maxProfilerScopes] = {0};
+    bool isScopeTimed[maxProfilerScopes] = {0};
+    for (int i = 0; i < frame->passCount; ++i) {
+        uint64_t begin = timestamps[i * 2];
+        uint64_t end = timestamps[i * 2 + 1];
+
+        // Some drivers report garbage for passes that were interrupted, such
+        // as by a GPU power state change.
+        if (end < begin) {
+            continue;
+        }
+
+        int scope = frame->passScopes[i];
+        scopeMs[scope] += (double)(end - begin) * timestampToMs;
+        isScopeTimed[scope] = true;
+    }
+
+    wgpuBufferUnmap(frame->readbackBuffer);
+    frame->isMapped = false;
+    frame->passCount = 0;
+
+    for (int i = 0; i < profiler->scopeCount; ++i) {
+        if (isScopeTimed[i]) {
+            profilerAddSample(profiler, i, scopeMs[i]);
+        }
+    }
+}
+
+void profilerBeginFrame(Profiler *profiler) {
+    profiler->currentFrame = NULL;
+
+    if (!profiler->hasTimestamps) {
+        return;
+    }
+
+    // Runs the callbacks of finished readbacks without waiting for others.
+    wgpuDevicePoll(profiler->device, false, NULL);
+
+    // Read frames oldest first, so samples stay in order.
+    for (int i = 0; i < profilerFrameCount; ++i) {
+        ProfilerFrame *frame =
+            &profiler->frames[(profiler->frameIndex + i) % profilerFrameCount];
+        if (frame->isMapped) {
+            readFrame(profiler, frame);
+        }
+    }
+
+    ProfilerFrame *frame =
+        &profiler->frames[profiler->frameIndex % profilerFrameCount];
+    ++profiler->frameIndex;
+
+    // Skip timing this frame rather than waiting for the slot's readback.
+    if (frame->isMapPending) {
+        return;
+    }
+
+    frame->passCount = 0;
+    profiler->currentFrame = frame;
+}
+
+// Reserves the two queries of a pass timed under scope, returns the index of
+// the first one or -1 if the pass isn't timed.
+static int addPass(Profiler *profiler, int scope) {
+    ProfilerFrame *frame = profiler->currentFrame;
+    if (!frame || scope < 0 || frame->passCount >= maxProfiledPasses) {
+        return -1;
+    }
+
+    int frameI = (int)(frame - profiler->frames);
+    int passI = frame->passCount++;
+    frame->passScopes[passI] = scope;
+
+    return frameI * queriesPerFrame + passI * 2;
+}
+
+size_t profilerRenderPassWrites(Profiler *profiler, int scope,
+                                WGPURenderPassTimestampWrite writes[2]) {
+    int queryI = addPass(profiler, scope);
+    if (queryI < 0) {
+        return 0;
+    }
+
+    writes[0] = (WGPURenderPassTimestampWrite){
+        .querySet = profiler->querySet,
+        .queryIndex = queryI,
+        .location = WGPURenderPassTimestampLocation_Beginning,
+    };
+    writes[1] = (WGPURenderPassTimestampWrite){
+        .querySet = profiler->querySet,
+        .queryIndex = queryI + 1,
+        .location = WGPURenderPassTimestampLocation_End,
+    };
+
+    return 2;
+}
+
+size_t profilerComputePassWrites(Profiler *profiler, int scope,
+                                 WGPUComputePassTimestampWrite writes[2]) {
+    int queryI = addPass(profiler, scope);
+    if (queryI < 0) {
+        return 0;
+    }
+
+    writes[0] = (WGPUComputePassTimestampWrite){
+        .querySet = profiler->querySet,
+        .queryIndex = queryI,
+        .location = WGPUComputePassTimestampLocation_Beginning,
+    };
+    writes[1] = (WGPUComputePassTimestampWrite){
+        .querySet = profiler->querySet,
+        .queryIndex = queryI + 1,
+        .location = WGPUComputePassTimestampLocation_End,
+    };
+
+    return 2;
+}
+
+void profilerEndFrame(Profiler *profiler, WGPUCommandEncoder encoder) {
+    ProfilerFrame *frame = profiler->currentFrame;
+    if (!frame || frame->passCount == 0) {
+        return;
+    }
+
+    int frameI = (int)(frame - profiler->frames);
+    uint32_t firstQuery = frameI * queriesPerFrame;
+    uint32_t queryCount = frame->passCount * 2;
+    uint64_t offset = firstQuery * sizeof(uint64_t);
+
+    wgpuCommandEncoderResolveQuerySet(encoder, profiler->querySet, firstQuery,
+                                      queryCount, profiler->resolveBuffer,
+                                      offset);
+    wgpuCommandEncoderCopyBufferToBuffer(encoder, profiler->resolveBuffer,
+                                         offset, frame->readbackBuffer, 0,
+                                         queryCount * sizeof(uint64_t));
+}
+
+void profilerFrameSubmitted(Profiler *profiler) {
+    ProfilerFrame *frame = profiler->currentFrame;
+    profiler->currentFrame = NULL;
+    if (!frame || frame->passCount == 0) {
+        return;
+    }
+
+    frame->isMapPending = true;
+    wgpuBufferMapAsync(frame->readbackBuffer, WGPUMapMode_Read, 0,
+                       frame->passCount * 2 * sizeof(uint64_t), frameMapped,
+                       frame);
+}
+
+static int compareSamples(const void *a, const void *b) {
+    float sampleA = *(const float *)a;
+    float sampleB = *(const float *)b;
+
+    return (sampleA > sampleB) - (sampleA < sampleB);
+}
+
+bool profilerGetStats(const Profiler *profiler, const char *name,
+                      ProfilerStats *stats) {
+    const ProfilerScope *scope = NULL;
+    for (int i = 0; i < profiler->scopeCount; ++i) {
+        if (strcmp(profiler->scopes[i].name, name) == 0) {
+            scope = &profiler->scopes[i];
+            break;
+        }
+    }
+
+    if (!scope) {
+        return false;
+    }
+
+    *stats = (ProfilerStats){.sampleCount = scope->sampleCount};
+    if (scope->sampleCount == 0) {
+        return true;
+    }
+
+    float sorted[profilerSampleCount];
+    memcpy(sorted, scope->samples, scope->sampleCount * sizeof(float));
+    qsort(sorted, scope->sampleCount, sizeof(float), compareSamples);
+
+    double total = 0.0;
+    for (int i = 0; i < scope->sampleCount; ++i) {
+        total += sorted[i];
+    }
+
+    // The smallest sample that at least 99% of the samples don't exceed.
+    int p99I = (scope->sampleCount * 99 + 99) / 100 - 1;
+    stats->minMs = sorted[0];
+    stats->averageMs = total / scope->sampleCount;
+    stats->p99Ms = sorted[p99I];
+
+    return true;
+}
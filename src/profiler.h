@@ -0,0 +1,98 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../webgpu-headers/webgpu.h"
+
+#define maxProfilerScopes 32
+// Passes that can be timed each frame, each one uses a begin and an end query.
+#define maxProfiledPasses 32
+// Frames whose results can be waiting to be read back at once. Results are
+// read a few frames late, so the CPU never waits for the GPU to finish them.
+#define profilerFrameCount 4
+// Samples kept by each scope for its rolling statistics.
+#define profilerSampleCount 120
+
+// Scope of the frame's render pass, created along with the profiler.
+#define profilerFrameScope 0
+
+// Rolling statistics of a scope, in milliseconds.
+typedef struct {
+    double minMs;
+    double averageMs;
+    double p99Ms;
+    int sampleCount;
+} ProfilerStats;
+
+// A named part of the frame. Passes timed under the same scope in one frame
+// add up to a single sample.
+typedef struct {
+    char *name;
+    float samples[profilerSampleCount];
+    int sampleCount;
+    int nextSample;
+} ProfilerScope;
+
+typedef struct Profiler Profiler;
+
+typedef struct {
+    Profiler *profiler;
+    // Receives the frame's slice of the resolve buffer.
+    WGPUBuffer readbackBuffer;
+    int passScopes[maxProfiledPasses];
+    int passCount;
+    bool isMapPending;
+    bool isMapped;
+} ProfilerFrame;
+
+// Kept on the heap, since map callbacks point into its frames.
+struct Profiler {
+    WGPUDevice device;
+    // Without timestamp queries only the frame scope is measured, as the CPU
+    // time from submitting a frame until rendererBegin's per frame poll sees
+    // the GPU finish it, like RendererLatencyStats.lastLatencyMs.
+    bool hasTimestamps;
+    WGPUQuerySet querySet;
+    WGPUBuffer resolveBuffer;
+    ProfilerFrame frames[profilerFrameCount];
+    // NULL if every frame slot is still being read back, in which case the
+    // frame being recorded isn't timed.
+    ProfilerFrame *currentFrame;
+    uint64_t frameIndex;
+    ProfilerScope scopes[maxProfilerScopes];
+    int scopeCount;
+};
+
+// hasTimestamps must only be true if the device was created with
+// WGPUFeatureName_TimestampQuery.
+Profiler *profilerCreate(WGPUDevice device, bool hasTimestamps);
+void profilerDestroy(Profiler *profiler);
+
+// Returns the scope with the given name, creating it if it doesn't exist yet.
+// Returns -1 if there are already maxProfilerScopes scopes.
+int profilerGetScope(Profiler *profiler, const char *name);
+
+// Collects results that finished reading back and starts timing a new frame.
+void profilerBeginFrame(Profiler *profiler);
+// Fills writes with the timestamps of a pass timed under scope. Returns the
+// number of writes to put in the pass descriptor, 0 if the pass isn't timed.
+size_t profilerRenderPassWrites(Profiler *profiler, int scope,
+                                WGPURenderPassTimestampWrite writes[2]);
+size_t profilerComputePassWrites(Profiler *profiler, int scope,
+                                 WGPUComputePassTimestampWrite writes[2]);
+// Resolves the frame's timestamps, encoder must be submitted after every pass
+// that was timed.
+void profilerEndFrame(Profiler *profiler, WGPUCommandEncoder encoder);
+// Starts reading back the frame's timestamps once it has been submitted.
+void profilerFrameSubmitted(Profiler *profiler);
+
+// Adds a sample measured some other way.
+void profilerAddSample(Profiler *profiler, int scope, double ms);
+// Returns false if there is no scope with the given name.
+bool profilerGetStats(const Profiler *profiler, const char *name,
+                      ProfilerStats *stats);
+
+#endif
@@ -0,0 +1,131 @@
+#include "radixSort.h"
+
+#include <string.h>
+
+#define radixBits 8
+#define radixBuckets (1 << radixBits)
+
+uint32_t radixSortKeyFromFloat(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    // Negative floats sort in reverse, so flip all of their bits. Positive
+    // floats only need their sign bit set to come after them.
+    uint32_t mask = (bits & 0x80000000u) ? 0xffffffffu : 0x80000000u;
+    return bits ^ mask;
+}
+
+void radixSort32(uint32_t *keys, uint32_t *values, uint32_t *tempKeys,
+                 uint32_t *tempValues, int count) {
+    if (count < 2) {
+        return;
+    }
+
+    // Count every digit up front, so only one read of the keys is needed
+    // before the scatter passes.
+    uint32_t counts[sizeof(uint32_t)][radixBuckets] = {{0}};
+    for (int i = 0; i < count; ++i) {
+        uint32_t key = keys[i];
+        for (int pass = 0; pass < (int)sizeof(uint32_t); ++pass) {
+            ++counts[pass][(key >> (pass * radixBits)) & (radixBuckets - 1)];
+        }
+    }
+
+    uint32_t *sourceKeys = keys;
+    uint32_t *sourceValues = values;
+    uint32_t *destinationKeys = tempKeys;
+    uint32_t *destinationValues = tempValues;
+
+    for (int pass = 0; pass < (int)sizeof(uint32_t); ++pass) {
+        int shift = pass * radixBits;
+
+        // Skip digits that are the same for every key, which is common for
+        // the high bytes of depth keys.
+        uint32_t firstDigit = (sourceKeys[0] >> shift) & (radixBuckets - 1);
+        if (counts[pass][firstDigit] == (uint32_t)count) {
+            continue;
+        }
+
+        uint32_t offsets[radixBuckets];
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < radixBuckets; ++bucket) {
+            offsets[bucket] = offset;
+            offset += counts[pass][bucket];
+        }
+
+        for (int i = 0; i < count; ++i) {
+            uint32_t digit = (sourceKeys[i] >> shift) & (radixBuckets - 1);
+            uint32_t destinationI = offsets[digit]++;
+            destinationKeys[destinationI] = sourceKeys[i];
+            destinationValues[destinationI] = sourceValues[i];
+        }
+
+        uint32_t *swapKeys = sourceKeys;
+        uint32_t *swapValues = sourceValues;
+        sourceKeys = destinationKeys;
+        sourceValues = destinationValues;
+        destinationKeys = swapKeys;
+        destinationValues = swapValues;
+    }
+
+    if (sourceKeys != keys) {
+        memcpy(keys, sourceKeys, count * sizeof(uint32_t));
+        memcpy(values, sourceValues, count * sizeof(uint32_t));
+    }
+}
+
+void radixSort64(uint64_t *keys, uint32_t *values, uint64_t *tempKeys,
+                 uint32_t *tempValues, int count) {
+    if (count < 2) {
+        return;
+    }
+
+    uint32_t counts[sizeof(uint64_t)][radixBuckets] = {{0}};
+    for (int i = 0; i < count; ++i) {
+        uint64_t key = keys[i];
+        for (int pass = 0; pass < (int)sizeof(uint64_t); ++pass) {
+            ++counts[pass][(key >> (pass * radixBits)) & (radixBuckets - 1)];
+        }
+    }
+
+    uint64_t *sourceKeys = keys;
+    uint32_t *sourceValues = values;
+    uint64_t *destinationKeys = tempKeys;
+    uint32_t *destinationValues = tempValues;
+
+    for (int pass = 0; pass < (int)sizeof(uint64_t); ++pass) {
+        int shift = pass * radixBits;
+
+        // Keys packed from several fields often leave whole bytes unused.
+        uint32_t firstDigit = (sourceKeys[0] >> shift) & (radixBuckets - 1);
+        if (counts[pass][firstDigit] == (uint32_t)count) {
+            continue;
+        }
+
+        uint32_t offsets[radixBuckets];
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < radixBuckets; ++bucket) {
+            offsets[bucket] = offset;
+            offset += counts[pass][bucket];
+        }
+
+        for (int i = 0; i < count; ++i) {
+            uint32_t digit = (sourceKeys[i] >> shift) & (radixBuckets - 1);
+            uint32_t destinationI = offsets[digit]++;
+            destinationKeys[destinationI] = sourceKeys[i];
+            destinationValues[destinationI] = sourceValues[i];
+        }
+
+        uint64_t *swapKeys = sourceKeys;
+        uint32_t *swapValues = sourceValues;
+        sourceKeys = destinationKeys;
+        sourceValues = destinationValues;
+        destinationKeys = swapKeys;
+        destinationValues = swapValues;
+    }
+
+    if (sourceKeys != keys) {
+        memcpy(keys, sourceKeys, count * sizeof(uint64_t));
+        memcpy(values, sourceValues, count * sizeof(uint32_t));
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <inttypes.h>
+
+// Maps a float to a key that sorts in the same order as the float, including
+// negative values.
+uint32_t radixSortKeyFromFloat(float value);
+
+// Stably sorts count keys in ascending order and moves values along with
+// them. tempKeys and tempValues are scratch space for count elements each.
+void radixSort32(uint32_t *keys, uint32_t *values, uint32_t *tempKeys,
+                 uint32_t *tempValues, int count);
+// Like radixSort32, for 64 bit keys.
+void radixSort64(uint64_t *keys, uint32_t *values, uint64_t *tempKeys,
+                 uint32_t *tempValues, int count);
+
+#endif
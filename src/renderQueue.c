@@ -0,0 +1,250 @@
+#include "renderQueue.h"
+
+#include <stdlib.h>
+
+#include "radixSort.h"
+#include "wgpuHelper.h"
+
+#define initialItemCapacity 64
+
+// Bits of the sort key given to each field. The layer and translucency come
+// first, the depth takes the remaining 32 bits.
+#define layerShift 56
+#define translucentBit (1ull << 55)
+#define pipelineBits 7
+#define textureBits 16
+
+// Bindings set by the draws recorded so far in a flush.
+typedef struct {
+    WGPURenderPipeline pipeline;
+    WGPUBindGroup bindGroup;
+    WGPUBuffer vertexBuffer;
+    uint64_t vertexBufferSize;
+    WGPUBuffer indexBuffer;
+    WGPUIndexFormat indexFormat;
+    uint64_t indexBufferSize;
+} RenderQueueState;
+
+RenderQueue renderQueueCreate(void) {
+    return (RenderQueue){
+        .items = malloc(initialItemCapacity * sizeof(RenderQueueItem)),
+        .itemCapacity = initialItemCapacity,
+    };
+}
+
+void renderQueueDestroy(RenderQueue *renderQueue) {
+    free(renderQueue->items);
+    free(renderQueue->sortKeys);
+    free(renderQueue->sortIndices);
+    free(renderQueue->sortTempKeys);
+    free(renderQueue->sortTempIndices);
+}
+
+void renderQueueSubmit(RenderQueue *renderQueue, RenderQueueItem item) {
+    if (renderQueue->itemCount >= renderQueue->itemCapacity) {
+        renderQueue->itemCapacity *= 2;
+        renderQueue->items =
+            realloc(renderQueue->items,
+                    renderQueue->itemCapacity * sizeof(RenderQueueItem));
+    }
+
+    renderQueue->items[renderQueue->itemCount++] = item;
+}
+
+// Reduces a handle to a few bits for the sort key. Handles that collide are
+// only grouped less tightly, state is still compared by handle.
+static uint64_t hashHandle(const void *handle, int bits) {
+    return hashPointer(handle) >> (64 - bits);
+}
+
+static uint64_t itemKey(const RenderQueueItem *item) {
+    uint64_t depth = radixSortKeyFromFloat(item->depth);
+    uint64_t state = hashHandle(item->pipeline, pipelineBits) << textureBits |
+                     hashHandle(item->bindGroup, textureBits);
+    uint64_t key = (uint64_t)item->layer << layerShift;
+
+    // Opaque items are grouped by state and go front to back within a group
+    // to reject hidden pixels early. Translucent items have to blend in depth
+    // order, so the depth comes before their state.
+    if (item->isTranslucent) {
+        return key | translucentBit |
+               depth << (pipelineBits + textureBits) | state;
+    }
+
+    return key | state << 32 | (~depth & 0xffffffffull);
+}
+
+static void growSortArrays(RenderQueue *renderQueue) {
+    int capacity = renderQueue->itemCapacity;
+    renderQueue->sortKeys =
+        realloc(renderQueue->sortKeys, capacity * sizeof(uint64_t));
+    renderQueue->sortIndices =
+        realloc(renderQueue->sortIndices, capacity * sizeof(uint32_t));
+    renderQueue->sortTempKeys =
+        realloc(renderQueue->sortTempKeys, capacity * sizeof(uint64_t));
+    renderQueue->sortTempIndices =
+        realloc(renderQueue->sortTempIndices, capacity * sizeof(uint32_t));
+    renderQueue->sortCapacity = capacity;
+}
+
+static bool hasSameState(const RenderQueueItem *a, const RenderQueueItem *b) {
+    return a->pipeline == b->pipeline && a->bindGroup == b->bindGroup &&
+           a->vertexBuffer == b->vertexBuffer &&
+           a->vertexBufferSize == b->vertexBufferSize &&
+           a->indexBuffer == b->indexBuffer &&
+           a->indexFormat == b->indexFormat &&
+           a->indexBufferSize == b->indexBufferSize;
+}
+
+// Extends draw with next if next continues where draw ends, either with the
+// following indices of a single instance or the following instances of the
+// same indices.
+static bool tryMerge(RenderQueueItem *draw, const RenderQueueItem *next) {
+    if (draw->indirectBuffer || next->indirectBuffer ||
+        !hasSameState(draw, next)) {
+        return false;
+    }
+
+    if (draw->instanceCount == 1 && next->instanceCount == 1 &&
+        draw->firstInstance == next->firstInstance &&
+        draw->firstIndex + draw->indexCount == next->firstIndex) {
+        draw->indexCount += next->indexCount;
+        return true;
+    }
+
+    if (draw->indexCount == next->indexCount &&
+        draw->firstIndex == next->firstIndex &&
+        draw->firstInstance + draw->instanceCount == next->firstInstance) {
+        draw->instanceCount += next->instanceCount;
+        return true;
+    }
+
+    return false;
+}
+
+static void applyState(RenderQueue *renderQueue, Renderer *renderer,
+                       RenderQueueState *state, const RenderQueueItem *item) {
+    WGPURenderPassEncoder renderPass = renderer->renderPass;
+    RenderQueueStats *stats = &renderQueue->stats;
+
+    if (item->pipeline != state->pipeline) {
+        wgpuRenderPassEncoderSetPipeline(renderPass, item->pipeline);
+        state->pipeline = item->pipeline;
+        ++stats->stateChangeCount;
+    } else {
+        ++stats->redundantStateCount;
+    }
+
+    if (item->bindGroup != state->bindGroup) {
+        wgpuRenderPassEncoderSetBindGroup(renderPass, 0, item->bindGroup, 0,
+                                          NULL);
+        state->bindGroup = item->bindGroup;
+        ++stats->stateChangeCount;
+    } else {
+        ++stats->redundantStateCount;
+    }
+
+    if (item->vertexBuffer) {
+        if (item->vertexBuffer != state->vertexBuffer ||
+            item->vertexBufferSize != state->vertexBufferSize) {
+            wgpuRenderPassEncoderSetVertexBuffer(renderPass, 0,
+                                                 item->vertexBuffer, 0,
+                                                 item->vertexBufferSize);
+            state->vertexBuffer = item->vertexBuffer;
+            state->vertexBufferSize = item->vertexBufferSize;
+            ++stats->stateChangeCount;
+        } else {
+            ++stats->redundantStateCount;
+        }
+    }
+
+    if (item->indexBuffer) {
+        if (item->indexBuffer != state->indexBuffer ||
+            item->indexFormat != state->indexFormat ||
+            item->indexBufferSize != state->indexBufferSize) {
+            wgpuRenderPassEncoderSetIndexBuffer(renderPass, item->indexBuffer,
+                                                item->indexFormat, 0,
+                                                item->indexBufferSize);
+            state->indexBuffer = item->indexBuffer;
+            state->indexFormat = item->indexFormat;
+            state->indexBufferSize = item->indexBufferSize;
+            ++stats->stateChangeCount;
+        } else {
+            ++stats->redundantStateCount;
+        }
+    }
+}
+
+static void recordDraw(RenderQueue *renderQueue, Renderer *renderer,
+                       RenderQueueState *state, const RenderQueueItem *item) {
+    applyState(renderQueue, renderer, state, item);
+    ++renderQueue->stats.drawCount;
+
+    WGPURenderPassEncoder renderPass = renderer->renderPass;
+    if (item->indirectBuffer) {
+        if (item->indexBuffer) {
+            wgpuRenderPassEncoderDrawIndexedIndirect(renderPass,
+                                                     item->indirectBuffer, 0);
+        } else {
+            wgpuRenderPassEncoderDrawIndirect(renderPass, item->indirectBuffer,
+                                              0);
+        }
+    } else if (item->indexBuffer) {
+        wgpuRenderPassEncoderDrawIndexed(renderPass, item->indexCount,
+                                         item->instanceCount, item->firstIndex,
+                                         0, item->firstInstance);
+    } else {
+        wgpuRenderPassEncoderDraw(renderPass, item->indexCount,
+                                  item->instanceCount, item->firstIndex,
+                                  item->firstInstance);
+    }
+}
+
+void renderQueueFlush(RenderQueue *renderQueue, Renderer *renderer) {
+    if (renderQueue->statsFrameIndex != renderer->frameIndex) {
+        renderQueue->stats = (RenderQueueStats){0};
+        renderQueue->statsFrameIndex = renderer->frameIndex;
+    }
+
+    int itemCount = renderQueue->itemCount;
+    renderQueue->itemCount = 0;
+
+    if (!renderer->hasRenderPass || itemCount == 0) {
+        return;
+    }
+
+    renderQueue->stats.itemCount += itemCount;
+
+    if (renderQueue->sortCapacity < itemCount) {
+        growSortArrays(renderQueue);
+    }
+
+    // The sort is stable, so items with equal keys keep their submission
+    // order.
+    for (int i = 0; i < itemCount; ++i) {
+        renderQueue->sortKeys[i] = itemKey(&renderQueue->items[i]);
+        renderQueue->sortIndices[i] = i;
+    }
+    radixSort64(renderQueue->sortKeys, renderQueue->sortIndices,
+                renderQueue->sortTempKeys, renderQueue->sortTempIndices,
+                itemCount);
+
+    // State set before the flush isn't known, so the first draw sets all of
+    // its state.
+    RenderQueueState state = {0};
+    RenderQueueItem draw = renderQueue->items[renderQueue->sortIndices[0]];
+    for (int i = 1; i < itemCount; ++i) {
+        const RenderQueueItem *item =
+            &renderQueue->items[renderQueue->sortIndices[i]];
+
+        if (!tryMerge(&draw, item)) {
+            recordDraw(renderQueue, renderer, &state, &draw);
+            draw = *item;
+        }
+    }
+    recordDraw(renderQueue, renderer, &state, &draw);
+}
+
+RenderQueueStats renderQueueGetStats(const RenderQueue *renderQueue) {
+    return renderQueue->stats;
+}
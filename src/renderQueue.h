@@ -0,0 +1,82 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "renderer.h"
+
+// A draw waiting in a render queue, along with the state it needs.
+typedef struct {
+    // Items are drawn in layer order. Within a layer, opaque items are grouped
+    // by pipeline and texture and drawn front to back, then translucent items
+    // are drawn back to front. Larger depths are closer.
+    uint8_t layer;
+    float depth;
+    bool isTranslucent;
+
+    WGPURenderPipeline pipeline;
+    // Bound to group 0, usually holds the item's texture.
+    WGPUBindGroup bindGroup;
+    // May be NULL for draws that don't read vertices from a buffer.
+    WGPUBuffer vertexBuffer;
+    uint64_t vertexBufferSize;
+    // Items without an index buffer draw indexCount vertices instead.
+    WGPUBuffer indexBuffer;
+    WGPUIndexFormat indexFormat;
+    uint64_t indexBufferSize;
+    // Takes the draw's arguments from the start of this buffer if it isn't
+    // NULL, in which case the counts below are ignored.
+    WGPUBuffer indirectBuffer;
+
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    uint32_t firstInstance;
+} RenderQueueItem;
+
+typedef struct {
+    // Items submitted and flushed this frame.
+    uint64_t itemCount;
+    // Draws recorded for them, after merging adjacent items.
+    uint64_t drawCount;
+    // Pipeline, bind group, vertex buffer and index buffer changes recorded.
+    uint64_t stateChangeCount;
+    // State changes skipped because the state was already set.
+    uint64_t redundantStateCount;
+} RenderQueueStats;
+
+// Collects draws, then records them sorted by the state they need. Adjacent
+// items that read consecutive indices or instances of the same buffers are
+// merged into one draw, and state that is already set isn't set again.
+typedef struct {
+    RenderQueueItem *items;
+    int itemCount;
+    int itemCapacity;
+
+    // Scratch space for sorting the items.
+    uint64_t *sortKeys;
+    uint32_t *sortIndices;
+    uint64_t *sortTempKeys;
+    uint32_t *sortTempIndices;
+    int sortCapacity;
+
+    RenderQueueStats stats;
+    // The frame stats were last counted in, they are cleared once a flush
+    // happens in a new frame.
+    uint64_t statsFrameIndex;
+} RenderQueue;
+
+RenderQueue renderQueueCreate(void);
+void renderQueueDestroy(RenderQueue *renderQueue);
+
+// Adds an item to be drawn by the next flush. Resources used by the item must
+// stay alive until then.
+void renderQueueSubmit(RenderQueue *renderQueue, RenderQueueItem item);
+// Records every submitted item into the current render pass and empties the
+// queue. Items are only ordered relative to others in the same flush.
+void renderQueueFlush(RenderQueue *renderQueue, Renderer *renderer);
+
+RenderQueueStats renderQueueGetStats(const RenderQueue *renderQueue);
+
+#endif
@@ -1,5 +1,8 @@
 #include "renderer.h"
 
+#include <stddef.h>
+#include <string.h>
+
 #include "spriteModel.h"
 
 #define WGPU_TARGET_MACOS 1
@@ -15,6 +18,8 @@
 #include <SDL2/SDL_syswm.h>
 
 #define maxZDistance 1000
+// Weight of the newest frame in RendererLatencyStats.averageLatencyMs.
+#define latencyAverageWeight 0.1
 
 static void handleDeviceLost(WGPUDeviceLostReason reason, char const *message,
                              void *userdata) {
@@ -30,7 +35,431 @@ static void handleUncapturedError(WGPUErrorType type, char const *message,
     printf("UNCAPTURED ERROR (%d): %s\n", type, message);
 }
 
-Renderer rendererCreate(SDL_Window *window, char *shaderPath) {
+static WGPUAdapter requestDevice(Renderer *renderer, WGPUInstance instance,
+                                 bool gpuProfiling) {
+    WGPURequestAdapterOptions adapterOptions = {0};
+    adapterOptions.compatibleSurface = renderer->surface;
+    WGPUAdapter adapter;
+    wgpuInstanceRequestAdapter(instance, &adapterOptions,
+                               requestAdapterCallback, (void *)&adapter);
+
+    // Timestamp queries are only requested for profiling, from adapters that
+    // support them.
+    WGPUFeatureName requiredFeatures[1];
+    size_t requiredFeatureCount = 0;
+    if (gpuProfiling &&
+        wgpuAdapterHasFeature(adapter, WGPUFeatureName_TimestampQuery)) {
+        requiredFeatures[requiredFeatureCount++] =
+            WGPUFeatureName_TimestampQuery;
+    }
+
+    wgpuAdapterRequestDevice(adapter,
+                             &(WGPUDeviceDescriptor){
+                                 .requiredFeaturesCount = requiredFeatureCount,
+                                 .requiredFeatures = requiredFeatures,
+                             },
+                             requestDeviceCallback, (void *)&renderer->device);
+
+    wgpuDeviceSetUncapturedErrorCallback(renderer->device, handleUncapturedError,
+                                         NULL);
+    wgpuDeviceSetDeviceLostCallback(renderer->device, handleDeviceLost, NULL);
+
+    return adapter;
+}
+
+static const WGPUVertexAttribute spriteVertexAttributes[] = {
+    {
+        .shaderLocation = 0,
+        .format = WGPUVertexFormat_Float32x3,
+        .offset = 0,
+    },
+    {
+        .shaderLocation = 1,
+        .format = WGPUVertexFormat_Float32x4,
+        .offset = 3 * sizeof(float),
+    },
+    {
+        .shaderLocation = 2,
+        .format = WGPUVertexFormat_Float32,
+        .offset = 7 * sizeof(float),
+    },
+    {
+        .shaderLocation = 3,
+        .format = WGPUVertexFormat_Float32x2,
+        .offset = 8 * sizeof(float),
+    },
+};
+
+static const WGPUVertexBufferLayout spriteVertexBufferLayout = {
+    .attributeCount = 4,
+    .arrayStride = spriteVertexComponents * sizeof(float),
+    .stepMode = WGPUVertexStepMode_Vertex,
+    .attributes = spriteVertexAttributes,
+};
+
+static const WGPUVertexAttribute spriteInstanceAttributes[] = {
+    {
+        .shaderLocation = 0,
+        .format = WGPUVertexFormat_Float32x3,
+        .offset = offsetof(SpriteInstance, x),
+    },
+    {
+        .shaderLocation = 1,
+        .format = WGPUVertexFormat_Float32x2,
+        .offset = offsetof(SpriteInstance, width),
+    },
+    {
+        .shaderLocation = 2,
+        .format = WGPUVertexFormat_Float32x4,
+        .offset = offsetof(SpriteInstance, texX),
+    },
+    {
+        .shaderLocation = 3,
+        .format = WGPUVertexFormat_Unorm8x4,
+        .offset = offsetof(SpriteInstance, r),
+    },
+    {
+        .shaderLocation = 4,
+        .format = WGPUVertexFormat_Float32,
+        .offset = offsetof(SpriteInstance, blend),
+    },
+    {
+        .shaderLocation = 5,
+        .format = WGPUVertexFormat_Uint32,
+        .offset = offsetof(SpriteInstance, layer),
+    },
+};
+
+static const WGPUVertexBufferLayout spriteInstanceBufferLayout = {
+    .attributeCount = 6,
+    .arrayStride = sizeof(SpriteInstance),
+    .stepMode = WGPUVertexStepMode_Instance,
+    .attributes = spriteInstanceAttributes,
+};
+
+static const WGPUVertexAttribute packedSpriteVertexAttributes[] = {
+    {
+        .shaderLocation = 0,
+        .format = WGPUVertexFormat_Float32x3,
+        .offset = offsetof(PackedSpriteVertex, x),
+    },
+    {
+        .shaderLocation = 1,
+        .format = WGPUVertexFormat_Unorm8x4,
+        .offset = offsetof(PackedSpriteVertex, r),
+    },
+    {
+        .shaderLocation = 2,
+        .format = WGPUVertexFormat_Unorm8x4,
+        .offset = offsetof(PackedSpriteVertex, blend),
+    },
+    {
+        .shaderLocation = 3,
+        .format = WGPUVertexFormat_Unorm16x2,
+        .offset = offsetof(PackedSpriteVertex, texX),
+    },
+};
+
+static const WGPUVertexBufferLayout packedSpriteVertexBufferLayout = {
+    .attributeCount = 4,
+    .arrayStride = sizeof(PackedSpriteVertex),
+    .stepMode = WGPUVertexStepMode_Vertex,
+    .attributes = packedSpriteVertexAttributes,
+};
+
+static const WGPUVertexAttribute shortPackedSpriteVertexAttributes[] = {
+    {
+        .shaderLocation = 0,
+        .format = WGPUVertexFormat_Sint16x4,
+        .offset = offsetof(ShortPackedSpriteVertex, x),
+    },
+    {
+        .shaderLocation = 1,
+        .format = WGPUVertexFormat_Unorm8x4,
+        .offset = offsetof(ShortPackedSpriteVertex, r),
+    },
+    {
+        .shaderLocation = 2,
+        .format = WGPUVertexFormat_Unorm16x2,
+        .offset = offsetof(ShortPackedSpriteVertex, texX),
+    },
+};
+
+static const WGPUVertexBufferLayout shortPackedSpriteVertexBufferLayout = {
+    .attributeCount = 3,
+    .arrayStride = sizeof(ShortPackedSpriteVertex),
+    .stepMode = WGPUVertexStepMode_Vertex,
+    .attributes = shortPackedSpriteVertexAttributes,
+};
+
+static WGPURenderPipeline getPipeline(
+    Renderer *renderer, WGPUShaderModule shader, const char *vertexEntryPoint,
+    const char *fragmentEntryPoint,
+    const WGPUVertexBufferLayout *vertexBufferLayout,
+    WGPUTextureFormat depthTextureFormat, bool depthWriteEnabled) {
+    return objectCacheGetPipeline(
+        &renderer->objectCache,
+        &(PipelineOptions){
+            .shader = shader,
+            .vertexEntryPoint = vertexEntryPoint,
+            .fragmentEntryPoint = fragmentEntryPoint,
+            .vertexBufferLayout = vertexBufferLayout,
+            .colorFormat = renderer->config.format,
+            .depthTextureFormat = depthTextureFormat,
+            .blendMode = BlendModeAlpha,
+            .depthWriteEnabled = depthWriteEnabled,
+            .depthCompare = WGPUCompareFunction_Less,
+        });
+}
+
+static SpritePipelines createSpritePipelines(Renderer *renderer,
+                                             WGPUShaderModule shader,
+                                             WGPUTextureFormat depthTextureFormat,
+                                             bool depthWriteEnabled) {
+    return (SpritePipelines){
+        .vertex = getPipeline(renderer, shader, "vs_main", "fs_main",
+                              &spriteVertexBufferLayout, depthTextureFormat,
+                              depthWriteEnabled),
+        .instanced = getPipeline(renderer, shader, "vs_instanced", "fs_main",
+                                 &spriteInstanceBufferLayout,
+                                 depthTextureFormat, depthWriteEnabled),
+        .instancedArray = getPipeline(renderer, shader, "vs_instanced",
+                                      "fs_array", &spriteInstanceBufferLayout,
+                                      depthTextureFormat, depthWriteEnabled),
+        .packed = getPipeline(renderer, shader, "vs_packed", "fs_main",
+                              &packedSpriteVertexBufferLayout,
+                              depthTextureFormat, depthWriteEnabled),
+        .shortPacked = getPipeline(renderer, shader, "vs_packed_short",
+                                   "fs_main",
+                                   &shortPackedSpriteVertexBufferLayout,
+                                   depthTextureFormat, depthWriteEnabled),
+    };
+}
+
+// Creates the textures drawn into by render passes once the window no longer
+// fits in them. Without bucketed targets the depth texture has to match the
+// swap chain, so it is recreated on every resize.
+static void resizeTargets(Renderer *renderer) {
+    uint32_t width = renderer->config.width;
+    uint32_t height = renderer->config.height;
+    bool hasTargets = renderer->depthTextureInfo.texture != NULL;
+
+    if (renderer->hasBucketedTargets) {
+        if (hasTargets && width <= renderer->targetWidth &&
+            height <= renderer->targetHeight) {
+            return;
+        }
+
+        // Never shrink, so shrinking and growing back doesn't reallocate.
+        width = textureBucketSize(width);
+        height = textureBucketSize(height);
+        if (width < renderer->targetWidth) {
+            width = renderer->targetWidth;
+        }
+        if (height < renderer->targetHeight) {
+            height = renderer->targetHeight;
+        }
+    } else if (hasTargets && width == renderer->targetWidth &&
+               height == renderer->targetHeight) {
+        return;
+    }
+
+    // Frames in flight may still use the old targets.
+    rendererReleaseTextureView(renderer, renderer->depthTextureInfo.view);
+    rendererReleaseTexture(renderer, renderer->depthTextureInfo.texture);
+    rendererReleaseBindGroup(renderer, renderer->presentBindGroup);
+    rendererReleaseTextureView(renderer, renderer->sceneView);
+    rendererReleaseTexture(renderer, renderer->sceneTexture);
+
+    renderer->targetWidth = width;
+    renderer->targetHeight = height;
+    renderer->depthTextureInfo = depthTextureCreate(
+        renderer->device, renderer->depthTextureInfo.format, width, height);
+
+    if (!renderer->hasBucketedTargets) {
+        return;
+    }
+
+    WGPUTextureDescriptor sceneTextureDescriptor = {
+        .dimension = WGPUTextureDimension_2D,
+        .format = renderer->config.format,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .size = {width, height, 1},
+        .usage = WGPUTextureUsage_RenderAttachment |
+                 WGPUTextureUsage_TextureBinding,
+        .viewFormatCount = 0,
+        .viewFormats = NULL,
+    };
+    renderer->sceneTexture =
+        wgpuDeviceCreateTexture(renderer->device, &sceneTextureDescriptor);
+    gpuMemoryTrack(renderer->sceneTexture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(width, height, 1, 1, 4));
+    renderer->sceneView = wgpuTextureCreateView(
+        renderer->sceneTexture, &(WGPUTextureViewDescriptor){
+                                    .aspect = WGPUTextureAspect_All,
+                                    .baseArrayLayer = 0,
+                                    .arrayLayerCount = 1,
+                                    .baseMipLevel = 0,
+                                    .mipLevelCount = 1,
+                                    .dimension = WGPUTextureViewDimension_2D,
+                                    .format = sceneTextureDescriptor.format,
+                                });
+    WGPUBindGroupLayout bindGroupLayout =
+        wgpuRenderPipelineGetBindGroupLayout(renderer->presentPipeline, 0);
+    renderer->presentBindGroup = wgpuDeviceCreateBindGroup(
+        renderer->device,
+        &(WGPUBindGroupDescriptor){
+            .layout = bindGroupLayout,
+            .entryCount = 1,
+            .entries =
+                &(WGPUBindGroupEntry){
+                    .binding = 10,
+                    .textureView = renderer->sceneView,
+                },
+        });
+    wgpuBindGroupLayoutDrop(bindGroupLayout);
+}
+
+// Creates everything that doesn't depend on where the frame is presented.
+// Expects the device and config to already be set up.
+static void createResources(Renderer *renderer, char *shaderPath,
+                            RendererOptions options) {
+    renderer->objectCache = objectCacheCreate(renderer->device);
+
+    // Frames are only tracked up to maxTrackedFrames, which bounds the limit.
+    renderer->maxFramesInFlight = options.maxFramesInFlight < maxTrackedFrames
+                                      ? options.maxFramesInFlight
+                                      : maxTrackedFrames;
+    renderer->frameTracker = calloc(1, sizeof(RendererFrameTracker));
+    for (int i = 0; i < maxTrackedFrames; ++i) {
+        renderer->frameTracker->frames[i].frameTracker = renderer->frameTracker;
+    }
+
+    if (options.gpuProfiling) {
+        renderer->profiler = profilerCreate(
+            renderer->device,
+            wgpuDeviceHasFeature(renderer->device,
+                                 WGPUFeatureName_TimestampQuery));
+        renderer->frameTracker->profiler = renderer->profiler;
+    }
+
+    WGPUShaderModule shader =
+        objectCacheGetShaderModule(&renderer->objectCache, shaderPath);
+
+    WGPUTextureFormat depthTextureFormat = WGPUTextureFormat_Depth24Plus;
+    renderer->pipelines =
+        createSpritePipelines(renderer, shader, depthTextureFormat, true);
+    renderer->translucentPipelines =
+        createSpritePipelines(renderer, shader, depthTextureFormat, false);
+    // Tilemaps generate their quad in the vertex shader, so they don't need a
+    // vertex buffer.
+    renderer->tilemapPipeline =
+        getPipeline(renderer, shader, "vs_tilemap", "fs_tilemap", NULL,
+                    depthTextureFormat, true);
+    renderer->cullPipeline = wgpuDeviceCreateComputePipeline(
+        renderer->device, &(WGPUComputePipelineDescriptor){
+                              .label = "Cull pipeline",
+                              .compute =
+                                  (WGPUProgrammableStageDescriptor){
+                                      .module = shader,
+                                      .entryPoint = "cs_cull",
+                                  },
+                          });
+
+    renderer->hasBucketedTargets =
+        options.bucketedTargets && !renderer->isHeadless;
+    if (renderer->hasBucketedTargets) {
+        renderer->presentPipeline = objectCacheGetPipeline(
+            &renderer->objectCache,
+            &(PipelineOptions){
+                .shader = shader,
+                .vertexEntryPoint = "vs_present",
+                .fragmentEntryPoint = "fs_present",
+                .vertexBufferLayout = NULL,
+                .colorFormat = renderer->config.format,
+                .depthTextureFormat = WGPUTextureFormat_Undefined,
+                .blendMode = BlendModeNone,
+            });
+    }
+
+    renderer->depthTextureInfo.format = depthTextureFormat;
+    resizeTargets(renderer);
+
+    renderer->queue = wgpuDeviceGetQueue(renderer->device);
+
+    // Create the projection uniform buffer.
+    WGPUBufferDescriptor bufferDescriptor = (WGPUBufferDescriptor){
+        .nextInChain = NULL,
+        .size = matrix4Components * sizeof(float),
+        .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
+        .mappedAtCreation = false,
+    };
+    renderer->uniformBuffer =
+        wgpuDeviceCreateBuffer(renderer->device, &bufferDescriptor);
+    gpuMemoryTrack(renderer->uniformBuffer, GpuMemoryUniform,
+                   bufferDescriptor.size);
+
+    rendererResize(renderer);
+}
+
+static bool isPresentModeSupported(const WGPUSurfaceCapabilities *capabilities,
+                                   WGPUPresentMode presentMode) {
+    for (size_t i = 0; i < capabilities->presentModeCount; ++i) {
+        if (capabilities->presentModes[i] == presentMode) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static WGPUPresentMode choosePresentMode(WGPUSurface surface,
+                                         WGPUAdapter adapter,
+                                         RendererPresentMode presentMode) {
+    WGPUPresentMode candidates[3] = {WGPUPresentMode_Fifo};
+    int candidateCount = 1;
+    if (presentMode == RendererPresentModeMailbox) {
+        candidates[0] = WGPUPresentMode_Mailbox;
+        candidates[1] = WGPUPresentMode_Immediate;
+        candidates[2] = WGPUPresentMode_Fifo;
+        candidateCount = 3;
+    } else if (presentMode == RendererPresentModeImmediate) {
+        candidates[0] = WGPUPresentMode_Immediate;
+        candidates[1] = WGPUPresentMode_Mailbox;
+        candidates[2] = WGPUPresentMode_Fifo;
+        candidateCount = 3;
+    }
+
+    // The first call only counts the supported modes.
+    WGPUSurfaceCapabilities capabilities = {0};
+    wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+    capabilities.formats =
+        malloc(capabilities.formatCount * sizeof(WGPUTextureFormat));
+    capabilities.presentModes =
+        malloc(capabilities.presentModeCount * sizeof(WGPUPresentMode));
+    capabilities.alphaModes =
+        malloc(capabilities.alphaModeCount * sizeof(WGPUCompositeAlphaMode));
+    wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+
+    // Every surface supports fifo.
+    WGPUPresentMode chosenMode = WGPUPresentMode_Fifo;
+    for (int i = 0; i < candidateCount; ++i) {
+        if (isPresentModeSupported(&capabilities, candidates[i])) {
+            chosenMode = candidates[i];
+            break;
+        }
+    }
+
+    free(capabilities.formats);
+    free(capabilities.presentModes);
+    free(capabilities.alphaModes);
+
+    return chosenMode;
+}
+
+Renderer rendererCreate(SDL_Window *window, char *shaderPath,
+                        RendererOptions options) {
     initializeLog();
 
     Renderer renderer = (Renderer){
@@ -138,181 +567,118 @@ Renderer rendererCreate(SDL_Window *window, char *shaderPath) {
 #error "Unsupported WGPU_TARGET"
 #endif
 
-    WGPURequestAdapterOptions adapterOptions = {0};
-    adapterOptions.compatibleSurface = renderer.surface;
-    WGPUAdapter adapter;
-    wgpuInstanceRequestAdapter(instance, &adapterOptions,
-                               requestAdapterCallback, (void *)&adapter);
-
-    wgpuAdapterRequestDevice(adapter, NULL, requestDeviceCallback,
-                             (void *)&renderer.device);
-
-    wgpuDeviceSetUncapturedErrorCallback(renderer.device, handleUncapturedError,
-                                         NULL);
-    wgpuDeviceSetDeviceLostCallback(renderer.device, handleDeviceLost, NULL);
-
-    WGPUShaderModuleDescriptor shaderSource = loadWgsl(shaderPath);
-    WGPUShaderModule shader =
-        wgpuDeviceCreateShaderModule(renderer.device, &shaderSource);
+    WGPUAdapter adapter =
+        requestDevice(&renderer, instance, options.gpuProfiling);
 
     WGPUTextureFormat swapChainFormat =
         wgpuSurfaceGetPreferredFormat(renderer.surface, adapter);
 
-    WGPUVertexAttribute vertexAttributes[4] = {
-        (WGPUVertexAttribute){
-            .shaderLocation = 0,
-            .format = WGPUVertexFormat_Float32x3,
-            .offset = 0,
-        },
-        (WGPUVertexAttribute){
-            .shaderLocation = 1,
-            .format = WGPUVertexFormat_Float32x4,
-            .offset = 3 * sizeof(float),
-        },
-        (WGPUVertexAttribute){
-            .shaderLocation = 2,
-            .format = WGPUVertexFormat_Float32,
-            .offset = 7 * sizeof(float),
-        },
-        (WGPUVertexAttribute){
-            .shaderLocation = 3,
-            .format = WGPUVertexFormat_Float32x2,
-            .offset = 8 * sizeof(float),
-        },
-    };
-
-    WGPUTextureFormat depthTextureFormat = WGPUTextureFormat_Depth24Plus;
-    renderer.pipeline = wgpuDeviceCreateRenderPipeline(
-        renderer.device,
-        &(WGPURenderPipelineDescriptor){
-            .label = "Render pipeline",
-            .vertex =
-                (WGPUVertexState){
-                    .module = shader,
-                    .entryPoint = "vs_main",
-                    .bufferCount = 1,
-                    .buffers =
-                        &(WGPUVertexBufferLayout){
-                            .attributeCount = 4,
-                            .arrayStride =
-                                spriteVertexComponents * sizeof(float),
-                            .stepMode = WGPUVertexStepMode_Vertex,
-                            .attributes = vertexAttributes,
-                        },
-                },
-            .primitive =
-                (WGPUPrimitiveState){
-                    .topology = WGPUPrimitiveTopology_TriangleList,
-                    .stripIndexFormat = WGPUIndexFormat_Undefined,
-                    .frontFace = WGPUFrontFace_CCW,
-                    .cullMode = WGPUCullMode_None},
-            .multisample =
-                (WGPUMultisampleState){
-                    .count = 1,
-                    .mask = (uint32_t)(~0),
-                    .alphaToCoverageEnabled = false,
-                },
-            .fragment =
-                &(WGPUFragmentState){
-                    .module = shader,
-                    .entryPoint = "fs_main",
-                    .targetCount = 1,
-                    .targets =
-                        &(WGPUColorTargetState){
-                            .format = swapChainFormat,
-                            .blend =
-                                &(WGPUBlendState){
-                                    .color =
-                                        (WGPUBlendComponent){
-                                            .srcFactor = WGPUBlendFactor_SrcAlpha,
-                                            .dstFactor = WGPUBlendFactor_OneMinusSrcAlpha,
-                                            .operation = WGPUBlendOperation_Add,
-                                        },
-                                    .alpha =
-                                        (WGPUBlendComponent){
-                                            .srcFactor = WGPUBlendFactor_One,
-                                            .dstFactor = WGPUBlendFactor_Zero,
-                                            .operation = WGPUBlendOperation_Add,
-                                        }},
-                            .writeMask = WGPUColorWriteMask_All,
-                        },
-                },
-            .depthStencil =
-                &(WGPUDepthStencilState){
-                    .depthCompare = WGPUCompareFunction_Less,
-                    .depthWriteEnabled = true,
-                    .format = depthTextureFormat,
-                    .stencilReadMask = 0,
-                    .stencilWriteMask = 0,
-                    .stencilFront =
-                        (WGPUStencilFaceState){
-                            .compare = WGPUCompareFunction_Always,
-                            .failOp = WGPUStencilOperation_Keep,
-                            .depthFailOp = WGPUStencilOperation_Keep,
-                            .passOp = WGPUStencilOperation_Keep,
-                        },
-                    .stencilBack =
-                        (WGPUStencilFaceState){
-                            .compare = WGPUCompareFunction_Always,
-                            .failOp = WGPUStencilOperation_Keep,
-                            .depthFailOp = WGPUStencilOperation_Keep,
-                            .passOp = WGPUStencilOperation_Keep,
-                        },
-                },
-        });
-
     renderer.config = (WGPUSwapChainDescriptor){
         .usage = WGPUTextureUsage_RenderAttachment,
         .format = swapChainFormat,
         .width = 0,
         .height = 0,
-        .presentMode = WGPUPresentMode_Fifo,
+        .presentMode = choosePresentMode(renderer.surface, adapter,
+                                         options.presentMode),
     };
 
     SDL_GetWindowSize(window, (int *)&renderer.config.width,
                       (int *)&renderer.config.height);
 
-    renderer.depthTextureInfo =
-        depthTextureCreate(renderer.device, depthTextureFormat,
-                           renderer.config.width, renderer.config.height);
+    createResources(&renderer, shaderPath, options);
 
     renderer.swapChain = wgpuDeviceCreateSwapChain(
         renderer.device, renderer.surface, &renderer.config);
-    renderer.queue = wgpuDeviceGetQueue(renderer.device);
 
-    // Create the projection uniform buffer.
-    WGPUBufferDescriptor bufferDescriptor = (WGPUBufferDescriptor){
-        .nextInChain = NULL,
-        .size = matrix4Components * sizeof(float),
-        .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
-        .mappedAtCreation = false,
+    return renderer;
+}
+
+Renderer rendererCreateHeadless(uint32_t width, uint32_t height,
+                                char *shaderPath, RendererOptions options) {
+    initializeLog();
+
+    Renderer renderer = (Renderer){
+        .isHeadless = true,
+    };
+
+    WGPUInstance instance =
+        wgpuCreateInstance(&(WGPUInstanceDescriptor){.nextInChain = NULL});
+
+    requestDevice(&renderer, instance, options.gpuProfiling);
+
+    // There is no swap chain, but the config still describes the target that
+    // frames are rendered into.
+    renderer.config = (WGPUSwapChainDescriptor){
+        .usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc,
+        .format = WGPUTextureFormat_RGBA8Unorm,
+        .width = width,
+        .height = height,
     };
-    renderer.uniformBuffer =
-        wgpuDeviceCreateBuffer(renderer.device, &bufferDescriptor);
 
-    rendererResize(&renderer);
+    createResources(&renderer, shaderPath, options);
+
+    renderer.offscreenTexture = wgpuDeviceCreateTexture(
+        renderer.device, &(WGPUTextureDescriptor){
+                             .dimension = WGPUTextureDimension_2D,
+                             .format = renderer.config.format,
+                             .mipLevelCount = 1,
+                             .sampleCount = 1,
+                             .size = {width, height, 1},
+                             .usage = renderer.config.usage,
+                             .viewFormatCount = 0,
+                             .viewFormats = NULL,
+                         });
+    renderer.offscreenView = wgpuTextureCreateView(
+        renderer.offscreenTexture, &(WGPUTextureViewDescriptor){
+                                       .aspect = WGPUTextureAspect_All,
+                                       .baseArrayLayer = 0,
+                                       .arrayLayerCount = 1,
+                                       .baseMipLevel = 0,
+                                       .mipLevelCount = 1,
+                                       .dimension = WGPUTextureViewDimension_2D,
+                                       .format = renderer.config.format,
+                                   });
+    gpuMemoryTrack(renderer.offscreenTexture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(width, height, 1, 1, 4));
+
+    // Rows copied out of a texture must be aligned to 256 bytes.
+    uint32_t bytesPerRow = (width * 4 + 255) & ~255u;
+    renderer.readbackBuffer = wgpuDeviceCreateBuffer(
+        renderer.device, &(WGPUBufferDescriptor){
+                             .nextInChain = NULL,
+                             .size = bytesPerRow * height,
+                             .usage = WGPUBufferUsage_CopyDst |
+                                      WGPUBufferUsage_MapRead,
+                             .mappedAtCreation = false,
+                         });
+    gpuMemoryTrack(renderer.readbackBuffer, GpuMemoryStaging,
+                   bytesPerRow * height);
 
     return renderer;
 }
 
 void rendererResize(Renderer *renderer) {
-    // Resize projection matrix to match window.
+    // Resize projection matrix to match the window and camera.
+    CameraRect visibleRect = rendererVisibleRect(renderer);
     float projectionMatrix[matrix4Components];
-    orthographicProjection(
-        projectionMatrix, 0.0f, (float)renderer->config.width, 0.0f,
-        (float)renderer->config.height, -maxZDistance, maxZDistance);
+    orthographicProjection(projectionMatrix, visibleRect.left,
+                           visibleRect.right, visibleRect.bottom,
+                           visibleRect.top, -maxZDistance, maxZDistance);
     wgpuQueueWriteBuffer(renderer->queue, renderer->uniformBuffer, 0,
                          &projectionMatrix, matrix4Components * sizeof(float));
 }
 
-void rendererBegin(Renderer *renderer, float backgroundR, float backgroundG,
-                   float backgroundB) {
-    if (renderer->hasRenderPass) {
-        return;
-    }
+void rendererSetCamera(Renderer *renderer, Camera camera) {
+    renderer->camera = camera;
+    rendererResize(renderer);
+}
 
-    renderer->hasRenderPass = true;
+CameraRect rendererVisibleRect(const Renderer *renderer) {
+    return cameraVisibleRect(&renderer->camera, (float)renderer->config.width,
+                             (float)renderer->config.height);
+}
 
+static void acquireSwapChainTexture(Renderer *renderer) {
     renderer->nextTexture = NULL;
 
     for (int attempt = 0; attempt < 2; attempt++) {
@@ -335,12 +701,14 @@ void rendererBegin(Renderer *renderer, float backgroundR, float backgroundG,
 
         if (prevWidth != renderer->config.width ||
             prevHeight != renderer->config.height) {
-            // Resize the window.
+            // Resize the window. Surfaces always have to match the window,
+            // but the other targets may already be large enough.
+            if (renderer->swapChain) {
+                wgpuSwapChainDrop(renderer->swapChain);
+            }
             renderer->swapChain = wgpuDeviceCreateSwapChain(
                 renderer->device, renderer->surface, &renderer->config);
-            renderer->depthTextureInfo = depthTextureCreate(
-                renderer->device, renderer->depthTextureInfo.format,
-                renderer->config.width, renderer->config.height);
+            resizeTargets(renderer);
 
             rendererResize(renderer);
         }
@@ -363,31 +731,365 @@ void rendererBegin(Renderer *renderer, float backgroundR, float backgroundG,
         printf("Cannot acquire next swap chain texture!\n");
         exit(-1);
     }
+}
+
+static void frameWorkDone(WGPUQueueWorkDoneStatus status, void *userdata) {
+    UNUSED(status);
+
+    RendererFrame *frame = userdata;
+    RendererFrameTracker *frameTracker = frame->frameTracker;
+    RendererLatencyStats *stats = &frameTracker->stats;
+    frame->isPending = false;
+    --stats->framesInFlight;
+
+    // Frames finish in order, so every earlier frame is done as well.
+    if (frame->frameIndex >= frameTracker->completedFrameCount) {
+        frameTracker->completedFrameCount = frame->frameIndex + 1;
+    }
 
-    renderer->encoder = wgpuDeviceCreateCommandEncoder(
-        renderer->device,
-        &(WGPUCommandEncoderDescriptor){.label = "Command Encoder"});
+    Uint64 now = SDL_GetPerformanceCounter();
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    stats->lastLatencyMs =
+        (double)(now - frame->inputTime) * 1000.0 / frequency;
+    if (stats->averageLatencyMs == 0.0) {
+        stats->averageLatencyMs = stats->lastLatencyMs;
+    } else {
+        stats->averageLatencyMs +=
+            (stats->lastLatencyMs - stats->averageLatencyMs) *
+            latencyAverageWeight;
+    }
+
+    Profiler *profiler = frameTracker->profiler;
+    if (profiler && !profiler->hasTimestamps) {
+        profilerAddSample(profiler, profilerFrameScope,
+                          (double)(now - frame->submitTime) * 1000.0 /
+                              frequency);
+    }
+}
+
+// Waits until fewer than maxFramesInFlight frames are on the GPU.
+static void limitFramesInFlight(Renderer *renderer) {
+    RendererFrameTracker *frameTracker = renderer->frameTracker;
+    if (renderer->maxFramesInFlight <= 0 ||
+        frameTracker->stats.framesInFlight < renderer->maxFramesInFlight) {
+        return;
+    }
+
+    Uint64 waitStart = SDL_GetPerformanceCounter();
+    while (frameTracker->stats.framesInFlight >= renderer->maxFramesInFlight) {
+        // Frames finish in order, so wait for the oldest pending one. Polling
+        // calls its work done callback.
+        uint64_t oldestFrameI =
+            renderer->frameIndex - frameTracker->stats.framesInFlight;
+        RendererFrame *oldestFrame =
+            &frameTracker->frames[oldestFrameI % maxTrackedFrames];
+        wgpuDevicePoll(renderer->device, true,
+                       &(WGPUWrappedSubmissionIndex){
+                           .queue = renderer->queue,
+                           .submissionIndex = oldestFrame->submissionIndex,
+                       });
+
+        // Don't wait forever if the device was lost before the callback.
+        if (oldestFrame->isPending) {
+            break;
+        }
+    }
+
+    ++frameTracker->stats.limitWaitCount;
+    frameTracker->stats.limitWaitMs +=
+        (double)(SDL_GetPerformanceCounter() - waitStart) * 1000.0 /
+        (double)SDL_GetPerformanceFrequency();
+}
+
+static void deferRelease(Renderer *renderer, RendererResourceType type,
+                         void *handle) {
+    if (!handle) {
+        return;
+    }
+
+    if (renderer->releaseCount >= renderer->releaseCapacity) {
+        renderer->releaseCapacity = renderer->releaseCapacity > 0
+                                        ? renderer->releaseCapacity * 2
+                                        : 64;
+        renderer->releases =
+            realloc(renderer->releases,
+                    renderer->releaseCapacity * sizeof(RendererRelease));
+    }
+
+    // The frame being recorded, or the next one between frames, may still
+    // use the resource.
+    renderer->releases[renderer->releaseCount++] = (RendererRelease){
+        .type = type,
+        .handle = handle,
+        .frameIndex = renderer->frameIndex,
+    };
+}
+
+void rendererReleaseBuffer(Renderer *renderer, WGPUBuffer buffer) {
+    deferRelease(renderer, RendererResourceBuffer, buffer);
+}
+
+void rendererReleaseTexture(Renderer *renderer, WGPUTexture texture) {
+    deferRelease(renderer, RendererResourceTexture, texture);
+}
+
+void rendererReleaseTextureView(Renderer *renderer, WGPUTextureView view) {
+    deferRelease(renderer, RendererResourceTextureView, view);
+}
+
+void rendererReleaseBindGroup(Renderer *renderer, WGPUBindGroup bindGroup) {
+    deferRelease(renderer, RendererResourceBindGroup, bindGroup);
+}
+
+void rendererReleaseTextureInfo(Renderer *renderer, TextureInfo textureInfo) {
+    rendererReleaseTextureView(renderer, textureInfo.view);
+    rendererReleaseTexture(renderer, textureInfo.texture);
+}
+
+static void releaseResource(RendererRelease release) {
+    switch (release.type) {
+        case RendererResourceBuffer:
+            gpuMemoryUntrack(release.handle);
+            wgpuBufferDestroy(release.handle);
+            wgpuBufferDrop(release.handle);
+            break;
+        case RendererResourceTexture:
+            gpuMemoryUntrack(release.handle);
+            wgpuTextureDestroy(release.handle);
+            wgpuTextureDrop(release.handle);
+            break;
+        case RendererResourceTextureView:
+            wgpuTextureViewDrop(release.handle);
+            break;
+        case RendererResourceBindGroup:
+            wgpuBindGroupDrop(release.handle);
+            break;
+    }
+}
+
+// Releases the resources of every frame before completedFrameCount.
+static void releaseFinishedResources(Renderer *renderer,
+                                     uint64_t completedFrameCount) {
+    // Releases are queued in frame order, so the finished ones come first.
+    int releasedCount = 0;
+    while (releasedCount < renderer->releaseCount &&
+           renderer->releases[releasedCount].frameIndex <
+               completedFrameCount) {
+        releaseResource(renderer->releases[releasedCount++]);
+    }
+
+    renderer->releaseCount -= releasedCount;
+    memmove(renderer->releases, renderer->releases + releasedCount,
+            renderer->releaseCount * sizeof(RendererRelease));
+}
+
+void rendererDestroy(Renderer *renderer) {
+    // Nothing is in use once the GPU is idle, so everything can be released.
+    wgpuDevicePoll(renderer->device, true, NULL);
+    releaseFinishedResources(renderer, UINT64_MAX);
+    free(renderer->releases);
+
+    if (renderer->profiler) {
+        profilerDestroy(renderer->profiler);
+    }
+    free(renderer->frameTracker);
+
+    if (renderer->isHeadless) {
+        wgpuTextureViewDrop(renderer->offscreenView);
+        releaseResource((RendererRelease){
+            .type = RendererResourceTexture,
+            .handle = renderer->offscreenTexture,
+        });
+        releaseResource((RendererRelease){
+            .type = RendererResourceBuffer,
+            .handle = renderer->readbackBuffer,
+        });
+    } else {
+        wgpuSwapChainDrop(renderer->swapChain);
+        wgpuSurfaceDrop(renderer->surface);
+    }
+
+    if (renderer->hasBucketedTargets) {
+        wgpuBindGroupDrop(renderer->presentBindGroup);
+        wgpuTextureViewDrop(renderer->sceneView);
+        releaseResource((RendererRelease){
+            .type = RendererResourceTexture,
+            .handle = renderer->sceneTexture,
+        });
+    }
+
+    wgpuTextureViewDrop(renderer->depthTextureInfo.view);
+    releaseResource((RendererRelease){
+        .type = RendererResourceTexture,
+        .handle = renderer->depthTextureInfo.texture,
+    });
+    releaseResource((RendererRelease){
+        .type = RendererResourceBuffer,
+        .handle = renderer->uniformBuffer,
+    });
+
+    // Pipelines, shaders and samplers belong to the object cache.
+    wgpuComputePipelineDrop(renderer->cullPipeline);
+    objectCacheDestroy(&renderer->objectCache);
+
+    wgpuQueueDrop(renderer->queue);
+    wgpuDeviceDrop(renderer->device);
+    *renderer = (Renderer){0};
+}
+
+void rendererMarkInput(Renderer *renderer) {
+    RendererFrameTracker *frameTracker = renderer->frameTracker;
+    if (!frameTracker->hasMarkedInput) {
+        frameTracker->markedInputTime = SDL_GetPerformanceCounter();
+        frameTracker->hasMarkedInput = true;
+    }
+}
+
+RendererLatencyStats rendererGetLatencyStats(const Renderer *renderer) {
+    return renderer->frameTracker->stats;
+}
+
+bool rendererGetProfilerStats(const Renderer *renderer, const char *scope,
+                              ProfilerStats *stats) {
+    if (!renderer->profiler) {
+        return false;
+    }
+
+    return profilerGetStats(renderer->profiler, scope, stats);
+}
+
+// Begins a render pass into the frame's target, timed under profilerScope
+// while profiling.
+static void beginRenderPass(Renderer *renderer, WGPULoadOp loadOp,
+                            WGPUColor clearColor, int profilerScope) {
+    WGPURenderPassTimestampWrite timestampWrites[2];
+    size_t timestampWriteCount = 0;
+    if (renderer->profiler) {
+        timestampWriteCount = profilerRenderPassWrites(
+            renderer->profiler, profilerScope, timestampWrites);
+    }
+
+    WGPURenderPassDepthStencilAttachment depthAttachment =
+        renderer->depthTextureInfo.attachment;
+    depthAttachment.depthLoadOp = loadOp;
 
     renderer->renderPass = wgpuCommandEncoderBeginRenderPass(
         renderer->encoder,
         &(WGPURenderPassDescriptor){
+            .colorAttachments =
+                &(WGPURenderPassColorAttachment){
+                    .view = renderer->hasBucketedTargets
+                                ? renderer->sceneView
+                                : renderer->nextTexture,
+                    .resolveTarget = NULL,
+                    .loadOp = loadOp,
+                    .storeOp = WGPUStoreOp_Store,
+                    .clearValue = clearColor,
+                },
+            .colorAttachmentCount = 1,
+            .depthStencilAttachment = &depthAttachment,
+            .timestampWriteCount = timestampWriteCount,
+            .timestampWrites = timestampWrites,
+        });
+
+    // Viewports that don't cover the whole target need to be set explicitly,
+    // the default viewport is the full target. Bucketed targets can be larger
+    // than the window, which only covers their top left.
+    CameraViewport viewport =
+        cameraViewport(&renderer->camera, (float)renderer->config.width,
+                       (float)renderer->config.height);
+    if (viewport.x != 0.0f || viewport.y != 0.0f ||
+        viewport.width != (float)renderer->targetWidth ||
+        viewport.height != (float)renderer->targetHeight) {
+        wgpuRenderPassEncoderSetViewport(renderer->renderPass, viewport.x,
+                                         viewport.y, viewport.width,
+                                         viewport.height, 0.0f, 1.0f);
+    }
+
+    if (renderer->hasBucketedTargets) {
+        wgpuRenderPassEncoderSetScissorRect(renderer->renderPass, 0, 0,
+                                            renderer->config.width,
+                                            renderer->config.height);
+    }
+}
+
+// Copies the window's part of the scene texture to the swap chain.
+static void presentScene(Renderer *renderer) {
+    WGPURenderPassEncoder presentPass = wgpuCommandEncoderBeginRenderPass(
+        renderer->encoder,
+        &(WGPURenderPassDescriptor){
+            .label = "Present pass",
             .colorAttachments =
                 &(WGPURenderPassColorAttachment){
                     .view = renderer->nextTexture,
                     .resolveTarget = NULL,
                     .loadOp = WGPULoadOp_Clear,
                     .storeOp = WGPUStoreOp_Store,
-                    .clearValue =
-                        (WGPUColor){
-                            .r = backgroundR,
-                            .g = backgroundG,
-                            .b = backgroundB,
-                            .a = 1.0,
-                        },
+                    .clearValue = (WGPUColor){.a = 1.0},
                 },
             .colorAttachmentCount = 1,
-            .depthStencilAttachment = &renderer->depthTextureInfo.attachment,
         });
+    wgpuRenderPassEncoderSetPipeline(presentPass, renderer->presentPipeline);
+    wgpuRenderPassEncoderSetBindGroup(presentPass, 0,
+                                      renderer->presentBindGroup, 0, NULL);
+    wgpuRenderPassEncoderDraw(presentPass, 3, 1, 0, 0);
+    wgpuRenderPassEncoderEnd(presentPass);
+}
+
+void rendererBegin(Renderer *renderer, float backgroundR, float backgroundG,
+                   float backgroundB) {
+    if (renderer->hasRenderPass) {
+        return;
+    }
+
+    renderer->hasRenderPass = true;
+
+    // Work done callbacks only run while polling, and deferred releases wait
+    // for them, so poll every frame even when the frames in flight aren't
+    // limited.
+    wgpuDevicePoll(renderer->device, false, NULL);
+    limitFramesInFlight(renderer);
+    releaseFinishedResources(renderer,
+                             renderer->frameTracker->completedFrameCount);
+
+    RendererFrameTracker *frameTracker = renderer->frameTracker;
+    frameTracker->inputTime = frameTracker->hasMarkedInput
+                                  ? frameTracker->markedInputTime
+                                  : SDL_GetPerformanceCounter();
+    frameTracker->hasMarkedInput = false;
+
+    if (renderer->isHeadless) {
+        renderer->nextTexture = renderer->offscreenView;
+    } else {
+        acquireSwapChainTexture(renderer);
+    }
+
+    renderer->encoder = wgpuDeviceCreateCommandEncoder(
+        renderer->device,
+        &(WGPUCommandEncoderDescriptor){.label = "Command Encoder"});
+
+    if (renderer->profiler) {
+        profilerBeginFrame(renderer->profiler);
+    }
+
+    beginRenderPass(renderer, WGPULoadOp_Clear,
+                    (WGPUColor){
+                        .r = backgroundR,
+                        .g = backgroundG,
+                        .b = backgroundB,
+                        .a = 1.0,
+                    },
+                    profilerFrameScope);
+}
+
+void rendererSplitRenderPass(Renderer *renderer, int profilerScope) {
+    if (!renderer->hasRenderPass) {
+        return;
+    }
+
+    wgpuRenderPassEncoderEnd(renderer->renderPass);
+    beginRenderPass(renderer, WGPULoadOp_Load, (WGPUColor){0},
+                    profilerScope);
 }
 
 void rendererEnd(Renderer *renderer) {
@@ -398,10 +1100,118 @@ void rendererEnd(Renderer *renderer) {
     renderer->hasRenderPass = false;
 
     wgpuRenderPassEncoderEnd(renderer->renderPass);
+
+    if (renderer->hasBucketedTargets) {
+        presentScene(renderer);
+    }
+
+    if (renderer->profiler) {
+        profilerEndFrame(renderer->profiler, renderer->encoder);
+    }
+
+    WGPUCommandBuffer cmdBuffers[2];
+    size_t cmdBufferCount = 0;
+
+    if (renderer->preEncoder) {
+        cmdBuffers[cmdBufferCount++] = wgpuCommandEncoderFinish(
+            renderer->preEncoder,
+            &(WGPUCommandBufferDescriptor){.label = NULL});
+        renderer->preEncoder = NULL;
+    }
+
+    cmdBuffers[cmdBufferCount++] = wgpuCommandEncoderFinish(
+        renderer->encoder, &(WGPUCommandBufferDescriptor){.label = NULL});
+    WGPUSubmissionIndex submissionIndex = wgpuQueueSubmitForIndex(
+        renderer->queue, (uint32_t)cmdBufferCount, cmdBuffers);
+
+    if (renderer->profiler) {
+        profilerFrameSubmitted(renderer->profiler);
+    }
+
+    // Without a limit more frames than can be tracked may be in flight, the
+    // extra ones just aren't measured.
+    RendererFrameTracker *frameTracker = renderer->frameTracker;
+    RendererFrame *frame =
+        &frameTracker->frames[renderer->frameIndex % maxTrackedFrames];
+    if (!frame->isPending) {
+        frame->inputTime = frameTracker->inputTime;
+        frame->submitTime = SDL_GetPerformanceCounter();
+        frame->frameIndex = renderer->frameIndex;
+        frame->submissionIndex = submissionIndex;
+        frame->isPending = true;
+        ++frameTracker->stats.framesInFlight;
+        wgpuQueueOnSubmittedWorkDone(renderer->queue, frameWorkDone, frame);
+    }
+    ++renderer->frameIndex;
+
+    if (renderer->isHeadless) {
+        return;
+    }
+
     wgpuTextureViewDrop(renderer->nextTexture);
+    wgpuSwapChainPresent(renderer->swapChain);
+}
+
+WGPUCommandEncoder rendererGetPreEncoder(Renderer *renderer) {
+    if (!renderer->preEncoder) {
+        renderer->preEncoder = wgpuDeviceCreateCommandEncoder(
+            renderer->device,
+            &(WGPUCommandEncoderDescriptor){.label = "Pre-pass Encoder"});
+    }
+
+    return renderer->preEncoder;
+}
+
+void rendererReadPixels(Renderer *renderer, uint8_t *pixels) {
+    if (!renderer->isHeadless || renderer->hasRenderPass) {
+        return;
+    }
+
+    uint32_t width = renderer->config.width;
+    uint32_t height = renderer->config.height;
+    uint32_t bytesPerRow = (width * 4 + 255) & ~255u;
+    size_t readbackSize = bytesPerRow * height;
 
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(
+        renderer->device,
+        &(WGPUCommandEncoderDescriptor){.label = "Readback Encoder"});
+    wgpuCommandEncoderCopyTextureToBuffer(
+        encoder,
+        &(WGPUImageCopyTexture){
+            .texture = renderer->offscreenTexture,
+            .mipLevel = 0,
+            .origin = {0, 0, 0},
+            .aspect = WGPUTextureAspect_All,
+        },
+        &(WGPUImageCopyBuffer){
+            .buffer = renderer->readbackBuffer,
+            .layout =
+                (WGPUTextureDataLayout){
+                    .offset = 0,
+                    .bytesPerRow = bytesPerRow,
+                    .rowsPerImage = height,
+                },
+        },
+        &(WGPUExtent3D){width, height, 1});
     WGPUCommandBuffer cmdBuffer = wgpuCommandEncoderFinish(
-        renderer->encoder, &(WGPUCommandBufferDescriptor){.label = NULL});
+        encoder, &(WGPUCommandBufferDescriptor){.label = NULL});
     wgpuQueueSubmit(renderer->queue, 1, &cmdBuffer);
-    wgpuSwapChainPresent(renderer->swapChain);
+
+    WGPUBufferMapAsyncStatus status = WGPUBufferMapAsyncStatus_Unknown;
+    wgpuBufferMapAsync(renderer->readbackBuffer, WGPUMapMode_Read, 0,
+                       readbackSize, readBufferMap, &status);
+    wgpuDevicePoll(renderer->device, true, NULL);
+
+    if (status != WGPUBufferMapAsyncStatus_Success) {
+        printf("Failed to map the readback buffer (%d)\n", status);
+        exit(-1);
+    }
+
+    const uint8_t *mappedPixels = wgpuBufferGetConstMappedRange(
+        renderer->readbackBuffer, 0, readbackSize);
+    for (uint32_t y = 0; y < height; ++y) {
+        memcpy(pixels + y * width * 4, mappedPixels + y * bytesPerRow,
+               width * 4);
+    }
+    wgpuBufferUnmap(renderer->readbackBuffer);
 }
\ No newline at end of file
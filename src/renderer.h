@@ -5,7 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "camera.h"
+#include "gpuMemory.h"
 #include "matrix.h"
+#include "objectCache.h"
+#include "profiler.h"
 #include "texture.h"
 #include "wgpuHelper.h"
 #include "unused.h"
@@ -14,26 +18,215 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+// One pipeline for each sprite batch format.
+typedef struct {
+    WGPURenderPipeline vertex;
+    WGPURenderPipeline instanced;
+    // Instanced pipeline that samples a texture array.
+    WGPURenderPipeline instancedArray;
+    WGPURenderPipeline packed;
+    WGPURenderPipeline shortPacked;
+} SpritePipelines;
+
+typedef enum {
+    // Waits for vertical blank without tearing. Always supported.
+    RendererPresentModeFifo,
+    // Replaces queued frames with newer ones without tearing, falls back to
+    // immediate and then fifo.
+    RendererPresentModeMailbox,
+    // Presents right away and may tear, falls back to mailbox and then fifo.
+    RendererPresentModeImmediate,
+} RendererPresentMode;
+
+typedef struct {
+    // Ignored by headless renderers.
+    RendererPresentMode presentMode;
+    // Frames that may be submitted before rendererBegin waits for the GPU to
+    // finish the oldest one, unlimited if 0. 1 gives the lowest latency, more
+    // frames give the GPU more work to overlap.
+    int maxFramesInFlight;
+    // Measures how long the GPU spends on the frame's render pass and on
+    // batches with a profiler scope, see rendererGetProfilerStats. Uses
+    // timestamp queries if the adapter supports them, otherwise only the
+    // frame is measured, from submission to the GPU finishing it.
+    bool gpuProfiling;
+    // Draws into an offscreen target that is allocated in size buckets and
+    // copies the window's part of it to the swap chain. Resizing the window
+    // then only reallocates the targets when it grows past their bucket, at
+    // the cost of one extra full screen pass per frame. Ignored by headless
+    // renderers.
+    bool bucketedTargets;
+} RendererOptions;
+
+typedef struct {
+    // Time from a frame's input until the renderer sees the GPU finish its
+    // work, in milliseconds. Completion is only seen when rendererBegin polls
+    // the device, without waiting at the start of every frame and while
+    // waiting on the oldest frame to stay within maxFramesInFlight. Frames
+    // that finish between polls are measured up to the next rendererBegin,
+    // so this overestimates by at most one frame of CPU time. Presentation
+    // follows right after, but its completion isn't reported by WebGPU.
+    double lastLatencyMs;
+    // Exponential moving average of lastLatencyMs.
+    double averageLatencyMs;
+    // Frames submitted whose work hasn't finished yet.
+    int framesInFlight;
+    // How often and how long rendererBegin waited to stay within
+    // maxFramesInFlight.
+    uint64_t limitWaitCount;
+    double limitWaitMs;
+} RendererLatencyStats;
+
+#define maxTrackedFrames 16
+
+typedef struct RendererFrameTracker RendererFrameTracker;
+
+typedef struct {
+    RendererFrameTracker *frameTracker;
+    Uint64 inputTime;
+    Uint64 submitTime;
+    uint64_t frameIndex;
+    WGPUSubmissionIndex submissionIndex;
+    bool isPending;
+} RendererFrame;
+
+// Kept on the heap, since queue callbacks point into it and the renderer is
+// returned by value.
+struct RendererFrameTracker {
+    RendererFrame frames[maxTrackedFrames];
+    // Input time of the frame being recorded.
+    Uint64 inputTime;
+    // Set by rendererMarkInput until the next rendererBegin.
+    Uint64 markedInputTime;
+    bool hasMarkedInput;
+    RendererLatencyStats stats;
+    // Every frame before this one has finished on the GPU.
+    uint64_t completedFrameCount;
+    // Receives submit to complete times when timestamps aren't supported.
+    Profiler *profiler;
+};
+
+typedef enum {
+    RendererResourceBuffer,
+    RendererResourceTexture,
+    RendererResourceTextureView,
+    RendererResourceBindGroup,
+} RendererResourceType;
+
+// A resource waiting for the GPU to finish the frames that may use it.
+typedef struct {
+    RendererResourceType type;
+    void *handle;
+    // Released once this frame has finished.
+    uint64_t frameIndex;
+} RendererRelease;
+
 typedef struct {
     SDL_Window *window;
     WGPUSwapChainDescriptor config;
     DepthTextureInfo depthTextureInfo;
+    // Size of the depth texture, and of the scene texture with bucketed
+    // targets, which may be larger than the window.
+    uint32_t targetWidth;
+    uint32_t targetHeight;
+    bool hasBucketedTargets;
+    WGPUTexture sceneTexture;
+    WGPUTextureView sceneView;
+    WGPUBindGroup presentBindGroup;
+    WGPURenderPipeline presentPipeline;
     WGPUSurface surface;
     WGPUSwapChain swapChain;
     WGPUQueue queue;
     WGPUDevice device;
     WGPUBuffer uniformBuffer;
-    WGPURenderPipeline pipeline;
+    // Decides the projection written to uniformBuffer and the viewport of
+    // each render pass. Change it with rendererSetCamera.
+    Camera camera;
+    // Shared samplers, bind group layouts, shader modules and pipelines.
+    ObjectCache objectCache;
+    SpritePipelines pipelines;
+    // Like pipelines, but without depth writes, for translucent sprites that
+    // are drawn after the opaque ones.
+    SpritePipelines translucentPipelines;
+    // Compacts the sprites of culled instanced batches that overlap the view.
+    WGPUComputePipeline cullPipeline;
+    WGPURenderPipeline tilemapPipeline;
 
     WGPURenderPassEncoder renderPass;
     WGPUCommandEncoder encoder;
+    // Records commands that have to run before the frame's render pass, such
+    // as buffer copies. Created on demand by rendererGetPreEncoder.
+    WGPUCommandEncoder preEncoder;
     WGPUTextureView nextTexture;
     bool hasRenderPass;
+    // Number of frames submitted so far.
+    uint64_t frameIndex;
+    int maxFramesInFlight;
+    RendererFrameTracker *frameTracker;
+    // NULL unless created with RendererOptions.gpuProfiling.
+    Profiler *profiler;
+    // Resources released by rendererRelease*, oldest first.
+    RendererRelease *releases;
+    int releaseCount;
+    int releaseCapacity;
+
+    // Headless renderers draw into an offscreen texture instead of a window.
+    bool isHeadless;
+    WGPUTexture offscreenTexture;
+    WGPUTextureView offscreenView;
+    WGPUBuffer readbackBuffer;
 } Renderer;
 
-Renderer rendererCreate(SDL_Window *window, char *shaderPath);
+Renderer rendererCreate(SDL_Window *window, char *shaderPath,
+                        RendererOptions options);
+Renderer rendererCreateHeadless(uint32_t width, uint32_t height,
+                                char *shaderPath, RendererOptions options);
+// Waits for the GPU to finish and releases everything the renderer owns.
+// Sprite batches, tilemaps and textures have to be destroyed first.
+void rendererDestroy(Renderer *renderer);
 void rendererResize(Renderer *renderer);
+// Uses camera for the following frames. Sprites are positioned in world units,
+// the camera decides where those end up on screen.
+void rendererSetCamera(Renderer *renderer, Camera camera);
+// Returns the part of the world visible through the current camera.
+CameraRect rendererVisibleRect(const Renderer *renderer);
 void rendererBegin(Renderer *renderer, float backgroundR, float backgroundG, float backgroundB);
 void rendererEnd(Renderer *renderer);
 
+// Records that input was read for the next frame, so its latency is measured
+// from now instead of from rendererBegin.
+void rendererMarkInput(Renderer *renderer);
+RendererLatencyStats rendererGetLatencyStats(const Renderer *renderer);
+
+// Gets the GPU time of a profiler scope over the last frames it was measured
+// in. "frame" covers the frame's render pass, except for batches with a
+// SpriteBatchOptions.profilerScope, which are reported under that scope.
+// Results lag a few frames behind. Returns
+// false if the renderer isn't profiling or the scope doesn't exist.
+bool rendererGetProfilerStats(const Renderer *renderer, const char *scope,
+                              ProfilerStats *stats);
+// Ends the frame's render pass and continues in a new one timed under
+// profilerScope, keeping what was drawn so far. Used to time draws on their
+// own while profiling with timestamp queries.
+void rendererSplitRenderPass(Renderer *renderer, int profilerScope);
+
+// Release resources once the GPU has finished every frame that may use them,
+// instead of right away. The handles must not be used after these calls.
+// Buffers and textures are destroyed as well, so their memory is freed even
+// if something else still holds a reference.
+void rendererReleaseBuffer(Renderer *renderer, WGPUBuffer buffer);
+void rendererReleaseTexture(Renderer *renderer, WGPUTexture texture);
+void rendererReleaseTextureView(Renderer *renderer, WGPUTextureView view);
+void rendererReleaseBindGroup(Renderer *renderer, WGPUBindGroup bindGroup);
+// Releases a texture and its view. Samplers belong to the object cache.
+void rendererReleaseTextureInfo(Renderer *renderer, TextureInfo textureInfo);
+
+// Returns an encoder whose commands are submitted ahead of the current frame's
+// render pass.
+WGPUCommandEncoder rendererGetPreEncoder(Renderer *renderer);
+
+// Copies the last frame of a headless renderer into pixels, which must hold
+// width * height RGBA8 values. Blocks until the GPU has finished the frame.
+void rendererReadPixels(Renderer *renderer, uint8_t *pixels);
+
 #endif
\ No newline at end of file
@@ -1,31 +1,150 @@
 #include "sprite.h"
 
+#include "radixSort.h"
 #include "spriteModel.h"
 
-SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
-                              Renderer *renderer, SpriteBatchOptions options) {
-    // Create the sprite's vertex buffer.
-    WGPUBufferDescriptor bufferDescriptor = (WGPUBufferDescriptor){
-        .nextInChain = NULL,
-        .size = maxSprites * verticesPerSprite * spriteVertexComponents *
-                sizeof(float),
-        .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
-        .mappedAtCreation = false,
-    };
-    WGPUBuffer vertexBuffer =
-        wgpuDeviceCreateBuffer(renderer->device, &bufferDescriptor);
+// Must match the workgroup size of cs_cull in shader.wgsl.
+#define cullWorkgroupSize 64
 
-    // Create the sprite's index buffer.
-    bufferDescriptor.size = maxSprites * indicesPerSprite * sizeof(uint32_t);
-    bufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index;
-    WGPUBuffer indexBuffer =
-        wgpuDeviceCreateBuffer(renderer->device, &bufferDescriptor);
+// Every sprite uses the same quad, so the index buffer only needs to be filled
+// once. Batches small enough to address all of their vertices with 16 bits
+// use 16 bit indices to halve the index buffer's size.
+static WGPUBuffer createIndexBuffer(WGPUDevice device, int maxSprites,
+                                    WGPUIndexFormat *indexFormat) {
+    int indexCount = maxSprites * indicesPerSprite;
+    bool useUint16 = maxSprites * verticesPerSprite <= UINT16_MAX + 1;
+    size_t indexSize = useUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    *indexFormat = useUint16 ? WGPUIndexFormat_Uint16 : WGPUIndexFormat_Uint32;
 
-    TextureInfo textureInfo =
-        textureCreate(renderer->device, renderer->queue, texturePath,
-                      options.textureWrapMode, options.textureFilteringMode);
+    // Mapped buffers must have a size that is a multiple of 4.
+    size_t bufferSize = (indexCount * indexSize + 3) & ~(size_t)3;
+    WGPUBuffer indexBuffer = wgpuDeviceCreateBuffer(
+        device, &(WGPUBufferDescriptor){
+                    .nextInChain = NULL,
+                    .size = bufferSize,
+                    .usage = WGPUBufferUsage_Index,
+                    .mappedAtCreation = true,
+                });
+    gpuMemoryTrack(indexBuffer, GpuMemoryIndex, bufferSize);
+
+    void *indexData = wgpuBufferGetMappedRange(indexBuffer, 0, bufferSize);
+    for (int spriteI = 0; spriteI < maxSprites; ++spriteI) {
+        uint32_t vertexI = spriteI * verticesPerSprite;
+        int indexI = spriteI * indicesPerSprite;
+
+        for (int i = 0; i < indicesPerSprite; ++i) {
+            uint32_t index = spriteIndexData[i] + vertexI;
+
+            if (useUint16) {
+                ((uint16_t *)indexData)[indexI + i] = (uint16_t)index;
+            } else {
+                ((uint32_t *)indexData)[indexI + i] = index;
+            }
+        }
+    }
+    wgpuBufferUnmap(indexBuffer);
+
+    return indexBuffer;
+}
+
+static size_t spriteStride(SpriteBatchFormat format) {
+    switch (format) {
+        case SpriteBatchFormatInstanced:
+            return sizeof(SpriteInstance);
+        case SpriteBatchFormatPacked:
+            return verticesPerSprite * sizeof(PackedSpriteVertex);
+        case SpriteBatchFormatPackedShort:
+            return verticesPerSprite * sizeof(ShortPackedSpriteVertex);
+        default:
+            return verticesPerSprite * spriteVertexComponents * sizeof(float);
+    }
+}
+
+static void createCullResources(SpriteBatch *spriteBatch, Renderer *renderer) {
+    size_t dataSize = spriteBatch->maxSprites * spriteBatch->spriteStride;
+
+    spriteBatch->visibleBuffer = wgpuDeviceCreateBuffer(
+        renderer->device,
+        &(WGPUBufferDescriptor){
+            .nextInChain = NULL,
+            .size = dataSize,
+            .usage = WGPUBufferUsage_Storage | WGPUBufferUsage_Vertex,
+            .mappedAtCreation = false,
+        });
+    gpuMemoryTrack(spriteBatch->visibleBuffer, GpuMemoryVertex, dataSize);
+
+    // Only the instance count changes between frames, the culling pass
+    // clears it before counting the visible sprites.
+    uint32_t drawArgs[5] = {indicesPerSprite, 0, 0, 0, 0};
+    spriteBatch->drawArgsBuffer = wgpuDeviceCreateBuffer(
+        renderer->device,
+        &(WGPUBufferDescriptor){
+            .nextInChain = NULL,
+            .size = sizeof(drawArgs),
+            .usage = WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect |
+                     WGPUBufferUsage_CopyDst,
+            .mappedAtCreation = true,
+        });
+    gpuMemoryTrack(spriteBatch->drawArgsBuffer, GpuMemoryOther,
+                   sizeof(drawArgs));
+    memcpy(wgpuBufferGetMappedRange(spriteBatch->drawArgsBuffer, 0,
+                                    sizeof(drawArgs)),
+           drawArgs, sizeof(drawArgs));
+    wgpuBufferUnmap(spriteBatch->drawArgsBuffer);
+
+    // Uniform buffers are padded to 16 bytes.
+    spriteBatch->cullParamsBuffer = wgpuDeviceCreateBuffer(
+        renderer->device,
+        &(WGPUBufferDescriptor){
+            .nextInChain = NULL,
+            .size = 4 * sizeof(uint32_t),
+            .usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst,
+            .mappedAtCreation = false,
+        });
+    gpuMemoryTrack(spriteBatch->cullParamsBuffer, GpuMemoryUniform,
+                   4 * sizeof(uint32_t));
+    spriteBatch->cullSpriteCount = -1;
 
-    // Create the sprite's bind group:
+    WGPUBindGroupEntry bindings[5] = {
+        (WGPUBindGroupEntry){
+            .binding = 0,
+            .buffer = renderer->uniformBuffer,
+            .size = matrix4Components * sizeof(float),
+        },
+        (WGPUBindGroupEntry){
+            .binding = 4,
+            .buffer = spriteBatch->vertexBuffer,
+            .size = dataSize,
+        },
+        (WGPUBindGroupEntry){
+            .binding = 5,
+            .buffer = spriteBatch->visibleBuffer,
+            .size = dataSize,
+        },
+        (WGPUBindGroupEntry){
+            .binding = 6,
+            .buffer = spriteBatch->drawArgsBuffer,
+            .size = sizeof(drawArgs),
+        },
+        (WGPUBindGroupEntry){
+            .binding = 7,
+            .buffer = spriteBatch->cullParamsBuffer,
+            .size = 4 * sizeof(uint32_t),
+        },
+    };
+    WGPUBindGroupLayout bindGroupLayout =
+        wgpuComputePipelineGetBindGroupLayout(renderer->cullPipeline, 0);
+    spriteBatch->cullBindGroup = wgpuDeviceCreateBindGroup(
+        renderer->device, &(WGPUBindGroupDescriptor){
+                              .layout = bindGroupLayout,
+                              .entryCount = 5,
+                              .entries = bindings,
+                          });
+    wgpuBindGroupLayoutDrop(bindGroupLayout);
+}
+
+static WGPUBindGroup createBindGroup(Renderer *renderer,
+                                     TextureInfo textureInfo) {
     WGPUBindGroupLayoutEntry bindGroupLayoutEntries[3] = {
         (WGPUBindGroupLayoutEntry){
             .binding = 0,
@@ -36,13 +155,17 @@ SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
                     .minBindingSize = matrix4Components * sizeof(float),
                 },
         },
+        // Texture arrays are bound to a separate binding, since they use a
+        // different type in the shader.
         (WGPUBindGroupLayoutEntry){
-            .binding = 1,
+            .binding = textureInfo.isArray ? 3 : 1,
             .visibility = WGPUShaderStage_Fragment,
             .texture =
                 (WGPUTextureBindingLayout){
                     .sampleType = WGPUTextureSampleType_Float,
-                    .viewDimension = WGPUTextureViewDimension_2D,
+                    .viewDimension = textureInfo.isArray
+                                         ? WGPUTextureViewDimension_2DArray
+                                         : WGPUTextureViewDimension_2D,
                 },
         },
         (WGPUBindGroupLayoutEntry){
@@ -60,8 +183,8 @@ SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
         .entryCount = 3,
         .entries = bindGroupLayoutEntries,
     };
-    WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(
-        renderer->device, &bindGroupLayoutDescriptor);
+    WGPUBindGroupLayout bindGroupLayout = objectCacheGetBindGroupLayout(
+        &renderer->objectCache, &bindGroupLayoutDescriptor);
 
     WGPUBindGroupEntry bindings[3] = {
         (WGPUBindGroupEntry){
@@ -73,7 +196,7 @@ SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
         },
         (WGPUBindGroupEntry){
             .nextInChain = NULL,
-            .binding = 1,
+            .binding = bindGroupLayoutEntries[1].binding,
             .textureView = textureInfo.view,
         },
         (WGPUBindGroupEntry){
@@ -88,39 +211,409 @@ SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
         .entryCount = bindGroupLayoutDescriptor.entryCount,
         .entries = bindings,
     };
-    WGPUBindGroup bindGroup =
-        wgpuDeviceCreateBindGroup(renderer->device, &bindGroupDescriptor);
 
-    return (SpriteBatch){
+    return wgpuDeviceCreateBindGroup(renderer->device, &bindGroupDescriptor);
+}
+
+// Creates the batch's GPU buffers with room for maxSprites sprites.
+static void createBuffers(SpriteBatch *spriteBatch, Renderer *renderer,
+                          bool gpuCulling) {
+    size_t dataSize = spriteBatch->maxSprites * spriteBatch->spriteStride;
+
+    // Create the sprite's vertex buffer, which holds one instance per sprite
+    // for instanced batches.
+    WGPUBufferDescriptor bufferDescriptor = (WGPUBufferDescriptor){
+        .nextInChain = NULL,
+        .size = dataSize,
+        .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
+        .mappedAtCreation = false,
+    };
+    if (gpuCulling) {
+        bufferDescriptor.usage |= WGPUBufferUsage_Storage;
+    }
+    spriteBatch->vertexBuffer =
+        wgpuDeviceCreateBuffer(renderer->device, &bufferDescriptor);
+    gpuMemoryTrack(spriteBatch->vertexBuffer, GpuMemoryVertex, dataSize);
+
+    // Create the staging buffers, which start out mapped so the first frames
+    // don't have to wait for them.
+    for (int i = 0; i < spriteBatch->stagingBufferCount; ++i) {
+        SpriteStagingBuffer *stagingBuffer = &spriteBatch->stagingBuffers[i];
+        stagingBuffer->buffer = wgpuDeviceCreateBuffer(
+            renderer->device,
+            &(WGPUBufferDescriptor){
+                .nextInChain = NULL,
+                .size = dataSize,
+                .usage = WGPUBufferUsage_MapWrite | WGPUBufferUsage_CopySrc,
+                .mappedAtCreation = true,
+            });
+        gpuMemoryTrack(stagingBuffer->buffer, GpuMemoryStaging, dataSize);
+        stagingBuffer->isMapped = true;
+        stagingBuffer->usedFrame = 0;
+    }
+
+    // Create the sprite's index buffer. Instanced batches draw every sprite
+    // with the indices of a single quad.
+    int indexedSprites = spriteBatch->format == SpriteBatchFormatInstanced
+                             ? 1
+                             : spriteBatch->maxSprites;
+    spriteBatch->indexBuffer = createIndexBuffer(
+        renderer->device, indexedSprites, &spriteBatch->indexFormat);
+
+    if (gpuCulling) {
+        createCullResources(spriteBatch, renderer);
+    }
+
+    spriteBatch->gpuCapacity = spriteBatch->maxSprites;
+}
+
+// Map callbacks point into the staging buffer array, so its buffers can't be
+// replaced and it can't be freed before they have run.
+static void waitForStagingBuffers(SpriteBatch *spriteBatch,
+                                  Renderer *renderer) {
+    for (int i = 0; i < spriteBatch->stagingBufferCount; ++i) {
+        while (spriteBatch->stagingBuffers[i].isMapPending) {
+            wgpuDevicePoll(renderer->device, true, NULL);
+        }
+    }
+}
+
+static void releaseBuffers(SpriteBatch *spriteBatch, Renderer *renderer) {
+    for (int i = 0; i < spriteBatch->stagingBufferCount; ++i) {
+        rendererReleaseBuffer(renderer, spriteBatch->stagingBuffers[i].buffer);
+    }
+
+    rendererReleaseBuffer(renderer, spriteBatch->vertexBuffer);
+    rendererReleaseBuffer(renderer, spriteBatch->indexBuffer);
+    rendererReleaseBindGroup(renderer, spriteBatch->cullBindGroup);
+    rendererReleaseBuffer(renderer, spriteBatch->visibleBuffer);
+    rendererReleaseBuffer(renderer, spriteBatch->drawArgsBuffer);
+    rendererReleaseBuffer(renderer, spriteBatch->cullParamsBuffer);
+}
+
+// Replaces the GPU buffers of a batch that outgrew them. The old buffers are
+// released once the frames using them finish, and every sprite is uploaded
+// again.
+static void growBuffers(SpriteBatch *spriteBatch, Renderer *renderer) {
+    bool gpuCulling = spriteBatch->cullBindGroup != NULL;
+
+    waitForStagingBuffers(spriteBatch, renderer);
+    releaseBuffers(spriteBatch, renderer);
+    createBuffers(spriteBatch, renderer, gpuCulling);
+
+    spriteBatch->dirtyRanges[0] =
+        (SpriteRange){.start = 0, .end = spriteBatch->spriteCount};
+    spriteBatch->dirtyRangeCount = 1;
+    ++spriteBatch->stats.reallocationCount;
+}
+
+SpriteBatch spriteBatchCreateFromTexture(int maxSprites, TextureInfo textureInfo,
+                                         Renderer *renderer,
+                                         SpriteBatchOptions options) {
+    // Only instances carry a layer, so texture arrays need instanced batches.
+    // The culling pass also works on instances.
+    if (textureInfo.isArray || options.gpuCulling) {
+        options.format = SpriteBatchFormatInstanced;
+    }
+
+    if (options.gpuCulling) {
+        options.ordering = SpriteBatchOrderingSubmission;
+    }
+
+    size_t stride = spriteStride(options.format);
+
+    int stagingBufferCount = options.bufferCount > 1 ? options.bufferCount : 0;
+    SpriteStagingBuffer *stagingBuffers = NULL;
+    if (stagingBufferCount > 0) {
+        stagingBuffers =
+            calloc(stagingBufferCount, sizeof(SpriteStagingBuffer));
+    }
+
+    SpriteBatch spriteBatch = (SpriteBatch){
         .maxSprites = maxSprites,
         .spriteCount = 0,
-        .vertexData =
-            calloc(maxSprites * verticesPerSprite * spriteVertexComponents,
-                   sizeof(float)),
-        .indexData = calloc(maxSprites * indicesPerSprite, sizeof(uint32_t)),
-        .vertexBuffer = vertexBuffer,
-        .indexBuffer = indexBuffer,
-        .bindGroup = bindGroup,
+        .isGrowable = options.growable,
+        .format = options.format,
+        .ordering = options.ordering,
+        .spriteStride = stride,
+        .spriteData = calloc(maxSprites, stride),
+        .stagingBuffers = stagingBuffers,
+        .stagingBufferCount = stagingBufferCount,
+        .bindGroup = createBindGroup(renderer, textureInfo),
         .textureInfo = textureInfo,
         .inverseTexWidth = 1.0f / textureInfo.width,
         .inverseTexHeight = 1.0f / textureInfo.height,
+        .profilerScope = -1,
     };
+
+    if (renderer->profiler && options.profilerScope) {
+        spriteBatch.profilerScope =
+            profilerGetScope(renderer->profiler, options.profilerScope);
+    }
+
+    createBuffers(&spriteBatch, renderer, options.gpuCulling);
+
+    if (options.ordering == SpriteBatchOrderingSorted) {
+        spriteBatch.spriteDepths = malloc(maxSprites * sizeof(float));
+        spriteBatch.spriteTranslucency = malloc(maxSprites * sizeof(bool));
+        spriteBatch.sortedData = malloc(maxSprites * stride);
+        spriteBatch.sortKeys = malloc(maxSprites * sizeof(uint32_t));
+        spriteBatch.sortIndices = malloc(maxSprites * sizeof(uint32_t));
+        spriteBatch.sortTempKeys = malloc(maxSprites * sizeof(uint32_t));
+        spriteBatch.sortTempIndices = malloc(maxSprites * sizeof(uint32_t));
+    }
+
+    return spriteBatch;
+}
+
+SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
+                              Renderer *renderer, SpriteBatchOptions options) {
+    TextureInfo textureInfo =
+        textureCreate(renderer->device, renderer->queue, &renderer->objectCache,
+                      texturePath, options.textureWrapMode,
+                      options.textureFilteringMode, options.generateMips);
+
+    SpriteBatch spriteBatch = spriteBatchCreateFromTexture(
+        maxSprites, textureInfo, renderer, options);
+    spriteBatch.ownsTexture = true;
+
+    return spriteBatch;
+}
+
+SpriteBatch spriteBatchCreateArray(int maxSprites, char **texturePaths,
+                                   int textureCount, Renderer *renderer,
+                                   SpriteBatchOptions options) {
+    TextureInfo textureInfo = textureArrayCreate(
+        renderer->device, renderer->queue, &renderer->objectCache,
+        texturePaths, textureCount, options.textureWrapMode,
+        options.textureFilteringMode, options.generateMips);
+
+    SpriteBatch spriteBatch = spriteBatchCreateFromTexture(
+        maxSprites, textureInfo, renderer, options);
+    spriteBatch.ownsTexture = true;
+
+    return spriteBatch;
+}
+
+void spriteBatchDestroy(SpriteBatch *spriteBatch, Renderer *renderer) {
+    waitForStagingBuffers(spriteBatch, renderer);
+    releaseBuffers(spriteBatch, renderer);
+    rendererReleaseBindGroup(renderer, spriteBatch->bindGroup);
+
+    if (spriteBatch->ownsTexture) {
+        rendererReleaseTextureInfo(renderer, spriteBatch->textureInfo);
+    }
+
+    free(spriteBatch->stagingBuffers);
+    free(spriteBatch->spriteData);
+    free(spriteBatch->handleSlots);
+    free(spriteBatch->slotHandles);
+    free(spriteBatch->freeHandles);
+    free(spriteBatch->spriteDepths);
+    free(spriteBatch->spriteTranslucency);
+    free(spriteBatch->sortedData);
+    free(spriteBatch->sortKeys);
+    free(spriteBatch->sortIndices);
+    free(spriteBatch->sortTempKeys);
+    free(spriteBatch->sortTempIndices);
+    *spriteBatch = (SpriteBatch){0};
+}
+
+static uint16_t scaleUnorm16(uint16_t value, float scale) {
+    float scaled = value * scale + 0.5f;
+    return scaled >= UINT16_MAX ? UINT16_MAX : (uint16_t)scaled;
+}
+
+// Texture coordinates are stored normalized to the texture bound when the
+// sprite was added, so they are scaled to stay on the same pixels of a
+// texture with a different size.
+static void rescaleTexCoords(SpriteBatch *spriteBatch, float scaleX,
+                             float scaleY) {
+    for (int spriteI = 0; spriteI < spriteBatch->spriteCount; ++spriteI) {
+        uint8_t *data =
+            spriteBatch->spriteData + spriteI * spriteBatch->spriteStride;
+
+        switch (spriteBatch->format) {
+            case SpriteBatchFormatVertex: {
+                float *vertexData = (float *)data;
+                for (int i = 0; i < verticesPerSprite; ++i) {
+                    vertexData[i * spriteVertexComponents + 8] *= scaleX;
+                    vertexData[i * spriteVertexComponents + 9] *= scaleY;
+                }
+                break;
+            }
+            case SpriteBatchFormatInstanced: {
+                SpriteInstance *instance = (SpriteInstance *)data;
+                instance->texX *= scaleX;
+                instance->texY *= scaleY;
+                instance->texWidth *= scaleX;
+                instance->texHeight *= scaleY;
+                break;
+            }
+            case SpriteBatchFormatPacked: {
+                PackedSpriteVertex *vertices = (PackedSpriteVertex *)data;
+                for (int i = 0; i < verticesPerSprite; ++i) {
+                    vertices[i].texX = scaleUnorm16(vertices[i].texX, scaleX);
+                    vertices[i].texY = scaleUnorm16(vertices[i].texY, scaleY);
+                }
+                break;
+            }
+            case SpriteBatchFormatPackedShort: {
+                ShortPackedSpriteVertex *vertices =
+                    (ShortPackedSpriteVertex *)data;
+                for (int i = 0; i < verticesPerSprite; ++i) {
+                    vertices[i].texX = scaleUnorm16(vertices[i].texX, scaleX);
+                    vertices[i].texY = scaleUnorm16(vertices[i].texY, scaleY);
+                }
+                break;
+            }
+        }
+    }
+
+    spriteBatch->dirtyRanges[0] =
+        (SpriteRange){.start = 0, .end = spriteBatch->spriteCount};
+    spriteBatch->dirtyRangeCount = 1;
+}
+
+void spriteBatchSetTexture(SpriteBatch *spriteBatch, Renderer *renderer,
+                           TextureInfo textureInfo) {
+    // The pipeline and sprite format were picked for the original texture.
+    if (textureInfo.isArray != spriteBatch->textureInfo.isArray) {
+        printf("Sprite batches can't switch between textures and texture "
+               "arrays\n");
+        exit(-1);
+    }
+
+    // The frame being recorded may still draw with the old texture.
+    rendererReleaseBindGroup(renderer, spriteBatch->bindGroup);
+    if (spriteBatch->ownsTexture) {
+        rendererReleaseTextureInfo(renderer, spriteBatch->textureInfo);
+        spriteBatch->ownsTexture = false;
+    }
+
+    if (spriteBatch->spriteCount > 0 &&
+        (textureInfo.width != spriteBatch->textureInfo.width ||
+         textureInfo.height != spriteBatch->textureInfo.height)) {
+        rescaleTexCoords(
+            spriteBatch,
+            (float)spriteBatch->textureInfo.width / textureInfo.width,
+            (float)spriteBatch->textureInfo.height / textureInfo.height);
+    }
+
+    spriteBatch->bindGroup = createBindGroup(renderer, textureInfo);
+    spriteBatch->textureInfo = textureInfo;
+    spriteBatch->inverseTexWidth = 1.0f / textureInfo.width;
+    spriteBatch->inverseTexHeight = 1.0f / textureInfo.height;
 }
 
 void spriteBatchClear(SpriteBatch *spriteBatch) {
     spriteBatch->spriteCount = 0;
+    spriteBatch->dirtyRangeCount = 0;
+
+    // Every retained sprite is gone, so all handles can be issued again.
+    spriteBatch->handleCount = 0;
+    spriteBatch->freeHandleCount = 0;
 }
 
-void spriteBatchAdd(SpriteBatch *spriteBatch, Sprite sprite) {
-    if (spriteBatch->spriteCount >= spriteBatch->maxSprites) {
+static bool rangesTouch(SpriteRange a, SpriteRange b) {
+    return a.start <= b.end && b.start <= a.end;
+}
+
+static SpriteRange mergeRanges(SpriteRange a, SpriteRange b) {
+    return (SpriteRange){
+        .start = a.start < b.start ? a.start : b.start,
+        .end = a.end > b.end ? a.end : b.end,
+    };
+}
+
+// Records that sprites in [start, end) need to be uploaded. Touching ranges
+// are merged, and once there are maxDirtyRanges the new range is merged into
+// whichever existing range is closest, uploading the gap between them.
+static void markDirty(SpriteBatch *spriteBatch, int start, int end) {
+    SpriteRange range = {.start = start, .end = end};
+    SpriteRange *ranges = spriteBatch->dirtyRanges;
+
+    int mergeI = -1;
+    int smallestGap = INT32_MAX;
+    for (int i = 0; i < spriteBatch->dirtyRangeCount; ++i) {
+        if (rangesTouch(ranges[i], range)) {
+            mergeI = i;
+            break;
+        }
+
+        int gap = ranges[i].start > end ? ranges[i].start - end
+                                        : start - ranges[i].end;
+        if (gap < smallestGap) {
+            smallestGap = gap;
+            mergeI = i;
+        }
+    }
+
+    bool isTouching = mergeI >= 0 && rangesTouch(ranges[mergeI], range);
+    if (!isTouching && spriteBatch->dirtyRangeCount < maxDirtyRanges) {
+        ranges[spriteBatch->dirtyRangeCount++] = range;
         return;
     }
 
-    int spriteI = spriteBatch->spriteCount;
-    ++spriteBatch->spriteCount;
-    int vertexI = spriteI * verticesPerSprite;
-    int vertexComponentI = vertexI * spriteVertexComponents;
-    int indexI = spriteI * indicesPerSprite;
+    ranges[mergeI] = mergeRanges(ranges[mergeI], range);
+
+    // The grown range may now touch others, fold them into it.
+    for (int i = 0; i < spriteBatch->dirtyRangeCount;) {
+        if (i != mergeI && rangesTouch(ranges[i], ranges[mergeI])) {
+            ranges[mergeI] = mergeRanges(ranges[mergeI], ranges[i]);
+            --spriteBatch->dirtyRangeCount;
+            ranges[i] = ranges[spriteBatch->dirtyRangeCount];
+
+            if (mergeI == spriteBatch->dirtyRangeCount) {
+                mergeI = i;
+            }
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+static uint8_t unormFromFloat(float value) {
+    if (value <= 0.0f) {
+        return 0;
+    }
+
+    if (value >= 1.0f) {
+        return UINT8_MAX;
+    }
+
+    return (uint8_t)(value * UINT8_MAX + 0.5f);
+}
+
+static uint16_t unorm16FromFloat(float value) {
+    if (value <= 0.0f) {
+        return 0;
+    }
+
+    if (value >= 1.0f) {
+        return UINT16_MAX;
+    }
+
+    return (uint16_t)(value * UINT16_MAX + 0.5f);
+}
+
+static int16_t sint16FromFloat(float value) {
+    if (value <= INT16_MIN) {
+        return INT16_MIN;
+    }
+
+    if (value >= INT16_MAX) {
+        return INT16_MAX;
+    }
+
+    return (int16_t)(value < 0.0f ? value - 0.5f : value + 0.5f);
+}
+
+static void writeSpriteVertices(SpriteBatch *spriteBatch, int spriteI,
+                                Sprite sprite) {
+    float *vertexData =
+        (float *)(spriteBatch->spriteData + spriteI * spriteBatch->spriteStride);
 
     // Convert the sprite's texture coordinates from pixel values to 0-1 floats.
     float normalTextureWidth = sprite.texWidth * spriteBatch->inverseTexWidth;
@@ -131,60 +624,906 @@ void spriteBatchAdd(SpriteBatch *spriteBatch, Sprite sprite) {
 
     for (int i = 0; i < verticesPerSprite; ++i) {
         int componentI = i * spriteVertexComponents;
-        int vertexDataI = vertexComponentI + componentI;
-        spriteBatch->vertexData[vertexDataI + 0] =
+        vertexData[componentI + 0] =
             spriteVertexData[componentI + 0] * sprite.width + sprite.x;
-        spriteBatch->vertexData[vertexDataI + 1] =
+        vertexData[componentI + 1] =
             spriteVertexData[componentI + 1] * sprite.height + sprite.y;
-        spriteBatch->vertexData[vertexDataI + 2] =
-            spriteVertexData[componentI + 2] + sprite.z;
-        spriteBatch->vertexData[vertexDataI + 3] = sprite.r;
-        spriteBatch->vertexData[vertexDataI + 4] = sprite.g;
-        spriteBatch->vertexData[vertexDataI + 5] = sprite.b;
-        spriteBatch->vertexData[vertexDataI + 6] = sprite.a;
-        spriteBatch->vertexData[vertexDataI + 7] = sprite.blend;
-        spriteBatch->vertexData[vertexDataI + 8] =
+        vertexData[componentI + 2] = spriteVertexData[componentI + 2] + sprite.z;
+        vertexData[componentI + 3] = sprite.r;
+        vertexData[componentI + 4] = sprite.g;
+        vertexData[componentI + 5] = sprite.b;
+        vertexData[componentI + 6] = sprite.a;
+        vertexData[componentI + 7] = sprite.blend;
+        vertexData[componentI + 8] =
             spriteVertexData[componentI + 8] * normalTextureWidth +
             normalTextureX;
-        spriteBatch->vertexData[vertexDataI + 9] =
+        vertexData[componentI + 9] =
             spriteVertexData[componentI + 9] * normalTextureHeight +
             normalTextureY;
     }
+}
+
+static void writeSpriteInstance(SpriteBatch *spriteBatch, int spriteI,
+                                Sprite sprite) {
+    SpriteInstance *instance =
+        (SpriteInstance *)(spriteBatch->spriteData +
+                           spriteI * spriteBatch->spriteStride);
+
+    *instance = (SpriteInstance){
+        .x = sprite.x,
+        .y = sprite.y,
+        .z = sprite.z,
+        .width = sprite.width,
+        .height = sprite.height,
+        .texX = sprite.texX * spriteBatch->inverseTexWidth,
+        .texY = sprite.texY * spriteBatch->inverseTexHeight,
+        .texWidth = sprite.texWidth * spriteBatch->inverseTexWidth,
+        .texHeight = sprite.texHeight * spriteBatch->inverseTexHeight,
+        .r = unormFromFloat(sprite.r),
+        .g = unormFromFloat(sprite.g),
+        .b = unormFromFloat(sprite.b),
+        .a = unormFromFloat(sprite.a),
+        .blend = sprite.blend,
+        .layer = sprite.layer,
+    };
+}
+
+static void writePackedSpriteVertices(SpriteBatch *spriteBatch, int spriteI,
+                                      Sprite sprite) {
+    PackedSpriteVertex *vertices =
+        (PackedSpriteVertex *)(spriteBatch->spriteData +
+                               spriteI * spriteBatch->spriteStride);
+
+    float normalTextureWidth = sprite.texWidth * spriteBatch->inverseTexWidth;
+    float normalTextureHeight =
+        sprite.texHeight * spriteBatch->inverseTexHeight;
+    float normalTextureX = sprite.texX * spriteBatch->inverseTexWidth;
+    float normalTextureY = sprite.texY * spriteBatch->inverseTexHeight;
+
+    uint8_t r = unormFromFloat(sprite.r);
+    uint8_t g = unormFromFloat(sprite.g);
+    uint8_t b = unormFromFloat(sprite.b);
+    uint8_t a = unormFromFloat(sprite.a);
+    uint8_t blend = unormFromFloat(sprite.blend);
+
+    for (int i = 0; i < verticesPerSprite; ++i) {
+        int componentI = i * spriteVertexComponents;
+        vertices[i] = (PackedSpriteVertex){
+            .x = spriteVertexData[componentI + 0] * sprite.width + sprite.x,
+            .y = spriteVertexData[componentI + 1] * sprite.height + sprite.y,
+            .z = spriteVertexData[componentI + 2] + sprite.z,
+            .r = r,
+            .g = g,
+            .b = b,
+            .a = a,
+            .texX = unorm16FromFloat(spriteVertexData[componentI + 8] *
+                                         normalTextureWidth +
+                                     normalTextureX),
+            .texY = unorm16FromFloat(spriteVertexData[componentI + 9] *
+                                         normalTextureHeight +
+                                     normalTextureY),
+            .blend = blend,
+        };
+    }
+}
+
+static void writeShortPackedSpriteVertices(SpriteBatch *spriteBatch,
+                                           int spriteI, Sprite sprite) {
+    ShortPackedSpriteVertex *vertices =
+        (ShortPackedSpriteVertex *)(spriteBatch->spriteData +
+                                    spriteI * spriteBatch->spriteStride);
+
+    float normalTextureWidth = sprite.texWidth * spriteBatch->inverseTexWidth;
+    float normalTextureHeight =
+        sprite.texHeight * spriteBatch->inverseTexHeight;
+    float normalTextureX = sprite.texX * spriteBatch->inverseTexWidth;
+    float normalTextureY = sprite.texY * spriteBatch->inverseTexHeight;
+
+    uint8_t r = unormFromFloat(sprite.r);
+    uint8_t g = unormFromFloat(sprite.g);
+    uint8_t b = unormFromFloat(sprite.b);
+    uint8_t a = unormFromFloat(sprite.a);
+    int16_t blend = unormFromFloat(sprite.blend);
+
+    for (int i = 0; i < verticesPerSprite; ++i) {
+        int componentI = i * spriteVertexComponents;
+        vertices[i] = (ShortPackedSpriteVertex){
+            .x = sint16FromFloat(spriteVertexData[componentI + 0] *
+                                     sprite.width +
+                                 sprite.x),
+            .y = sint16FromFloat(spriteVertexData[componentI + 1] *
+                                     sprite.height +
+                                 sprite.y),
+            .z = sint16FromFloat(spriteVertexData[componentI + 2] + sprite.z),
+            .blend = blend,
+            .r = r,
+            .g = g,
+            .b = b,
+            .a = a,
+            .texX = unorm16FromFloat(spriteVertexData[componentI + 8] *
+                                         normalTextureWidth +
+                                     normalTextureX),
+            .texY = unorm16FromFloat(spriteVertexData[componentI + 9] *
+                                         normalTextureHeight +
+                                     normalTextureY),
+        };
+    }
+}
 
-    for (int i = 0; i < indicesPerSprite; ++i) {
-        spriteBatch->indexData[indexI + i] = spriteIndexData[i] + vertexI;
+// The shader outputs mix(texture alpha, a, blend), which is only guaranteed to
+// be 0 or 1 if neither side can be partly transparent.
+static bool isSpriteTranslucent(SpriteBatch *spriteBatch, float a,
+                                float blend) {
+    if (blend > 0.0f && a < 1.0f) {
+        return true;
     }
+
+    return blend < 1.0f && spriteBatch->textureInfo.hasTranslucency;
 }
 
-void spriteBatchDraw(SpriteBatch *spriteBatch, Renderer *renderer) {
-    if (!renderer->hasRenderPass) {
+static void recordSortInfo(SpriteBatch *spriteBatch, int spriteI, float z,
+                           float a, float blend) {
+    spriteBatch->spriteDepths[spriteI] = z;
+    spriteBatch->spriteTranslucency[spriteI] =
+        isSpriteTranslucent(spriteBatch, a, blend);
+}
+
+static void writeSprite(SpriteBatch *spriteBatch, int spriteI, Sprite sprite) {
+    if (spriteBatch->spriteDepths) {
+        recordSortInfo(spriteBatch, spriteI, sprite.z, sprite.a, sprite.blend);
+    }
+
+    switch (spriteBatch->format) {
+        case SpriteBatchFormatInstanced:
+            writeSpriteInstance(spriteBatch, spriteI, sprite);
+            break;
+        case SpriteBatchFormatPacked:
+            writePackedSpriteVertices(spriteBatch, spriteI, sprite);
+            break;
+        case SpriteBatchFormatPackedShort:
+            writeShortPackedSpriteVertices(spriteBatch, spriteI, sprite);
+            break;
+        default:
+            writeSpriteVertices(spriteBatch, spriteI, sprite);
+            break;
+    }
+}
+
+static void *growArray(void *array, int capacity, size_t elementSize) {
+    if (!array) {
+        return NULL;
+    }
+
+    return realloc(array, capacity * elementSize);
+}
+
+// Grows the batch's CPU side arrays to fit at least minSprites sprites. The
+// GPU buffers follow the next time the batch is drawn.
+static void growSprites(SpriteBatch *spriteBatch, int minSprites) {
+    // Doubling keeps the number of reallocations logarithmic in the peak
+    // sprite count.
+    int maxSprites = spriteBatch->maxSprites > 0 ? spriteBatch->maxSprites : 1;
+    while (maxSprites < minSprites) {
+        maxSprites *= 2;
+    }
+
+    size_t stride = spriteBatch->spriteStride;
+    spriteBatch->spriteData =
+        growArray(spriteBatch->spriteData, maxSprites, stride);
+    spriteBatch->handleSlots =
+        growArray(spriteBatch->handleSlots, maxSprites, sizeof(int));
+    spriteBatch->slotHandles =
+        growArray(spriteBatch->slotHandles, maxSprites, sizeof(SpriteHandle));
+    spriteBatch->freeHandles =
+        growArray(spriteBatch->freeHandles, maxSprites, sizeof(SpriteHandle));
+    spriteBatch->spriteDepths =
+        growArray(spriteBatch->spriteDepths, maxSprites, sizeof(float));
+    spriteBatch->spriteTranslucency =
+        growArray(spriteBatch->spriteTranslucency, maxSprites, sizeof(bool));
+    spriteBatch->sortedData =
+        growArray(spriteBatch->sortedData, maxSprites, stride);
+    spriteBatch->sortKeys =
+        growArray(spriteBatch->sortKeys, maxSprites, sizeof(uint32_t));
+    spriteBatch->sortIndices =
+        growArray(spriteBatch->sortIndices, maxSprites, sizeof(uint32_t));
+    spriteBatch->sortTempKeys =
+        growArray(spriteBatch->sortTempKeys, maxSprites, sizeof(uint32_t));
+    spriteBatch->sortTempIndices =
+        growArray(spriteBatch->sortTempIndices, maxSprites, sizeof(uint32_t));
+
+    spriteBatch->maxSprites = maxSprites;
+}
+
+// Records that count sprites were asked for starting at firstSpriteI, of
+// which only some may have fit.
+static void recordDemand(SpriteBatch *spriteBatch, int firstSpriteI,
+                         int count, int fitCount) {
+    if (firstSpriteI + count > spriteBatch->stats.highWaterMark) {
+        spriteBatch->stats.highWaterMark = firstSpriteI + count;
+    }
+
+    spriteBatch->stats.droppedSpriteCount += count - fitCount;
+}
+
+// Claims room for up to count sprites and returns how many fit, storing the
+// index of the first one in firstSpriteI. Growable batches make room for all
+// of them.
+static int reserveSprites(SpriteBatch *spriteBatch, int count,
+                          int *firstSpriteI) {
+    if (count > 0) {
+        int spriteCount = spriteBatch->spriteCount;
+        if (spriteBatch->isGrowable &&
+            count > spriteBatch->maxSprites - spriteCount) {
+            growSprites(spriteBatch, spriteCount + count);
+        }
+
+        int available = spriteBatch->maxSprites - spriteCount;
+        recordDemand(spriteBatch, spriteCount, count,
+                     count < available ? count : available);
+    }
+
+    int available = spriteBatch->maxSprites - spriteBatch->spriteCount;
+    if (count > available) {
+        count = available;
+    }
+
+    *firstSpriteI = spriteBatch->spriteCount;
+    if (count <= 0) {
+        return 0;
+    }
+
+    spriteBatch->spriteCount += count;
+    markDirty(spriteBatch, *firstSpriteI, spriteBatch->spriteCount);
+
+    if (spriteBatch->slotHandles) {
+        for (int i = 0; i < count; ++i) {
+            spriteBatch->slotHandles[*firstSpriteI + i] = invalidSpriteHandle;
+        }
+    }
+
+    return count;
+}
+
+void spriteBatchAdd(SpriteBatch *spriteBatch, Sprite sprite) {
+    int spriteI;
+    if (reserveSprites(spriteBatch, 1, &spriteI) == 0) {
         return;
     }
 
-    if (spriteBatch->spriteCount == 0) {
+    writeSprite(spriteBatch, spriteI, sprite);
+}
+
+SpriteHandle spriteBatchAddRetained(SpriteBatch *spriteBatch, Sprite sprite) {
+    if (!spriteBatch->handleSlots) {
+        spriteBatch->handleSlots =
+            malloc(spriteBatch->maxSprites * sizeof(int));
+        spriteBatch->slotHandles =
+            malloc(spriteBatch->maxSprites * sizeof(SpriteHandle));
+        spriteBatch->freeHandles =
+            malloc(spriteBatch->maxSprites * sizeof(SpriteHandle));
+
+        for (int i = 0; i < spriteBatch->spriteCount; ++i) {
+            spriteBatch->slotHandles[i] = invalidSpriteHandle;
+        }
+    }
+
+    int spriteI;
+    if (reserveSprites(spriteBatch, 1, &spriteI) == 0) {
+        return invalidSpriteHandle;
+    }
+
+    SpriteHandle handle;
+    if (spriteBatch->freeHandleCount > 0) {
+        handle = spriteBatch->freeHandles[--spriteBatch->freeHandleCount];
+    } else {
+        handle = spriteBatch->handleCount++;
+    }
+
+    spriteBatch->handleSlots[handle] = spriteI;
+    spriteBatch->slotHandles[spriteI] = handle;
+    writeSprite(spriteBatch, spriteI, sprite);
+
+    return handle;
+}
+
+static bool isHandleValid(SpriteBatch *spriteBatch, SpriteHandle handle) {
+    return spriteBatch->handleSlots && handle >= 0 &&
+           handle < spriteBatch->handleCount &&
+           spriteBatch->handleSlots[handle] >= 0;
+}
+
+void spriteBatchUpdate(SpriteBatch *spriteBatch, SpriteHandle handle,
+                       Sprite sprite) {
+    if (!isHandleValid(spriteBatch, handle)) {
+        return;
+    }
+
+    int spriteI = spriteBatch->handleSlots[handle];
+    writeSprite(spriteBatch, spriteI, sprite);
+    markDirty(spriteBatch, spriteI, spriteI + 1);
+}
+
+void spriteBatchRemove(SpriteBatch *spriteBatch, SpriteHandle handle) {
+    if (!isHandleValid(spriteBatch, handle)) {
+        return;
+    }
+
+    // Keep sprites contiguous by moving the last one into the removed slot.
+    int spriteI = spriteBatch->handleSlots[handle];
+    int lastSpriteI = spriteBatch->spriteCount - 1;
+
+    if (spriteI != lastSpriteI) {
+        size_t stride = spriteBatch->spriteStride;
+        memcpy(spriteBatch->spriteData + spriteI * stride,
+               spriteBatch->spriteData + lastSpriteI * stride, stride);
+
+        if (spriteBatch->spriteDepths) {
+            spriteBatch->spriteDepths[spriteI] =
+                spriteBatch->spriteDepths[lastSpriteI];
+            spriteBatch->spriteTranslucency[spriteI] =
+                spriteBatch->spriteTranslucency[lastSpriteI];
+        }
+
+        SpriteHandle movedHandle = spriteBatch->slotHandles[lastSpriteI];
+        spriteBatch->slotHandles[spriteI] = movedHandle;
+        if (movedHandle != invalidSpriteHandle) {
+            spriteBatch->handleSlots[movedHandle] = spriteI;
+        }
+    }
+
+    // Removing the last sprite doesn't need an upload, but sorted batches
+    // still need to notice that their order changed.
+    markDirty(spriteBatch, spriteI, spriteI + 1);
+
+    --spriteBatch->spriteCount;
+    spriteBatch->handleSlots[handle] = -1;
+    spriteBatch->freeHandles[spriteBatch->freeHandleCount++] = handle;
+}
+
+void spriteBatchAddMany(SpriteBatch *spriteBatch, const Sprite *sprites,
+                        int count) {
+    int firstSpriteI;
+    count = reserveSprites(spriteBatch, count, &firstSpriteI);
+
+    for (int i = 0; i < count; ++i) {
+        writeSprite(spriteBatch, firstSpriteI + i, sprites[i]);
+    }
+}
+
+static float arrayField(const float *field, int i) {
+    return field ? field[i] : 0.0f;
+}
+
+void spriteBatchAddArrays(SpriteBatch *spriteBatch, const SpriteArrays *arrays,
+                          int count) {
+    int firstSpriteI;
+    count = reserveSprites(spriteBatch, count, &firstSpriteI);
+
+    if (count <= 0) {
+        return;
+    }
+
+    if (spriteBatch->format == SpriteBatchFormatVertex) {
+        writeSpriteArrayVertices(
+            (float *)(spriteBatch->spriteData +
+                      firstSpriteI * spriteBatch->spriteStride),
+            arrays, 0, count, spriteBatch->inverseTexWidth,
+            spriteBatch->inverseTexHeight);
+
+        if (spriteBatch->spriteDepths) {
+            for (int i = 0; i < count; ++i) {
+                recordSortInfo(spriteBatch, firstSpriteI + i,
+                               arrayField(arrays->z, i),
+                               arrayField(arrays->a, i),
+                               arrayField(arrays->blend, i));
+            }
+        }
+
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        writeSprite(spriteBatch, firstSpriteI + i,
+                    (Sprite){
+                        .x = arrayField(arrays->x, i),
+                        .y = arrayField(arrays->y, i),
+                        .z = arrayField(arrays->z, i),
+                        .width = arrayField(arrays->width, i),
+                        .height = arrayField(arrays->height, i),
+                        .texX = arrayField(arrays->texX, i),
+                        .texY = arrayField(arrays->texY, i),
+                        .texWidth = arrayField(arrays->texWidth, i),
+                        .texHeight = arrayField(arrays->texHeight, i),
+                        .r = arrayField(arrays->r, i),
+                        .g = arrayField(arrays->g, i),
+                        .b = arrayField(arrays->b, i),
+                        .a = arrayField(arrays->a, i),
+                        .blend = arrayField(arrays->blend, i),
+                        .layer = arrays->layer ? arrays->layer[i] : 0,
+                    });
+    }
+}
+
+void spriteBatchGrow(SpriteBatch *spriteBatch, int maxSprites) {
+    if (maxSprites > spriteBatch->maxSprites) {
+        growSprites(spriteBatch, maxSprites);
+    }
+}
+
+void spriteBatchBeginParallel(SpriteBatch *spriteBatch) {
+    spriteBatch->parallelStart = spriteBatch->spriteCount;
+    SDL_AtomicSet(&spriteBatch->parallelCount, spriteBatch->spriteCount);
+}
+
+int spriteBatchReserve(SpriteBatch *spriteBatch, int count,
+                       int *firstSpriteI) {
+    if (count <= 0) {
+        *firstSpriteI = spriteBatch->maxSprites;
+        return 0;
+    }
+
+    *firstSpriteI = SDL_AtomicAdd(&spriteBatch->parallelCount, count);
+
+    int available = spriteBatch->maxSprites - *firstSpriteI;
+    if (available <= 0) {
+        return 0;
+    }
+
+    return count < available ? count : available;
+}
+
+void spriteBatchWrite(SpriteBatch *spriteBatch, int spriteI, Sprite sprite) {
+    writeSprite(spriteBatch, spriteI, sprite);
+}
+
+void spriteBatchEndParallel(SpriteBatch *spriteBatch) {
+    // Reservations that didn't fit still advanced the counter, so clamp it.
+    int spriteCount = SDL_AtomicGet(&spriteBatch->parallelCount);
+    if (spriteCount > spriteBatch->maxSprites) {
+        recordDemand(spriteBatch, 0, spriteCount, spriteBatch->maxSprites);
+
+        // Growing moves spriteData while other threads may be writing to it,
+        // so it waits until now. The sprites that didn't fit are lost, but
+        // the next fill will fit.
+        int demand = spriteCount;
+        spriteCount = spriteBatch->maxSprites;
+        if (spriteBatch->isGrowable) {
+            growSprites(spriteBatch, demand);
+        }
+    }
+
+    int firstSpriteI;
+    reserveSprites(spriteBatch, spriteCount - spriteBatch->parallelStart,
+                   &firstSpriteI);
+}
+
+static WGPURenderPipeline spriteBatchPipeline(
+    SpriteBatch *spriteBatch, const SpritePipelines *pipelines) {
+    switch (spriteBatch->format) {
+        case SpriteBatchFormatInstanced:
+            return spriteBatch->textureInfo.isArray ? pipelines->instancedArray
+                                                    : pipelines->instanced;
+        case SpriteBatchFormatPacked:
+            return pipelines->packed;
+        case SpriteBatchFormatPackedShort:
+            return pipelines->shortPacked;
+        default:
+            return pipelines->vertex;
+    }
+}
+
+// Orders sortedData with opaque sprites first, front to back, followed by
+// translucent sprites, back to front. Larger z values are closer.
+static void sortSprites(SpriteBatch *spriteBatch) {
+    int spriteCount = spriteBatch->spriteCount;
+
+    int opaqueCount = 0;
+    for (int i = 0; i < spriteCount; ++i) {
+        opaqueCount += !spriteBatch->spriteTranslucency[i];
+    }
+
+    int opaqueI = 0;
+    int translucentI = opaqueCount;
+    for (int i = 0; i < spriteCount; ++i) {
+        uint32_t key = radixSortKeyFromFloat(spriteBatch->spriteDepths[i]);
+
+        if (spriteBatch->spriteTranslucency[i]) {
+            spriteBatch->sortKeys[translucentI] = key;
+            spriteBatch->sortIndices[translucentI++] = i;
+        } else {
+            spriteBatch->sortKeys[opaqueI] = ~key;
+            spriteBatch->sortIndices[opaqueI++] = i;
+        }
+    }
+
+    radixSort32(spriteBatch->sortKeys, spriteBatch->sortIndices,
+                spriteBatch->sortTempKeys, spriteBatch->sortTempIndices,
+                opaqueCount);
+    radixSort32(spriteBatch->sortKeys + opaqueCount,
+                spriteBatch->sortIndices + opaqueCount,
+                spriteBatch->sortTempKeys, spriteBatch->sortTempIndices,
+                spriteCount - opaqueCount);
+
+    size_t stride = spriteBatch->spriteStride;
+    for (int i = 0; i < spriteCount; ++i) {
+        memcpy(spriteBatch->sortedData + i * stride,
+               spriteBatch->spriteData + spriteBatch->sortIndices[i] * stride,
+               stride);
+    }
+
+    spriteBatch->opaqueCount = opaqueCount;
+}
+
+static void stagingBufferMapped(WGPUBufferMapAsyncStatus status,
+                                void *userdata) {
+    SpriteStagingBuffer *stagingBuffer = userdata;
+    stagingBuffer->isMapPending = false;
+
+    if (status != WGPUBufferMapAsyncStatus_Success) {
+        printf("Failed to map staging buffer, status: %d\n", status);
+        return;
+    }
+
+    stagingBuffer->isMapped = true;
+}
+
+// Mapping a buffer only completes once the GPU is done with it, so the map
+// callbacks double as the fence for each staging buffer. Buffers are only
+// remapped once the frame that copied from them has been submitted.
+static void mapStagingBuffers(SpriteBatch *spriteBatch, Renderer *renderer) {
+    for (int i = 0; i < spriteBatch->stagingBufferCount; ++i) {
+        SpriteStagingBuffer *stagingBuffer = &spriteBatch->stagingBuffers[i];
+
+        if (stagingBuffer->isMapped || stagingBuffer->isMapPending ||
+            stagingBuffer->usedFrame >= renderer->frameIndex) {
+            continue;
+        }
+
+        stagingBuffer->isMapPending = true;
+        wgpuBufferMapAsync(stagingBuffer->buffer, WGPUMapMode_Write, 0,
+                           spriteBatch->gpuCapacity * spriteBatch->spriteStride,
+                           stagingBufferMapped, stagingBuffer);
+    }
+}
+
+// Returns the next staging buffer in the ring once it is mapped, waiting for
+// the GPU if necessary. Returns NULL if every buffer was already used this
+// frame, since waiting for them would never finish.
+static SpriteStagingBuffer *acquireStagingBuffer(SpriteBatch *spriteBatch,
+                                                 Renderer *renderer) {
+    wgpuDevicePoll(renderer->device, false, NULL);
+    mapStagingBuffers(spriteBatch, renderer);
+
+    SpriteStagingBuffer *stagingBuffer =
+        &spriteBatch->stagingBuffers[spriteBatch->nextStagingBuffer];
+
+    if (!stagingBuffer->isMapped && !stagingBuffer->isMapPending) {
+        return NULL;
+    }
+
+    if (!stagingBuffer->isMapped) {
+        ++spriteBatch->stats.stallCount;
+
+        while (stagingBuffer->isMapPending) {
+            wgpuDevicePoll(renderer->device, true, NULL);
+        }
+
+        if (!stagingBuffer->isMapped) {
+            return NULL;
+        }
+    }
+
+    spriteBatch->nextStagingBuffer =
+        (spriteBatch->nextStagingBuffer + 1) % spriteBatch->stagingBufferCount;
+
+    return stagingBuffer;
+}
+
+// Uploads a range of sprites with either a staging buffer or, if stagingBuffer
+// is NULL, wgpuQueueWriteBuffer.
+static void uploadRange(SpriteBatch *spriteBatch, Renderer *renderer,
+                        SpriteStagingBuffer *stagingBuffer, uint8_t *mapped,
+                        const uint8_t *spriteData, SpriteRange range) {
+    size_t stride = spriteBatch->spriteStride;
+    size_t offset = range.start * stride;
+    size_t rangeSize = (range.end - range.start) * stride;
+
+    if (stagingBuffer) {
+        memcpy(mapped + offset, spriteData + offset, rangeSize);
+        wgpuCommandEncoderCopyBufferToBuffer(
+            rendererGetPreEncoder(renderer), stagingBuffer->buffer, offset,
+            spriteBatch->vertexBuffer, offset, rangeSize);
+    } else {
+        wgpuQueueWriteBuffer(renderer->queue, spriteBatch->vertexBuffer,
+                             offset, spriteData + offset, rangeSize);
+    }
+
+    spriteBatch->stats.uploadedBytes += rangeSize;
+}
+
+// Records the culling pass ahead of the frame's render pass. It reads the
+// sprites after this frame's uploads, which are recorded before it.
+static void cullSprites(SpriteBatch *spriteBatch, Renderer *renderer) {
+    // The sprite count is all the params hold, so most frames can skip the
+    // write.
+    if (spriteBatch->cullSpriteCount != spriteBatch->spriteCount) {
+        uint32_t cullParams[4] = {(uint32_t)spriteBatch->spriteCount, 0, 0, 0};
+        wgpuQueueWriteBuffer(renderer->queue, spriteBatch->cullParamsBuffer, 0,
+                             cullParams, sizeof(cullParams));
+        spriteBatch->cullSpriteCount = spriteBatch->spriteCount;
+    }
+
+    WGPUCommandEncoder encoder = rendererGetPreEncoder(renderer);
+
+    // Reset the instance count, the second of the draw arguments.
+    wgpuCommandEncoderClearBuffer(encoder, spriteBatch->drawArgsBuffer,
+                                  sizeof(uint32_t), sizeof(uint32_t));
+
+    WGPUComputePassTimestampWrite timestampWrites[2];
+    size_t timestampWriteCount = 0;
+    if (renderer->profiler) {
+        timestampWriteCount = profilerComputePassWrites(
+            renderer->profiler, spriteBatch->profilerScope, timestampWrites);
+    }
+
+    WGPUComputePassEncoder cullPass = wgpuCommandEncoderBeginComputePass(
+        encoder, &(WGPUComputePassDescriptor){
+                     .label = "Cull pass",
+                     .timestampWriteCount = timestampWriteCount,
+                     .timestampWrites = timestampWrites,
+                 });
+    wgpuComputePassEncoderSetPipeline(cullPass, renderer->cullPipeline);
+    wgpuComputePassEncoderSetBindGroup(cullPass, 0, spriteBatch->cullBindGroup,
+                                       0, NULL);
+    wgpuComputePassEncoderDispatchWorkgroups(
+        cullPass, (spriteBatch->spriteCount + cullWorkgroupSize - 1) /
+                      cullWorkgroupSize,
+        1, 1);
+    wgpuComputePassEncoderEnd(cullPass);
+}
+
+// Draws count sprites starting at firstSpriteI, with the batch's buffers
+// already bound.
+static void drawSprites(SpriteBatch *spriteBatch, Renderer *renderer,
+                        WGPURenderPipeline pipeline, int firstSpriteI,
+                        int count) {
+    if (count <= 0) {
         return;
     }
 
-    int indexCount = spriteBatch->spriteCount * indicesPerSprite;
-    int vertexComponentCount =
-        spriteBatch->spriteCount * verticesPerSprite * spriteVertexComponents;
+    wgpuRenderPassEncoderSetPipeline(renderer->renderPass, pipeline);
+
+    if (spriteBatch->format == SpriteBatchFormatInstanced) {
+        wgpuRenderPassEncoderDrawIndexed(renderer->renderPass,
+                                         indicesPerSprite, count, 0, 0,
+                                         firstSpriteI);
+    } else {
+        wgpuRenderPassEncoderDrawIndexed(
+            renderer->renderPass, count * indicesPerSprite, 1,
+            firstSpriteI * indicesPerSprite, 0, 0);
+    }
+}
 
-    wgpuQueueWriteBuffer(renderer->queue, spriteBatch->vertexBuffer, 0,
-                         spriteBatch->vertexData,
-                         vertexComponentCount * sizeof(float));
-    wgpuQueueWriteBuffer(renderer->queue, spriteBatch->indexBuffer, 0,
-                         spriteBatch->indexData, indexCount * sizeof(uint32_t));
+// Returns the bindings shared by every draw of the batch.
+static RenderQueueItem drawItem(const SpriteBatch *spriteBatch) {
+    bool isInstanced = spriteBatch->format == SpriteBatchFormatInstanced;
+    int indexCount =
+        isInstanced ? indicesPerSprite
+                    : spriteBatch->spriteCount * indicesPerSprite;
+    size_t indexSize = spriteBatch->indexFormat == WGPUIndexFormat_Uint16
+                           ? sizeof(uint16_t)
+                           : sizeof(uint32_t);
 
-    wgpuRenderPassEncoderSetPipeline(renderer->renderPass, renderer->pipeline);
+    return (RenderQueueItem){
+        .bindGroup = spriteBatch->bindGroup,
+        .vertexBuffer = spriteBatch->cullBindGroup ? spriteBatch->visibleBuffer
+                                                   : spriteBatch->vertexBuffer,
+        .vertexBufferSize = spriteBatch->spriteCount * spriteBatch->spriteStride,
+        .indexBuffer = spriteBatch->indexBuffer,
+        .indexFormat = spriteBatch->indexFormat,
+        .indexBufferSize = indexCount * indexSize,
+    };
+}
+
+// Records the batch's draws into the frame's render pass, after its sprites
+// have been uploaded.
+static void recordDraws(SpriteBatch *spriteBatch, Renderer *renderer) {
+    RenderQueueItem item = drawItem(spriteBatch);
     wgpuRenderPassEncoderSetVertexBuffer(renderer->renderPass, 0,
-                                         spriteBatch->vertexBuffer, 0,
-                                         vertexComponentCount * sizeof(float));
-    wgpuRenderPassEncoderSetIndexBuffer(
-        renderer->renderPass, spriteBatch->indexBuffer, WGPUIndexFormat_Uint32,
-        0, indexCount * sizeof(uint32_t));
+                                         item.vertexBuffer, 0,
+                                         item.vertexBufferSize);
+    wgpuRenderPassEncoderSetIndexBuffer(renderer->renderPass,
+                                        item.indexBuffer, item.indexFormat,
+                                        0, item.indexBufferSize);
     wgpuRenderPassEncoderSetBindGroup(renderer->renderPass, 0,
-                                      spriteBatch->bindGroup, 0, NULL);
+                                      item.bindGroup, 0, NULL);
+
+    if (spriteBatch->cullBindGroup) {
+        wgpuRenderPassEncoderSetPipeline(
+            renderer->renderPass,
+            spriteBatchPipeline(spriteBatch, &renderer->pipelines));
+        wgpuRenderPassEncoderDrawIndexedIndirect(
+            renderer->renderPass, spriteBatch->drawArgsBuffer, 0);
+        return;
+    }
+
+    if (!spriteBatch->sortedData) {
+        drawSprites(spriteBatch, renderer,
+                    spriteBatchPipeline(spriteBatch, &renderer->pipelines), 0,
+                    spriteBatch->spriteCount);
+        return;
+    }
+
+    int opaqueCount = spriteBatch->opaqueCount;
+    spriteBatch->stats.translucentSpriteCount =
+        spriteBatch->spriteCount - opaqueCount;
+    drawSprites(spriteBatch, renderer,
+                spriteBatchPipeline(spriteBatch, &renderer->pipelines), 0,
+                opaqueCount);
+    drawSprites(
+        spriteBatch, renderer,
+        spriteBatchPipeline(spriteBatch, &renderer->translucentPipelines),
+        opaqueCount, spriteBatch->spriteCount - opaqueCount);
+}
+
+// Uploads the sprites that changed since the last draw and culls them if the
+// batch is culled. Returns false if there is nothing to draw.
+static bool prepareDraw(SpriteBatch *spriteBatch, Renderer *renderer) {
+    if (!renderer->hasRenderPass) {
+        return false;
+    }
+
+    spriteBatch->stats.uploadedBytes = 0;
+
+    if (spriteBatch->spriteCount == 0) {
+        return false;
+    }
+
+    if (spriteBatch->spriteCount > spriteBatch->gpuCapacity) {
+        growBuffers(spriteBatch, renderer);
+    }
+
+    // Any change can move sprites in the draw order, so sorted batches are
+    // sorted and uploaded as a whole.
+    const uint8_t *spriteData = spriteBatch->spriteData;
+    if (spriteBatch->sortedData) {
+        if (spriteBatch->dirtyRangeCount > 0) {
+            sortSprites(spriteBatch);
+            spriteBatch->dirtyRanges[0] =
+                (SpriteRange){.start = 0, .end = spriteBatch->spriteCount};
+            spriteBatch->dirtyRangeCount = 1;
+        }
+
+        spriteData = spriteBatch->sortedData;
+    }
+
+    SpriteStagingBuffer *stagingBuffer = NULL;
+    uint8_t *mapped = NULL;
+    if (spriteBatch->stagingBufferCount > 0 &&
+        spriteBatch->dirtyRangeCount > 0) {
+        stagingBuffer = acquireStagingBuffer(spriteBatch, renderer);
+
+        if (stagingBuffer) {
+            mapped = wgpuBufferGetMappedRange(
+                stagingBuffer->buffer, 0,
+                spriteBatch->gpuCapacity * spriteBatch->spriteStride);
+        }
+    }
+
+    // Queue writes land before the copies recorded in the pre-encoder, so
+    // once this frame has staged sprites, writing newer ones with the queue
+    // would let the staged copies overwrite them. Those ranges stay dirty and
+    // are uploaded next frame instead.
+    bool isStagedThisFrame =
+        spriteBatch->stagedFrameCount == renderer->frameIndex + 1;
+    if (stagingBuffer || !isStagedThisFrame) {
+        // Only upload sprites that changed since the last draw. Staging
+        // buffers may hold older sprites elsewhere, but only the dirty ranges
+        // are copied.
+        for (int i = 0; i < spriteBatch->dirtyRangeCount; ++i) {
+            SpriteRange range = spriteBatch->dirtyRanges[i];
+            if (range.end > spriteBatch->spriteCount) {
+                range.end = spriteBatch->spriteCount;
+            }
+
+            if (range.start >= range.end) {
+                continue;
+            }
+
+            uploadRange(spriteBatch, renderer, stagingBuffer, mapped,
+                        spriteData, range);
+        }
+        spriteBatch->dirtyRangeCount = 0;
+    }
+
+    if (stagingBuffer) {
+        wgpuBufferUnmap(stagingBuffer->buffer);
+        stagingBuffer->isMapped = false;
+        stagingBuffer->usedFrame = renderer->frameIndex;
+        spriteBatch->stagedFrameCount = renderer->frameIndex + 1;
+    }
+
+    if (spriteBatch->cullBindGroup) {
+        cullSprites(spriteBatch, renderer);
+    }
+
+    return true;
+}
+
+void spriteBatchDraw(SpriteBatch *spriteBatch, Renderer *renderer) {
+    if (!prepareDraw(spriteBatch, renderer)) {
+        return;
+    }
+
+    // Timestamps can only be written around passes, so batches timed on their
+    // own get a render pass of their own.
+    bool isTimed = renderer->profiler && renderer->profiler->hasTimestamps &&
+                   spriteBatch->profilerScope >= 0;
+    if (isTimed) {
+        rendererSplitRenderPass(renderer, spriteBatch->profilerScope);
+    }
+
+    recordDraws(spriteBatch, renderer);
+
+    if (isTimed) {
+        rendererSplitRenderPass(renderer, profilerFrameScope);
+    }
+}
+
+// Queues count sprites starting at firstSpriteI with the bindings in item.
+static void submitSprites(SpriteBatch *spriteBatch, RenderQueue *renderQueue,
+                          RenderQueueItem item, int firstSpriteI, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    if (spriteBatch->format == SpriteBatchFormatInstanced) {
+        item.indexCount = indicesPerSprite;
+        item.instanceCount = count;
+        item.firstInstance = firstSpriteI;
+    } else {
+        item.indexCount = count * indicesPerSprite;
+        item.instanceCount = 1;
+        item.firstIndex = firstSpriteI * indicesPerSprite;
+    }
+
+    renderQueueSubmit(renderQueue, item);
+}
+
+void spriteBatchSubmit(SpriteBatch *spriteBatch, Renderer *renderer,
+                       RenderQueue *renderQueue, uint8_t layer, float depth) {
+    if (!prepareDraw(spriteBatch, renderer)) {
+        return;
+    }
+
+    RenderQueueItem item = drawItem(spriteBatch);
+    item.layer = layer;
+    item.depth = depth;
+    item.pipeline = spriteBatchPipeline(spriteBatch, &renderer->pipelines);
+
+    if (spriteBatch->cullBindGroup) {
+        item.indirectBuffer = spriteBatch->drawArgsBuffer;
+        renderQueueSubmit(renderQueue, item);
+        return;
+    }
+
+    // Unsorted batches blend in submission order, so translucent ones have to
+    // keep their place in the depth order instead of being grouped by state.
+    if (!spriteBatch->sortedData) {
+        item.isTranslucent = spriteBatch->textureInfo.hasTranslucency;
+        submitSprites(spriteBatch, renderQueue, item, 0,
+                      spriteBatch->spriteCount);
+        return;
+    }
+
+    int opaqueCount = spriteBatch->opaqueCount;
+    spriteBatch->stats.translucentSpriteCount =
+        spriteBatch->spriteCount - opaqueCount;
+    submitSprites(spriteBatch, renderQueue, item, 0, opaqueCount);
 
-    wgpuRenderPassEncoderDrawIndexed(renderer->renderPass, indexCount, 1, 0, 0,
-                                     0);
+    item.isTranslucent = true;
+    item.pipeline =
+        spriteBatchPipeline(spriteBatch, &renderer->translucentPipelines);
+    submitSprites(spriteBatch, renderQueue, item, opaqueCount,
+                  spriteBatch->spriteCount - opaqueCount);
 }
@@ -2,7 +2,9 @@
 #define SPRITE_H
 
 #include "matrix.h"
+#include "renderQueue.h"
 #include "renderer.h"
+#include "spriteArrays.h"
 #include "texture.h"
 
 typedef struct {
@@ -23,35 +25,271 @@ typedef struct {
     float b;
     float a;
     float blend;
+
+    // Texture array layer, ignored by batches without a texture array.
+    uint32_t layer;
 } Sprite;
 
+typedef enum {
+    // Four vertices are built on the CPU for every sprite.
+    SpriteBatchFormatVertex,
+    // One SpriteInstance is stored per sprite and the quad is expanded in the
+    // vertex shader.
+    SpriteBatchFormatInstanced,
+    // Like SpriteBatchFormatVertex, but with 8 bit color and blend and 16 bit
+    // texture coordinates. Texture coordinates must stay within the texture,
+    // so repeating textures aren't supported.
+    SpriteBatchFormatPacked,
+    // Like SpriteBatchFormatPacked, but positions are also stored as 16 bit
+    // integers, so they are rounded to whole units between -32768 and 32767.
+    SpriteBatchFormatPackedShort,
+} SpriteBatchFormat;
+
+typedef enum {
+    // Sprites are drawn in the order they were added.
+    SpriteBatchOrderingSubmission,
+    // Opaque sprites are drawn front to back with depth writes, so hidden
+    // pixels are rejected before shading. Translucent sprites are drawn after
+    // them, back to front and without depth writes, so they blend correctly.
+    SpriteBatchOrderingSorted,
+} SpriteBatchOrdering;
+
+// Identifies a retained sprite within its batch. Handles of removed sprites
+// are reused by later spriteBatchAddRetained calls.
+typedef int SpriteHandle;
+
+#define invalidSpriteHandle (-1)
+
+// A range of sprite indices, from start up to but not including end.
+typedef struct {
+    int start;
+    int end;
+} SpriteRange;
+
+#define maxDirtyRanges 4
+
+typedef struct {
+    // Bytes written to GPU buffers by the most recent spriteBatchDraw.
+    size_t uploadedBytes;
+    // Number of draws that had to wait for the GPU to release a staging
+    // buffer. Only counted for batches with more than one buffer.
+    uint64_t stallCount;
+    // Sprites drawn without depth writes by the most recent draw of a sorted
+    // batch.
+    int translucentSpriteCount;
+    // Most sprites the batch was asked to hold at once, including any that
+    // were dropped. Useful for choosing maxSprites.
+    int highWaterMark;
+    // Sprites dropped because the batch was full.
+    uint64_t droppedSpriteCount;
+    // Times a growable batch had to replace its GPU buffers.
+    uint64_t reallocationCount;
+} SpriteBatchStats;
+
+// A staging buffer that sprites are written into through mapped memory before
+// being copied to the batch's vertex buffer.
+typedef struct {
+    WGPUBuffer buffer;
+    bool isMapped;
+    bool isMapPending;
+    // The frame whose commands last copied from this buffer.
+    uint64_t usedFrame;
+} SpriteStagingBuffer;
+
 typedef struct {
     int maxSprites;
     int spriteCount;
+    // Whether adding sprites to a full batch grows it instead of dropping
+    // them.
+    bool isGrowable;
+    // Sprites the GPU buffers have room for, which lags behind maxSprites
+    // until a grown batch is drawn.
+    int gpuCapacity;
+
+    SpriteBatchFormat format;
+    SpriteBatchOrdering ordering;
+    // Bytes of spriteData used by each sprite.
+    size_t spriteStride;
+    uint8_t *spriteData;
+
+    // Sprites that changed since the last draw and need to be uploaded.
+    SpriteRange dirtyRanges[maxDirtyRanges];
+    int dirtyRangeCount;
+
+    // Maps retained sprite handles to sprite indices and back. These are only
+    // allocated once the first retained sprite is added.
+    int *handleSlots;
+    SpriteHandle *slotHandles;
+    SpriteHandle *freeHandles;
+    int freeHandleCount;
+    int handleCount;
+
+    // Ring of staging buffers used instead of wgpuQueueWriteBuffer when the
+    // batch was created with more than one buffer.
+    SpriteStagingBuffer *stagingBuffers;
+    int stagingBufferCount;
+    int nextStagingBuffer;
+    // One more than the last frame that copied sprites from a staging buffer,
+    // 0 if none has.
+    uint64_t stagedFrameCount;
+
+    // Sorted batches keep each sprite's depth and whether it is translucent,
+    // and upload sortedData, a copy of spriteData in draw order. The first
+    // opaqueCount sorted sprites are opaque.
+    float *spriteDepths;
+    bool *spriteTranslucency;
+    uint8_t *sortedData;
+    uint32_t *sortKeys;
+    uint32_t *sortIndices;
+    uint32_t *sortTempKeys;
+    uint32_t *sortTempIndices;
+    int opaqueCount;
+
+    // Culled batches copy the sprites that overlap the view into
+    // visibleBuffer and draw them with the arguments in drawArgsBuffer.
+    WGPUBuffer visibleBuffer;
+    WGPUBuffer drawArgsBuffer;
+    WGPUBuffer cullParamsBuffer;
+    WGPUBindGroup cullBindGroup;
+    // Sprite count last written to cullParamsBuffer, -1 if none has been.
+    int cullSpriteCount;
 
-    float *vertexData;
-    uint32_t *indexData;
     WGPUBuffer vertexBuffer;
     WGPUBuffer indexBuffer;
+    WGPUIndexFormat indexFormat;
     WGPUBindGroup bindGroup;
     TextureInfo textureInfo;
+    // Whether the texture was loaded by the batch and is released with it.
+    bool ownsTexture;
 
     float inverseTexWidth;
     float inverseTexHeight;
+
+    SpriteBatchStats stats;
+    // -1 if the batch isn't timed on its own.
+    int profilerScope;
+
+    // Next free sprite while the batch is being filled from several threads.
+    SDL_atomic_t parallelCount;
+    int parallelStart;
 } SpriteBatch;
 
 typedef struct {
     TextureWrapMode textureWrapMode;
     TextureFilteringMode textureFilteringMode;
+    SpriteBatchFormat format;
+    // Number of staging buffers to cycle through when uploading sprites, so
+    // the CPU can fill one while the GPU still copies from the others. 0 or 1
+    // uploads with wgpuQueueWriteBuffer instead.
+    int bufferCount;
+    SpriteBatchOrdering ordering;
+    // Culls sprites outside the view in a compute pass before drawing them
+    // with an indirect draw. Culled batches always use the instanced format,
+    // and their sprites are drawn in no particular order, so the ordering is
+    // ignored. The cull runs before the frame's render pass and overwrites
+    // the previous cull's results, so draw culled batches at most once per
+    // frame.
+    bool gpuCulling;
+    // Generates mip levels for the batch's texture, which keeps zoomed out
+    // sprites from aliasing and reading more texels than they show.
+    bool generateMips;
+    // Reports the batch's GPU time under this name when the renderer is
+    // profiling, see rendererGetProfilerStats. With timestamp queries the
+    // batch is drawn in a render pass of its own to time it, which costs a
+    // little on tiled GPUs.
+    const char *profilerScope;
+    // Doubles the batch's capacity when it fills up instead of dropping
+    // sprites. The GPU buffers are replaced on the next draw, which uploads
+    // every sprite again.
+    bool growable;
 } SpriteBatchOptions;
 
 SpriteBatch spriteBatchCreate(int maxSprites, char *texturePath,
                               Renderer *renderer, SpriteBatchOptions options);
 
+// Creates an instanced batch whose sprites can use any layer of a texture array
+// loaded from texturePaths, which must all be the same size.
+SpriteBatch spriteBatchCreateArray(int maxSprites, char **texturePaths,
+                                   int textureCount, Renderer *renderer,
+                                   SpriteBatchOptions options);
+
+// Creates a batch that draws from an existing texture, such as an atlas page.
+// The texture's sampler and mip levels are used, so the wrap, filtering and
+// mip options are ignored.
+SpriteBatch spriteBatchCreateFromTexture(int maxSprites, TextureInfo textureInfo,
+                                         Renderer *renderer,
+                                         SpriteBatchOptions options);
+
+// Releases the batch's buffers and arrays once the GPU is done with them, as
+// well as its texture if the batch loaded it. Textures passed to
+// spriteBatchCreateFromTexture or spriteBatchSetTexture still belong to the
+// caller.
+void spriteBatchDestroy(SpriteBatch *spriteBatch, Renderer *renderer);
+
+// Draws the batch's sprites from a different texture, such as one that just
+// finished loading in the background. Sprites already in the batch keep
+// their texture coordinates in pixels. Packed formats clamp coordinates to
+// the texture bound when a sprite is added, so packed sprites added while a
+// smaller texture was bound have to be added again. A texture the batch
+// loaded itself is released.
+void spriteBatchSetTexture(SpriteBatch *spriteBatch, Renderer *renderer,
+                           TextureInfo textureInfo);
+
 void spriteBatchClear(SpriteBatch *spriteBatch);
 
 void spriteBatchAdd(SpriteBatch *spriteBatch, Sprite sprite);
 
+// Retained sprites stay in the batch until they are removed or the batch is
+// cleared, and are only uploaded again after they change. Returns
+// invalidSpriteHandle if the batch is full.
+SpriteHandle spriteBatchAddRetained(SpriteBatch *spriteBatch, Sprite sprite);
+
+void spriteBatchUpdate(SpriteBatch *spriteBatch, SpriteHandle handle,
+                       Sprite sprite);
+
+// Removes a retained sprite by moving the batch's last sprite into its place.
+void spriteBatchRemove(SpriteBatch *spriteBatch, SpriteHandle handle);
+
+// Adds count sprites at once. Sprites that don't fit in a batch that isn't
+// growable are dropped.
+void spriteBatchAddMany(SpriteBatch *spriteBatch, const Sprite *sprites,
+                        int count);
+
+// Adds count sprites stored as separate arrays. Vertex format batches expand
+// them with SIMD where the CPU supports it.
+void spriteBatchAddArrays(SpriteBatch *spriteBatch, const SpriteArrays *arrays,
+                          int count);
+
+// Makes room for at least maxSprites sprites, even if the batch isn't
+// growable. Batches can't grow while being filled in parallel, so call this
+// beforehand when the sprite count is known.
+void spriteBatchGrow(SpriteBatch *spriteBatch, int maxSprites);
+
+// Starts filling the batch from several threads. Until spriteBatchEndParallel
+// is called, only spriteBatchReserve and spriteBatchWrite may be used.
+void spriteBatchBeginParallel(SpriteBatch *spriteBatch);
+
+// Reserves up to count consecutive sprites starting at *firstSpriteI, and
+// returns how many were reserved. Safe to call from any thread. Sprites that
+// don't fit are dropped even if the batch is growable, see
+// spriteBatchEndParallel.
+int spriteBatchReserve(SpriteBatch *spriteBatch, int count, int *firstSpriteI);
+
+// Writes a sprite previously reserved with spriteBatchReserve. Different
+// threads may write different sprites at the same time.
+void spriteBatchWrite(SpriteBatch *spriteBatch, int spriteI, Sprite sprite);
+
+// Finishes a parallel fill. Sprites dropped by spriteBatchReserve are counted
+// in the batch's stats, and growable batches grow so the same fill fits next
+// time.
+void spriteBatchEndParallel(SpriteBatch *spriteBatch);
+
 void spriteBatchDraw(SpriteBatch *spriteBatch, Renderer *renderer);
+// Uploads the batch like spriteBatchDraw, but queues its draws to be recorded
+// by renderQueueFlush along with draws of other batches that share state. The
+// batch must not change or be drawn again before the flush. Queued batches
+// are timed as part of the frame, even if they have a profiler scope.
+void spriteBatchSubmit(SpriteBatch *spriteBatch, Renderer *renderer,
+                       RenderQueue *renderQueue, uint8_t layer, float depth);
 
 #endif
\ No newline at end of file
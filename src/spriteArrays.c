@@ -0,0 +1,263 @@
+#include "spriteArrays.h"
+
+#include <SDL2/SDL.h>
+
+#include "spriteModel.h"
+
+// SSE2 is always available on x86-64, AVX2 is checked for at runtime.
+#if defined(__x86_64__) || defined(_M_X64)
+#define SPRITE_ARRAYS_SIMD 1
+#include <immintrin.h>
+#else
+#define SPRITE_ARRAYS_SIMD 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+#define spriteComponents (verticesPerSprite * spriteVertexComponents)
+
+typedef void (*SpriteArrayWriter)(float *vertexData, const SpriteArrays *arrays,
+                                  int first, int count, float inverseTexWidth,
+                                  float inverseTexHeight);
+
+static float loadField(const float *field, int i) {
+    return field ? field[i] : 0.0f;
+}
+
+static void writeVerticesScalar(float *vertexData, const SpriteArrays *arrays,
+                                int first, int count, float inverseTexWidth,
+                                float inverseTexHeight) {
+    for (int i = 0; i < count; ++i) {
+        int spriteI = first + i;
+        float *spriteVertices = vertexData + i * spriteComponents;
+
+        float x = loadField(arrays->x, spriteI);
+        float y = loadField(arrays->y, spriteI);
+        float z = loadField(arrays->z, spriteI);
+        float width = loadField(arrays->width, spriteI);
+        float height = loadField(arrays->height, spriteI);
+        float r = loadField(arrays->r, spriteI);
+        float g = loadField(arrays->g, spriteI);
+        float b = loadField(arrays->b, spriteI);
+        float a = loadField(arrays->a, spriteI);
+        float blend = loadField(arrays->blend, spriteI);
+
+        float normalTextureWidth =
+            loadField(arrays->texWidth, spriteI) * inverseTexWidth;
+        float normalTextureHeight =
+            loadField(arrays->texHeight, spriteI) * inverseTexHeight;
+        float normalTextureX = loadField(arrays->texX, spriteI) * inverseTexWidth;
+        float normalTextureY =
+            loadField(arrays->texY, spriteI) * inverseTexHeight;
+
+        for (int v = 0; v < verticesPerSprite; ++v) {
+            int componentI = v * spriteVertexComponents;
+            float *vertex = spriteVertices + componentI;
+            vertex[0] = spriteVertexData[componentI + 0] * width + x;
+            vertex[1] = spriteVertexData[componentI + 1] * height + y;
+            vertex[2] = spriteVertexData[componentI + 2] + z;
+            vertex[3] = r;
+            vertex[4] = g;
+            vertex[5] = b;
+            vertex[6] = a;
+            vertex[7] = blend;
+            vertex[8] = spriteVertexData[componentI + 8] * normalTextureWidth +
+                        normalTextureX;
+            vertex[9] = spriteVertexData[componentI + 9] * normalTextureHeight +
+                        normalTextureY;
+        }
+    }
+}
+
+#if SPRITE_ARRAYS_SIMD
+
+// The fields of four consecutive sprites, one sprite per lane. Corner values
+// are computed the same way as in writeVerticesScalar so both paths produce
+// identical vertices.
+typedef struct {
+    __m128 x0, x1, y0, y1, z;
+    __m128 r, g, b, a, blend;
+    __m128 u0, u1, v0, v1;
+} SpriteLanes;
+
+static inline __m128 loadField4(const float *field, int i) {
+    return field ? _mm_loadu_ps(field + i) : _mm_setzero_ps();
+}
+
+// Transposes the lanes into four sprites' worth of interleaved vertices.
+static inline void storeSpriteLanes(float *vertexData, SpriteLanes *lanes) {
+    __m128 cornerX[verticesPerSprite] = {lanes->x0, lanes->x1, lanes->x1,
+                                         lanes->x0};
+    __m128 cornerY[verticesPerSprite] = {lanes->y0, lanes->y0, lanes->y1,
+                                         lanes->y1};
+    __m128 cornerU[verticesPerSprite] = {lanes->u0, lanes->u1, lanes->u1,
+                                         lanes->u0};
+    __m128 cornerV[verticesPerSprite] = {lanes->v1, lanes->v1, lanes->v0,
+                                         lanes->v0};
+
+    // Green, blue, alpha and blend are shared by all of a sprite's vertices.
+    __m128 gbab0 = lanes->g;
+    __m128 gbab1 = lanes->b;
+    __m128 gbab2 = lanes->a;
+    __m128 gbab3 = lanes->blend;
+    _MM_TRANSPOSE4_PS(gbab0, gbab1, gbab2, gbab3);
+    __m128 gbab[4] = {gbab0, gbab1, gbab2, gbab3};
+
+    for (int v = 0; v < verticesPerSprite; ++v) {
+        __m128 xyzr0 = cornerX[v];
+        __m128 xyzr1 = cornerY[v];
+        __m128 xyzr2 = lanes->z;
+        __m128 xyzr3 = lanes->r;
+        _MM_TRANSPOSE4_PS(xyzr0, xyzr1, xyzr2, xyzr3);
+        __m128 xyzr[4] = {xyzr0, xyzr1, xyzr2, xyzr3};
+
+        __m128 uvLow = _mm_unpacklo_ps(cornerU[v], cornerV[v]);
+        __m128 uvHigh = _mm_unpackhi_ps(cornerU[v], cornerV[v]);
+
+        float *vertex = vertexData + v * spriteVertexComponents;
+        for (int s = 0; s < 4; ++s) {
+            float *spriteVertex = vertex + s * spriteComponents;
+            _mm_storeu_ps(spriteVertex, xyzr[s]);
+            _mm_storeu_ps(spriteVertex + 4, gbab[s]);
+        }
+        _mm_storel_pi((__m64 *)(vertex + 0 * spriteComponents + 8), uvLow);
+        _mm_storeh_pi((__m64 *)(vertex + 1 * spriteComponents + 8), uvLow);
+        _mm_storel_pi((__m64 *)(vertex + 2 * spriteComponents + 8), uvHigh);
+        _mm_storeh_pi((__m64 *)(vertex + 3 * spriteComponents + 8), uvHigh);
+    }
+}
+
+static void writeVerticesSse2(float *vertexData, const SpriteArrays *arrays,
+                              int first, int count, float inverseTexWidth,
+                              float inverseTexHeight) {
+    __m128 inverseWidth = _mm_set1_ps(inverseTexWidth);
+    __m128 inverseHeight = _mm_set1_ps(inverseTexHeight);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int spriteI = first + i;
+        SpriteLanes lanes;
+        lanes.x0 = loadField4(arrays->x, spriteI);
+        lanes.y0 = loadField4(arrays->y, spriteI);
+        lanes.x1 = _mm_add_ps(loadField4(arrays->width, spriteI), lanes.x0);
+        lanes.y1 = _mm_add_ps(loadField4(arrays->height, spriteI), lanes.y0);
+        lanes.z = loadField4(arrays->z, spriteI);
+        lanes.r = loadField4(arrays->r, spriteI);
+        lanes.g = loadField4(arrays->g, spriteI);
+        lanes.b = loadField4(arrays->b, spriteI);
+        lanes.a = loadField4(arrays->a, spriteI);
+        lanes.blend = loadField4(arrays->blend, spriteI);
+        lanes.u0 = _mm_mul_ps(loadField4(arrays->texX, spriteI), inverseWidth);
+        lanes.v0 =
+            _mm_mul_ps(loadField4(arrays->texY, spriteI), inverseHeight);
+        lanes.u1 = _mm_add_ps(
+            _mm_mul_ps(loadField4(arrays->texWidth, spriteI), inverseWidth),
+            lanes.u0);
+        lanes.v1 = _mm_add_ps(
+            _mm_mul_ps(loadField4(arrays->texHeight, spriteI), inverseHeight),
+            lanes.v0);
+
+        storeSpriteLanes(vertexData + i * spriteComponents, &lanes);
+    }
+
+    writeVerticesScalar(vertexData + i * spriteComponents, arrays, first + i,
+                        count - i, inverseTexWidth, inverseTexHeight);
+}
+
+TARGET_AVX2 static inline __m256 loadField8(const float *field, int i) {
+    return field ? _mm256_loadu_ps(field + i) : _mm256_setzero_ps();
+}
+
+// Computes eight sprites at a time, then hands each half to the SSE2
+// transpose, since interleaving is bound by stores rather than arithmetic.
+TARGET_AVX2 static void writeVerticesAvx2(float *vertexData,
+                                          const SpriteArrays *arrays, int first,
+                                          int count, float inverseTexWidth,
+                                          float inverseTexHeight) {
+    __m256 inverseWidth = _mm256_set1_ps(inverseTexWidth);
+    __m256 inverseHeight = _mm256_set1_ps(inverseTexHeight);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int spriteI = first + i;
+        __m256 x0 = loadField8(arrays->x, spriteI);
+        __m256 y0 = loadField8(arrays->y, spriteI);
+        __m256 x1 = _mm256_add_ps(loadField8(arrays->width, spriteI), x0);
+        __m256 y1 = _mm256_add_ps(loadField8(arrays->height, spriteI), y0);
+        __m256 z = loadField8(arrays->z, spriteI);
+        __m256 r = loadField8(arrays->r, spriteI);
+        __m256 g = loadField8(arrays->g, spriteI);
+        __m256 b = loadField8(arrays->b, spriteI);
+        __m256 a = loadField8(arrays->a, spriteI);
+        __m256 blend = loadField8(arrays->blend, spriteI);
+        __m256 u0 =
+            _mm256_mul_ps(loadField8(arrays->texX, spriteI), inverseWidth);
+        __m256 v0 =
+            _mm256_mul_ps(loadField8(arrays->texY, spriteI), inverseHeight);
+        __m256 u1 = _mm256_add_ps(
+            _mm256_mul_ps(loadField8(arrays->texWidth, spriteI), inverseWidth),
+            u0);
+        __m256 v1 = _mm256_add_ps(
+            _mm256_mul_ps(loadField8(arrays->texHeight, spriteI),
+                          inverseHeight),
+            v0);
+
+        SpriteLanes low = {
+            _mm256_castps256_ps128(x0),    _mm256_castps256_ps128(x1),
+            _mm256_castps256_ps128(y0),    _mm256_castps256_ps128(y1),
+            _mm256_castps256_ps128(z),     _mm256_castps256_ps128(r),
+            _mm256_castps256_ps128(g),     _mm256_castps256_ps128(b),
+            _mm256_castps256_ps128(a),     _mm256_castps256_ps128(blend),
+            _mm256_castps256_ps128(u0),    _mm256_castps256_ps128(u1),
+            _mm256_castps256_ps128(v0),    _mm256_castps256_ps128(v1),
+        };
+        SpriteLanes high = {
+            _mm256_extractf128_ps(x0, 1),    _mm256_extractf128_ps(x1, 1),
+            _mm256_extractf128_ps(y0, 1),    _mm256_extractf128_ps(y1, 1),
+            _mm256_extractf128_ps(z, 1),     _mm256_extractf128_ps(r, 1),
+            _mm256_extractf128_ps(g, 1),     _mm256_extractf128_ps(b, 1),
+            _mm256_extractf128_ps(a, 1),     _mm256_extractf128_ps(blend, 1),
+            _mm256_extractf128_ps(u0, 1),    _mm256_extractf128_ps(u1, 1),
+            _mm256_extractf128_ps(v0, 1),    _mm256_extractf128_ps(v1, 1),
+        };
+
+        storeSpriteLanes(vertexData + i * spriteComponents, &low);
+        storeSpriteLanes(vertexData + (i + 4) * spriteComponents, &high);
+    }
+
+    writeVerticesSse2(vertexData + i * spriteComponents, arrays, first + i,
+                      count - i, inverseTexWidth, inverseTexHeight);
+}
+
+#endif
+
+static SpriteArrayWriter selectWriter(void) {
+#if SPRITE_ARRAYS_SIMD
+    if (SDL_HasAVX2()) {
+        return writeVerticesAvx2;
+    }
+
+    if (SDL_HasSSE2()) {
+        return writeVerticesSse2;
+    }
+#endif
+
+    return writeVerticesScalar;
+}
+
+void writeSpriteArrayVertices(float *vertexData, const SpriteArrays *arrays,
+                              int first, int count, float inverseTexWidth,
+                              float inverseTexHeight) {
+    static SpriteArrayWriter writer = NULL;
+
+    if (!writer) {
+        writer = selectWriter();
+    }
+
+    writer(vertexData, arrays, first, count, inverseTexWidth,
+           inverseTexHeight);
+}
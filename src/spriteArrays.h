@@ -0,0 +1,40 @@
+#ifndef SPRITE_ARRAYS_H
+#define SPRITE_ARRAYS_H
+
+#include <inttypes.h>
+
+// Sprite fields stored as separate arrays, with one element per sprite. Any
+// array may be NULL, in which case that field is 0 for every sprite, matching
+// a zero initialized Sprite.
+typedef struct {
+    const float *x;
+    const float *y;
+    const float *z;
+
+    const float *width;
+    const float *height;
+
+    const float *texX;
+    const float *texY;
+    const float *texWidth;
+    const float *texHeight;
+
+    const float *r;
+    const float *g;
+    const float *b;
+    const float *a;
+    const float *blend;
+
+    // Texture array layers, ignored by batches without a texture array.
+    const uint32_t *layer;
+} SpriteArrays;
+
+// Expands count sprites, starting at index first of arrays, into four vertices
+// each, laid out like spriteVertexData. The vertices of sprite first are
+// written to the start of vertexData. Uses AVX2 or SSE2 when the CPU supports
+// them.
+void writeSpriteArrayVertices(float *vertexData, const SpriteArrays *arrays,
+                              int first, int count, float inverseTexWidth,
+                              float inverseTexHeight);
+
+#endif
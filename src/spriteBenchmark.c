@@ -0,0 +1,297 @@
+#include "jobs.h"
+#include "renderer.h"
+#include "sprite.h"
+
+// Measures the CPU cost of filling, clearing and drawing sprite batches on a
+// headless renderer. Results are printed as one JSON object per line so they
+// can be collected and compared across releases.
+
+#define benchmarkWidth 640
+#define benchmarkHeight 480
+#define benchmarkSpritesPerSize 2000000
+#define benchmarkMinFrames 5
+#define benchmarkMaxFrames 1000
+// Frames the profiler check renders at most before giving up on a sample.
+#define profilerCheckFrames 240
+
+static const int batchSizes[] = {10, 100, 1000, 10000, 100000, 1000000};
+
+static const SpriteBatchFormat formats[] = {
+    SpriteBatchFormatVertex,
+    SpriteBatchFormatInstanced,
+    SpriteBatchFormatPacked,
+    SpriteBatchFormatPackedShort,
+};
+
+static const char *formatNames[] = {
+    "vertex",
+    "instanced",
+    "packed",
+    "packedShort",
+};
+
+static double secondsSince(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) /
+           (double)SDL_GetPerformanceFrequency();
+}
+
+static Sprite *createSprites(int count) {
+    Sprite *sprites = malloc(count * sizeof(Sprite));
+    uint32_t seed = 12345;
+
+    for (int i = 0; i < count; ++i) {
+        // A small LCG keeps the input identical between runs.
+        seed = seed * 1664525u + 1013904223u;
+        float x = (float)(seed % benchmarkWidth);
+        seed = seed * 1664525u + 1013904223u;
+        float y = (float)(seed % benchmarkHeight);
+
+        sprites[i] = (Sprite){
+            .x = x,
+            .y = y,
+            .z = (float)(i % 100),
+            .width = 16.0f,
+            .height = 16.0f,
+            .texX = 8.0f,
+            .texY = 8.0f,
+            .texWidth = 8.0f,
+            .texHeight = 8.0f,
+            .r = 1.0f,
+            .g = 1.0f,
+            .b = 1.0f,
+            .a = 1.0f,
+        };
+    }
+
+    return sprites;
+}
+
+// Copies the sprites into separate arrays for spriteBatchAddArrays. All of
+// the arrays share one allocation, which starts at the returned x array.
+static SpriteArrays createSpriteArrays(const Sprite *sprites, int count) {
+    float *fields = malloc(14 * count * sizeof(float));
+    SpriteArrays arrays = {
+        .x = fields + 0 * count,
+        .y = fields + 1 * count,
+        .z = fields + 2 * count,
+        .width = fields + 3 * count,
+        .height = fields + 4 * count,
+        .texX = fields + 5 * count,
+        .texY = fields + 6 * count,
+        .texWidth = fields + 7 * count,
+        .texHeight = fields + 8 * count,
+        .r = fields + 9 * count,
+        .g = fields + 10 * count,
+        .b = fields + 11 * count,
+        .a = fields + 12 * count,
+        .blend = fields + 13 * count,
+    };
+
+    for (int i = 0; i < count; ++i) {
+        const Sprite *sprite = &sprites[i];
+        fields[0 * count + i] = sprite->x;
+        fields[1 * count + i] = sprite->y;
+        fields[2 * count + i] = sprite->z;
+        fields[3 * count + i] = sprite->width;
+        fields[4 * count + i] = sprite->height;
+        fields[5 * count + i] = sprite->texX;
+        fields[6 * count + i] = sprite->texY;
+        fields[7 * count + i] = sprite->texWidth;
+        fields[8 * count + i] = sprite->texHeight;
+        fields[9 * count + i] = sprite->r;
+        fields[10 * count + i] = sprite->g;
+        fields[11 * count + i] = sprite->b;
+        fields[12 * count + i] = sprite->a;
+        fields[13 * count + i] = sprite->blend;
+    }
+
+    return arrays;
+}
+
+typedef struct {
+    SpriteBatch *spriteBatch;
+    const Sprite *sprites;
+} ParallelAddData;
+
+static void parallelAddSprites(void *data, int start, int end) {
+    ParallelAddData *addData = data;
+
+    int firstSpriteI;
+    int count =
+        spriteBatchReserve(addData->spriteBatch, end - start, &firstSpriteI);
+    for (int i = 0; i < count; ++i) {
+        spriteBatchWrite(addData->spriteBatch, firstSpriteI + i,
+                         addData->sprites[start + i]);
+    }
+}
+
+static void benchmarkBatchSize(Renderer *renderer, JobSystem *jobSystem,
+                               int batchSize, int formatI, FILE *output) {
+    SpriteBatch spriteBatch = spriteBatchCreate(
+        batchSize, "test.png", renderer,
+        (SpriteBatchOptions){
+            .textureFilteringMode = TextureFilteringModeNearest,
+            .textureWrapMode = TextureWrapModeClamp,
+            .format = formats[formatI],
+        });
+    Sprite *sprites = createSprites(batchSize);
+    SpriteArrays spriteArrays = createSpriteArrays(sprites, batchSize);
+
+    int frames = benchmarkSpritesPerSize / batchSize;
+    if (frames < benchmarkMinFrames) {
+        frames = benchmarkMinFrames;
+    } else if (frames > benchmarkMaxFrames) {
+        frames = benchmarkMaxFrames;
+    }
+
+    double clearSeconds = 0.0;
+    double addSeconds = 0.0;
+    double addArraysSeconds = 0.0;
+    double parallelAddSeconds = 0.0;
+    double drawSeconds = 0.0;
+    size_t uploadedBytes = 0;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        spriteBatchClear(&spriteBatch);
+        clearSeconds += secondsSince(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < batchSize; ++i) {
+            spriteBatchAdd(&spriteBatch, sprites[i]);
+        }
+        addSeconds += secondsSince(start);
+
+        rendererBegin(renderer, 0.0f, 0.0f, 0.0f);
+
+        start = SDL_GetPerformanceCounter();
+        spriteBatchDraw(&spriteBatch, renderer);
+        drawSeconds += secondsSince(start);
+        uploadedBytes += spriteBatch.stats.uploadedBytes;
+
+        rendererEnd(renderer);
+
+        // Wait for the GPU outside of the timed sections so queued frames
+        // don't pile up and skew later measurements.
+        wgpuDevicePoll(renderer->device, true, NULL);
+    }
+
+    for (int frame = 0; frame < frames; ++frame) {
+        spriteBatchClear(&spriteBatch);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        spriteBatchAddArrays(&spriteBatch, &spriteArrays, batchSize);
+        addArraysSeconds += secondsSince(start);
+    }
+
+    ParallelAddData parallelAddData = {
+        .spriteBatch = &spriteBatch,
+        .sprites = sprites,
+    };
+    for (int frame = 0; frame < frames; ++frame) {
+        spriteBatchClear(&spriteBatch);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        spriteBatchBeginParallel(&spriteBatch);
+        jobSystemParallelFor(jobSystem, batchSize, 0, parallelAddSprites,
+                             &parallelAddData);
+        spriteBatchEndParallel(&spriteBatch);
+        parallelAddSeconds += secondsSince(start);
+    }
+
+    double totalSprites = (double)batchSize * frames;
+    double cpuSeconds = addSeconds + drawSeconds;
+    fprintf(output,
+            "{\"benchmark\": \"spriteBatch\", \"format\": \"%s\", "
+            "\"sprites\": %d, \"frames\": %d, \"addNsPerSprite\": %.3f, "
+            "\"addArraysNsPerSprite\": %.3f, \"parallelAddNsPerSprite\": %.3f, "
+            "\"drawNsPerSprite\": %.3f, \"nsPerSprite\": %.3f, "
+            "\"clearNs\": %.1f, \"spritesPerSecond\": %.0f, "
+            "\"bytesPerFrame\": %zu}\n",
+            formatNames[formatI], batchSize, frames,
+            addSeconds * 1e9 / totalSprites,
+            addArraysSeconds * 1e9 / totalSprites,
+            parallelAddSeconds * 1e9 / totalSprites,
+            drawSeconds * 1e9 / totalSprites, cpuSeconds * 1e9 / totalSprites,
+            clearSeconds * 1e9 / frames, totalSprites / cpuSeconds,
+            uploadedBytes / frames);
+    fflush(output);
+
+    spriteBatchDestroy(&spriteBatch, renderer);
+    free((float *)spriteArrays.x);
+    free(sprites);
+}
+
+// Makes sure the frame scope gets samples without a frames in flight limit,
+// where nothing waits for the GPU and results only arrive through the poll in
+// rendererBegin. Uses a renderer of its own, so profiling doesn't affect the
+// measurements.
+static void checkProfilerSamples(void) {
+    Renderer renderer = rendererCreateHeadless(
+        benchmarkWidth, benchmarkHeight, "shader.wgsl",
+        (RendererOptions){
+            .maxFramesInFlight = 0,
+            .gpuProfiling = true,
+        });
+
+    ProfilerStats stats = {0};
+    for (int frame = 0; frame < profilerCheckFrames && stats.sampleCount == 0;
+         ++frame) {
+        rendererBegin(&renderer, 0.0f, 0.0f, 0.0f);
+        rendererEnd(&renderer);
+        rendererGetProfilerStats(&renderer, "frame", &stats);
+        SDL_Delay(1);
+    }
+
+    rendererDestroy(&renderer);
+
+    if (stats.sampleCount == 0) {
+        printf("The profiler recorded no frame samples without a frames in "
+               "flight limit\n");
+        exit(-1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    FILE *output = stdout;
+    if (argc > 1) {
+        output = fopen(argv[1], "w");
+
+        if (!output) {
+            printf("Cannot open %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (SDL_Init(0) < 0) {
+        printf("Cannot initialize SDL");
+        return 1;
+    }
+
+    checkProfilerSamples();
+
+    Renderer renderer =
+        rendererCreateHeadless(benchmarkWidth, benchmarkHeight, "shader.wgsl",
+                               (RendererOptions){0});
+    JobSystem *jobSystem = jobSystemCreate(0);
+
+    int formatCount = sizeof(formats) / sizeof(formats[0]);
+    int batchSizeCount = sizeof(batchSizes) / sizeof(batchSizes[0]);
+    for (int formatI = 0; formatI < formatCount; ++formatI) {
+        for (int i = 0; i < batchSizeCount; ++i) {
+            benchmarkBatchSize(&renderer, jobSystem, batchSizes[i], formatI,
+                               output);
+        }
+    }
+
+    jobSystemDestroy(jobSystem);
+    rendererDestroy(&renderer);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    SDL_Quit();
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include "spriteGrid.h"
+
+#include <math.h>
+
+#include "radixSort.h"
+
+SpriteGrid spriteGridCreate(float cellSize) {
+    if (cellSize <= 0.0f) {
+        printf("Sprite grid cells must have a positive size\n");
+        exit(-1);
+    }
+
+    return (SpriteGrid){
+        .cellSize = cellSize,
+    };
+}
+
+void spriteGridDestroy(SpriteGrid *spriteGrid) {
+    free(spriteGrid->sprites);
+    free(spriteGrid->spriteBounds);
+    free(spriteGrid->cellStarts);
+    free(spriteGrid->cellSprites);
+    free(spriteGrid->visibleSprites);
+    free(spriteGrid->visibleValues);
+    free(spriteGrid->tempKeys);
+    free(spriteGrid->tempValues);
+    free(spriteGrid->visibleData);
+    *spriteGrid = (SpriteGrid){0};
+}
+
+int spriteGridAdd(SpriteGrid *spriteGrid, Sprite sprite) {
+    if (spriteGrid->spriteCount >= spriteGrid->spriteCapacity) {
+        int capacity =
+            spriteGrid->spriteCapacity > 0 ? spriteGrid->spriteCapacity * 2 : 64;
+        spriteGrid->sprites =
+            realloc(spriteGrid->sprites, capacity * sizeof(Sprite));
+        spriteGrid->spriteBounds =
+            realloc(spriteGrid->spriteBounds, capacity * sizeof(CameraRect));
+        spriteGrid->spriteCapacity = capacity;
+    }
+
+    // Sprites with a negative size are flipped, so they extend the other way.
+    int spriteI = spriteGrid->spriteCount++;
+    spriteGrid->sprites[spriteI] = sprite;
+    spriteGrid->spriteBounds[spriteI] = (CameraRect){
+        .left = fminf(sprite.x, sprite.x + sprite.width),
+        .bottom = fminf(sprite.y, sprite.y + sprite.height),
+        .right = fmaxf(sprite.x, sprite.x + sprite.width),
+        .top = fmaxf(sprite.y, sprite.y + sprite.height),
+    };
+    spriteGrid->isDirty = true;
+
+    return spriteI;
+}
+
+void spriteGridClear(SpriteGrid *spriteGrid) {
+    spriteGrid->spriteCount = 0;
+    spriteGrid->isDirty = true;
+}
+
+static int clampCell(float position, int cellCount) {
+    if (!(position > 0.0f)) {
+        return 0;
+    }
+
+    if (position >= (float)cellCount) {
+        return cellCount - 1;
+    }
+
+    return (int)position;
+}
+
+// Finds the cells overlapped by rect, clamped to the grid.
+static void findCells(const SpriteGrid *spriteGrid, CameraRect rect,
+                      int *startColumn, int *startRow, int *endColumn,
+                      int *endRow) {
+    *startColumn =
+        clampCell((rect.left - spriteGrid->originX) / spriteGrid->cellWidth,
+                  spriteGrid->columns);
+    *startRow =
+        clampCell((rect.bottom - spriteGrid->originY) / spriteGrid->cellHeight,
+                  spriteGrid->rows);
+    *endColumn =
+        clampCell((rect.right - spriteGrid->originX) / spriteGrid->cellWidth,
+                  spriteGrid->columns);
+    *endRow =
+        clampCell((rect.top - spriteGrid->originY) / spriteGrid->cellHeight,
+                  spriteGrid->rows);
+}
+
+static void rebuildCells(SpriteGrid *spriteGrid) {
+    spriteGrid->isDirty = false;
+
+    if (spriteGrid->spriteCount == 0) {
+        spriteGrid->columns = 0;
+        spriteGrid->rows = 0;
+        spriteGrid->cellSpriteCount = 0;
+        return;
+    }
+
+    CameraRect bounds = spriteGrid->spriteBounds[0];
+    for (int i = 1; i < spriteGrid->spriteCount; ++i) {
+        CameraRect spriteBounds = spriteGrid->spriteBounds[i];
+        bounds.left = fminf(bounds.left, spriteBounds.left);
+        bounds.bottom = fminf(bounds.bottom, spriteBounds.bottom);
+        bounds.right = fmaxf(bounds.right, spriteBounds.right);
+        bounds.top = fmaxf(bounds.top, spriteBounds.top);
+    }
+
+    float width = bounds.right - bounds.left;
+    float height = bounds.top - bounds.bottom;
+    int columns = (int)fminf(ceilf(width / spriteGrid->cellSize),
+                             (float)maxSpriteGridCells);
+    int rows = (int)fminf(ceilf(height / spriteGrid->cellSize),
+                          (float)maxSpriteGridCells);
+    columns = columns > 0 ? columns : 1;
+    rows = rows > 0 ? rows : 1;
+
+    spriteGrid->originX = bounds.left;
+    spriteGrid->originY = bounds.bottom;
+    spriteGrid->cellWidth = fmaxf(width / columns, spriteGrid->cellSize);
+    spriteGrid->cellHeight = fmaxf(height / rows, spriteGrid->cellSize);
+    spriteGrid->columns = columns;
+    spriteGrid->rows = rows;
+
+    int cellCount = columns * rows;
+    free(spriteGrid->cellStarts);
+    spriteGrid->cellStarts = calloc(cellCount + 1, sizeof(int));
+
+    // Count the sprites in each cell, then turn the counts into offsets and
+    // place every sprite, like a counting sort.
+    int *cellStarts = spriteGrid->cellStarts;
+    for (int i = 0; i < spriteGrid->spriteCount; ++i) {
+        int startColumn, startRow, endColumn, endRow;
+        findCells(spriteGrid, spriteGrid->spriteBounds[i], &startColumn,
+                  &startRow, &endColumn, &endRow);
+
+        for (int row = startRow; row <= endRow; ++row) {
+            for (int column = startColumn; column <= endColumn; ++column) {
+                ++cellStarts[row * columns + column + 1];
+            }
+        }
+    }
+
+    for (int i = 0; i < cellCount; ++i) {
+        cellStarts[i + 1] += cellStarts[i];
+    }
+
+    spriteGrid->cellSpriteCount = cellStarts[cellCount];
+    free(spriteGrid->cellSprites);
+    spriteGrid->cellSprites = malloc(spriteGrid->cellSpriteCount * sizeof(int));
+
+    // Sprites are placed in increasing order, so every cell lists its sprites
+    // in the order they were added.
+    int *cellEnds = malloc(cellCount * sizeof(int));
+    memcpy(cellEnds, cellStarts, cellCount * sizeof(int));
+    for (int i = 0; i < spriteGrid->spriteCount; ++i) {
+        int startColumn, startRow, endColumn, endRow;
+        findCells(spriteGrid, spriteGrid->spriteBounds[i], &startColumn,
+                  &startRow, &endColumn, &endRow);
+
+        for (int row = startRow; row <= endRow; ++row) {
+            for (int column = startColumn; column <= endColumn; ++column) {
+                spriteGrid->cellSprites[cellEnds[row * columns + column]++] = i;
+            }
+        }
+    }
+    free(cellEnds);
+
+    // A query can't return more sprites than the grid holds.
+    if (spriteGrid->visibleCapacity < spriteGrid->spriteCount) {
+        int capacity = spriteGrid->spriteCapacity;
+        size_t indicesSize = capacity * sizeof(uint32_t);
+        spriteGrid->visibleSprites =
+            realloc(spriteGrid->visibleSprites, indicesSize);
+        spriteGrid->visibleValues =
+            realloc(spriteGrid->visibleValues, indicesSize);
+        spriteGrid->tempKeys = realloc(spriteGrid->tempKeys, indicesSize);
+        spriteGrid->tempValues = realloc(spriteGrid->tempValues, indicesSize);
+        spriteGrid->visibleData =
+            realloc(spriteGrid->visibleData, capacity * sizeof(Sprite));
+        spriteGrid->visibleCapacity = capacity;
+    }
+}
+
+static bool rectsOverlap(CameraRect a, CameraRect b) {
+    return a.left <= b.right && a.right >= b.left && a.bottom <= b.top &&
+           a.top >= b.bottom;
+}
+
+int spriteGridQuery(SpriteGrid *spriteGrid, CameraRect rect,
+                    SpriteBatch *spriteBatch) {
+    if (spriteGrid->isDirty) {
+        rebuildCells(spriteGrid);
+    }
+
+    if (spriteGrid->spriteCount == 0) {
+        return 0;
+    }
+
+    int startColumn, startRow, endColumn, endRow;
+    findCells(spriteGrid, rect, &startColumn, &startRow, &endColumn, &endRow);
+
+    int visibleCount = 0;
+    for (int row = startRow; row <= endRow; ++row) {
+        for (int column = startColumn; column <= endColumn; ++column) {
+            int cellI = row * spriteGrid->columns + column;
+            int cellEnd = spriteGrid->cellStarts[cellI + 1];
+
+            for (int i = spriteGrid->cellStarts[cellI]; i < cellEnd; ++i) {
+                int spriteI = spriteGrid->cellSprites[i];
+                CameraRect spriteBounds = spriteGrid->spriteBounds[spriteI];
+                if (!rectsOverlap(spriteBounds, rect)) {
+                    continue;
+                }
+
+                // Sprites in several cells are only counted in the first
+                // cell that both they and the query overlap.
+                int spriteColumn = clampCell(
+                    (spriteBounds.left - spriteGrid->originX) /
+                        spriteGrid->cellWidth,
+                    spriteGrid->columns);
+                int spriteRow = clampCell(
+                    (spriteBounds.bottom - spriteGrid->originY) /
+                        spriteGrid->cellHeight,
+                    spriteGrid->rows);
+                int firstColumn =
+                    spriteColumn > startColumn ? spriteColumn : startColumn;
+                int firstRow = spriteRow > startRow ? spriteRow : startRow;
+                if (column != firstColumn || row != firstRow) {
+                    continue;
+                }
+
+                spriteGrid->visibleSprites[visibleCount] = (uint32_t)spriteI;
+                spriteGrid->visibleValues[visibleCount] = (uint32_t)spriteI;
+                ++visibleCount;
+            }
+        }
+    }
+
+    // Cells are visited in order, not sprites, so restore the order the
+    // sprites were added in. Sprites at the same depth depend on it.
+    radixSort32(spriteGrid->visibleSprites, spriteGrid->visibleValues,
+                spriteGrid->tempKeys, spriteGrid->tempValues, visibleCount);
+
+    for (int i = 0; i < visibleCount; ++i) {
+        spriteGrid->visibleData[i] =
+            spriteGrid->sprites[spriteGrid->visibleSprites[i]];
+    }
+    spriteBatchAddMany(spriteBatch, spriteGrid->visibleData, visibleCount);
+
+    return visibleCount;
+}
@@ -0,0 +1,62 @@
+#ifndef SPRITE_GRID_H
+#define SPRITE_GRID_H
+
+#include "camera.h"
+#include "sprite.h"
+
+// A uniform grid of static sprites. Only the sprites overlapping a rectangle,
+// usually the camera's visible area, have to be added to a batch each frame,
+// so large worlds cost about as much as the part of them that's on screen.
+typedef struct {
+    Sprite *sprites;
+    // World space bounds of each sprite.
+    CameraRect *spriteBounds;
+    int spriteCount;
+    int spriteCapacity;
+
+    float cellSize;
+    // The grid covers the bounds of all sprites. Cells are grown beyond
+    // cellSize when the bounds are too large for maxSpriteGridCells cells
+    // per axis.
+    float originX;
+    float originY;
+    float cellWidth;
+    float cellHeight;
+    int columns;
+    int rows;
+
+    // Sprite indices of every cell, cell i's are in
+    // cellSprites[cellStarts[i]] up to cellSprites[cellStarts[i + 1]].
+    int *cellStarts;
+    int *cellSprites;
+    int cellSpriteCount;
+    // Set when sprites change, the cells are rebuilt by the next query.
+    bool isDirty;
+
+    // Scratch space for queries.
+    uint32_t *visibleSprites;
+    uint32_t *visibleValues;
+    uint32_t *tempKeys;
+    uint32_t *tempValues;
+    Sprite *visibleData;
+    int visibleCapacity;
+} SpriteGrid;
+
+#define maxSpriteGridCells 1024
+
+// Cells should be a few times larger than a typical sprite. Sprites larger
+// than a cell are stored in every cell they overlap.
+SpriteGrid spriteGridCreate(float cellSize);
+void spriteGridDestroy(SpriteGrid *spriteGrid);
+
+// Returns the index of the new sprite.
+int spriteGridAdd(SpriteGrid *spriteGrid, Sprite sprite);
+void spriteGridClear(SpriteGrid *spriteGrid);
+
+// Adds every sprite that overlaps rect to spriteBatch, in the order they were
+// added to the grid. Returns the number of overlapping sprites, sprites that
+// don't fit in the batch are dropped like with spriteBatchAdd.
+int spriteGridQuery(SpriteGrid *spriteGrid, CameraRect rect,
+                    SpriteBatch *spriteBatch);
+
+#endif
@@ -7,6 +7,65 @@
 #define verticesPerSprite 4
 #define indicesPerSprite 6
 
+// Per-sprite record used by instanced batches. Texture coordinates are
+// normalized to 0-1 and the color is stored as 8 bit unorms. The layer is
+// only used by texture array batches.
+typedef struct {
+    float x;
+    float y;
+    float z;
+
+    float width;
+    float height;
+
+    float texX;
+    float texY;
+    float texWidth;
+    float texHeight;
+
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+    float blend;
+    uint32_t layer;
+} SpriteInstance;
+
+// Vertex used by packed batches, 24 bytes instead of 40.
+typedef struct {
+    float x;
+    float y;
+    float z;
+
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+
+    uint16_t texX;
+    uint16_t texY;
+
+    uint8_t blend;
+    uint8_t padding[3];
+} PackedSpriteVertex;
+
+// Vertex used by short packed batches, 16 bytes instead of 40. Positions are
+// rounded to whole units and the blend is stored alongside them as 0-255.
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    int16_t blend;
+
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+
+    uint16_t texX;
+    uint16_t texY;
+} ShortPackedSpriteVertex;
+
 const float spriteVertexData[];
 const uint32_t spriteIndexData[];
 
@@ -1,11 +1,15 @@
 #include "texture.h"
 
-SDL_Surface *loadSurface(const char *path) {
+#include "gpuMemory.h"
+#include "wgpuHelper.h"
+
+#define minTextureBucketSize 64
+
+SDL_Surface *tryLoadSurface(const char *path) {
     SDL_Surface *loadedSurface = IMG_Load(path);
 
     if (!loadedSurface) {
-        printf("Failed to load file at path: %s", path);
-        exit(-1);
+        return NULL;
     }
 
     SDL_Surface *surface =
@@ -15,12 +19,28 @@ SDL_Surface *loadSurface(const char *path) {
     return surface;
 }
 
+SDL_Surface *loadSurface(const char *path) {
+    SDL_Surface *surface = tryLoadSurface(path);
+
+    if (!surface) {
+        printf("Failed to load file at path: %s", path);
+        exit(-1);
+    }
+
+    return surface;
+}
+
 void loadTextureData(WGPUQueue queue, WGPUTexture texture,
                      SDL_Surface *textureSurface) {
+    loadTextureLayerData(queue, texture, textureSurface, 0);
+}
+
+void loadTextureLayerData(WGPUQueue queue, WGPUTexture texture,
+                          SDL_Surface *textureSurface, uint32_t layer) {
     WGPUImageCopyTexture destination = {
         .texture = texture,
         .mipLevel = 0,
-        .origin = {0, 0, 0},
+        .origin = {0, 0, layer},
         .aspect = WGPUTextureAspect_All,
     };
     WGPUTextureDataLayout source = {
@@ -37,58 +57,373 @@ void loadTextureData(WGPUQueue queue, WGPUTexture texture,
                           &size);
 }
 
-TextureInfo textureCreate(WGPUDevice device, WGPUQueue queue, char *path,
-                          TextureWrapMode wrapMode,
-                          TextureFilteringMode filteringMode) {
+// Expects an RGBA32 surface.
+static bool surfaceHasTranslucency(SDL_Surface *surface) {
+    for (int y = 0; y < surface->h; ++y) {
+        uint8_t *row = (uint8_t *)surface->pixels + y * surface->pitch;
+
+        for (int x = 0; x < surface->w; ++x) {
+            uint8_t alpha = row[x * 4 + 3];
+            if (alpha != 0 && alpha != 255) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static WGPUSampler createSampler(WGPUDevice device, ObjectCache *objectCache,
+                                 TextureWrapMode wrapMode,
+                                 TextureFilteringMode filteringMode,
+                                 uint32_t mipLevelCount) {
+    WGPUAddressMode textureAddressMode = wrapMode == TextureWrapModeClamp
+                                             ? WGPUAddressMode_ClampToEdge
+                                             : WGPUAddressMode_Repeat;
+    WGPUAddressMode textureFilterMode = filteringMode == TextureFilteringModeNearest
+                                             ? WGPUFilterMode_Nearest
+                                             : WGPUFilterMode_Linear;
+    WGPUSamplerDescriptor textureSamplerDescriptor = {
+        .addressModeU = textureAddressMode,
+        .addressModeV = textureAddressMode,
+        .addressModeW = textureAddressMode,
+        .magFilter = textureFilterMode,
+        .minFilter = textureFilterMode,
+        .mipmapFilter = WGPUFilterMode_Linear,
+        .lodMinClamp = 0.0f,
+        .lodMaxClamp = (float)mipLevelCount,
+        .compare = WGPUCompareFunction_Undefined,
+        .maxAnisotropy = 0,
+    };
+
+    if (objectCache) {
+        return objectCacheGetSampler(objectCache, &textureSamplerDescriptor);
+    }
+
+    return wgpuDeviceCreateSampler(device, &textureSamplerDescriptor);
+}
+
+// Renders each mip level from the one above it with a bilinear sample, which
+// averages the 2x2 source texels under every destination texel.
+static const char *mipmapShaderSource =
+    "@group(0) @binding(0) var source: texture_2d<f32>;\n"
+    "@group(0) @binding(1) var sourceSampler: sampler;\n"
+    "\n"
+    "struct VertexOutput {\n"
+    "    @builtin(position) position: vec4<f32>,\n"
+    "    @location(0) textureCoords: vec2<f32>,\n"
+    "};\n"
+    "\n"
+    "// One triangle that covers the whole target.\n"
+    "@vertex\n"
+    "fn vs_mipmap(@builtin(vertex_index) vertexIndex: u32) -> VertexOutput {\n"
+    "    let textureCoords = vec2<f32>(f32((vertexIndex << 1u) & 2u),\n"
+    "        f32(vertexIndex & 2u));\n"
+    "    var out: VertexOutput;\n"
+    "    out.position = vec4<f32>(textureCoords * vec2<f32>(2.0, -2.0) +\n"
+    "        vec2<f32>(-1.0, 1.0), 0.0, 1.0);\n"
+    "    out.textureCoords = textureCoords;\n"
+    "    return out;\n"
+    "}\n"
+    "\n"
+    "@fragment\n"
+    "fn fs_mipmap(in: VertexOutput) -> @location(0) vec4<f32> {\n"
+    "    return textureSampleLevel(source, sourceSampler, in.textureCoords,\n"
+    "        0.0);\n"
+    "}\n";
 
+uint32_t textureMipLevelCount(uint32_t width, uint32_t height) {
+    uint32_t mipLevelCount = 1;
+    while (width > 1 || height > 1) {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        ++mipLevelCount;
+    }
+
+    return mipLevelCount;
+}
+
+static WGPUTextureView createLevelView(WGPUTexture texture, uint32_t level,
+                                       uint32_t layer) {
+    return wgpuTextureCreateView(
+        texture, &(WGPUTextureViewDescriptor){
+                     .aspect = WGPUTextureAspect_All,
+                     .baseArrayLayer = layer,
+                     .arrayLayerCount = 1,
+                     .baseMipLevel = level,
+                     .mipLevelCount = 1,
+                     .dimension = WGPUTextureViewDimension_2D,
+                     .format = WGPUTextureFormat_RGBA8Unorm,
+                 });
+}
+
+// Fills mip levels firstLevel up to mipLevelCount of every layer on the GPU.
+// The texture needs the RenderAttachment usage.
+static void generateMipmaps(WGPUDevice device, WGPUQueue queue,
+                            ObjectCache *objectCache, WGPUTexture texture,
+                            uint32_t layerCount, uint32_t firstLevel,
+                            uint32_t mipLevelCount) {
+    if (firstLevel >= mipLevelCount) {
+        return;
+    }
+
+    // Textures can be created without a cache, the pipeline still needs one.
+    ObjectCache localObjectCache;
+    if (!objectCache) {
+        localObjectCache = objectCacheCreate(device);
+        objectCache = &localObjectCache;
+    }
+
+    WGPUShaderModule shader = objectCacheGetShaderModuleFromSource(
+        objectCache, "Mipmap shader", mipmapShaderSource);
+    WGPURenderPipeline pipeline = objectCacheGetPipeline(
+        objectCache, &(PipelineOptions){
+                         .shader = shader,
+                         .vertexEntryPoint = "vs_mipmap",
+                         .fragmentEntryPoint = "fs_mipmap",
+                         .vertexBufferLayout = NULL,
+                         .colorFormat = WGPUTextureFormat_RGBA8Unorm,
+                         .depthTextureFormat = WGPUTextureFormat_Undefined,
+                         .blendMode = BlendModeNone,
+                         .depthWriteEnabled = false,
+                         .depthCompare = WGPUCompareFunction_Always,
+                     });
+    WGPUBindGroupLayout bindGroupLayout =
+        wgpuRenderPipelineGetBindGroupLayout(pipeline, 0);
+    WGPUSampler sampler = createSampler(device, objectCache,
+                                        TextureWrapModeClamp,
+                                        TextureFilteringModeLinear, 1);
+
+    // Views and bind groups are released once the passes are submitted.
+    int passCount = (int)(layerCount * (mipLevelCount - firstLevel));
+    WGPUTextureView *views = malloc(passCount * 2 * sizeof(WGPUTextureView));
+    WGPUBindGroup *bindGroups = malloc(passCount * sizeof(WGPUBindGroup));
+    int passI = 0;
+
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(
+        device, &(WGPUCommandEncoderDescriptor){.label = "Mipmap Encoder"});
+
+    for (uint32_t layer = 0; layer < layerCount; ++layer) {
+        for (uint32_t level = firstLevel; level < mipLevelCount; ++level) {
+            WGPUTextureView sourceView =
+                createLevelView(texture, level - 1, layer);
+            WGPUTextureView targetView = createLevelView(texture, level, layer);
+
+            WGPUBindGroupEntry bindings[2] = {
+                (WGPUBindGroupEntry){
+                    .nextInChain = NULL,
+                    .binding = 0,
+                    .textureView = sourceView,
+                },
+                (WGPUBindGroupEntry){
+                    .nextInChain = NULL,
+                    .binding = 1,
+                    .sampler = sampler,
+                },
+            };
+            WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(
+                device, &(WGPUBindGroupDescriptor){
+                            .nextInChain = NULL,
+                            .layout = bindGroupLayout,
+                            .entryCount = 2,
+                            .entries = bindings,
+                        });
+
+            WGPURenderPassEncoder renderPass =
+                wgpuCommandEncoderBeginRenderPass(
+                    encoder,
+                    &(WGPURenderPassDescriptor){
+                        .colorAttachments =
+                            &(WGPURenderPassColorAttachment){
+                                .view = targetView,
+                                .resolveTarget = NULL,
+                                .loadOp = WGPULoadOp_Clear,
+                                .storeOp = WGPUStoreOp_Store,
+                                .clearValue = (WGPUColor){0},
+                            },
+                        .colorAttachmentCount = 1,
+                        .depthStencilAttachment = NULL,
+                    });
+            wgpuRenderPassEncoderSetPipeline(renderPass, pipeline);
+            wgpuRenderPassEncoderSetBindGroup(renderPass, 0, bindGroup, 0,
+                                              NULL);
+            wgpuRenderPassEncoderDraw(renderPass, 3, 1, 0, 0);
+            wgpuRenderPassEncoderEnd(renderPass);
+
+            views[passI * 2] = sourceView;
+            views[passI * 2 + 1] = targetView;
+            bindGroups[passI] = bindGroup;
+            ++passI;
+        }
+    }
+    wgpuBindGroupLayoutDrop(bindGroupLayout);
+
+    // Texture writes queued before this submit reach the GPU first, so the
+    // passes see the uploaded base level.
+    WGPUCommandBuffer commandBuffer = wgpuCommandEncoderFinish(
+        encoder, &(WGPUCommandBufferDescriptor){.label = NULL});
+    wgpuQueueSubmit(queue, 1, &commandBuffer);
+
+    for (int i = 0; i < passCount; ++i) {
+        wgpuTextureViewDrop(views[i * 2]);
+        wgpuTextureViewDrop(views[i * 2 + 1]);
+        wgpuBindGroupDrop(bindGroups[i]);
+    }
+    free(views);
+    free(bindGroups);
+
+    if (objectCache == &localObjectCache) {
+        objectCacheDestroy(objectCache);
+    }
+}
+
+TextureInfo textureCreate(WGPUDevice device, WGPUQueue queue,
+                          ObjectCache *objectCache, char *path,
+                          TextureWrapMode wrapMode,
+                          TextureFilteringMode filteringMode,
+                          bool generateMips) {
     SDL_Surface *textureSurface = loadSurface(path);
+    TextureInfo textureInfo =
+        textureCreateFromSurface(device, queue, objectCache, textureSurface,
+                                 wrapMode, filteringMode, generateMips);
+    SDL_FreeSurface(textureSurface);
+
+    return textureInfo;
+}
+
+TextureInfo textureCreateFromSurface(WGPUDevice device, WGPUQueue queue,
+                                     ObjectCache *objectCache,
+                                     SDL_Surface *textureSurface,
+                                     TextureWrapMode wrapMode,
+                                     TextureFilteringMode filteringMode,
+                                     bool generateMips) {
     int textureWidth = textureSurface->w;
     int textureHeight = textureSurface->h;
+    uint32_t mipLevelCount =
+        generateMips ? textureMipLevelCount(textureWidth, textureHeight) : 1;
     WGPUTextureDescriptor textureDescriptor = {
         .dimension = WGPUTextureDimension_2D,
         .format = WGPUTextureFormat_RGBA8Unorm,
-        .mipLevelCount = 1,
+        .mipLevelCount = mipLevelCount,
         .sampleCount = 1,
         .size = {textureWidth, textureHeight, 1},
         .usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
         .viewFormatCount = 0,
         .viewFormats = NULL,
     };
+    if (generateMips) {
+        textureDescriptor.usage |= WGPUTextureUsage_RenderAttachment;
+    }
     WGPUTexture texture = wgpuDeviceCreateTexture(device, &textureDescriptor);
+    gpuMemoryTrack(texture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(
+                       textureDescriptor.size.width,
+                       textureDescriptor.size.height,
+                       textureDescriptor.size.depthOrArrayLayers,
+                       textureDescriptor.mipLevelCount, 4));
     loadTextureData(queue, texture, textureSurface);
-    SDL_FreeSurface(textureSurface);
+    generateMipmaps(device, queue, objectCache, texture, 1, 1, mipLevelCount);
+    bool hasTranslucency = surfaceHasTranslucency(textureSurface);
 
     WGPUTextureViewDescriptor textureViewDescriptor = {
         .aspect = WGPUTextureAspect_All,
         .baseArrayLayer = 0,
         .arrayLayerCount = 1,
         .baseMipLevel = 0,
-        .mipLevelCount = 1,
+        .mipLevelCount = mipLevelCount,
         .dimension = WGPUTextureViewDimension_2D,
         .format = textureDescriptor.format,
     };
     WGPUTextureView view =
         wgpuTextureCreateView(texture, &textureViewDescriptor);
-    WGPUAddressMode textureAddressMode = wrapMode == TextureWrapModeClamp
-                                             ? WGPUAddressMode_ClampToEdge
-                                             : WGPUAddressMode_Repeat;
-    WGPUAddressMode textureFilterMode = filteringMode == TextureFilteringModeNearest
-                                             ? WGPUFilterMode_Nearest
-                                             : WGPUFilterMode_Linear;
-    WGPUSamplerDescriptor textureSamplerDescriptor = {
-        .addressModeU = textureAddressMode,
-        .addressModeV = textureAddressMode,
-        .addressModeW = textureAddressMode,
-        .magFilter = textureFilterMode,
-        .minFilter = textureFilterMode,
-        .mipmapFilter = WGPUFilterMode_Linear,
-        .lodMinClamp = 0.0f,
-        .lodMaxClamp = 1.0f,
-        .compare = WGPUCompareFunction_Undefined,
-        .maxAnisotropy = 0,
+    WGPUSampler sampler = createSampler(device, objectCache, wrapMode,
+                                        filteringMode, mipLevelCount);
+
+    return (TextureInfo){
+        .texture = texture,
+        .view = view,
+        .sampler = sampler,
+        .width = textureWidth,
+        .height = textureHeight,
+        .isArray = false,
+        .layerCount = 1,
+        .hasTranslucency = hasTranslucency,
+    };
+}
+
+TextureInfo textureCreateFromMips(WGPUDevice device, WGPUQueue queue,
+                                  ObjectCache *objectCache,
+                                  const TextureMipLevel *mipLevels,
+                                  uint32_t mipLevelCount, bool hasTranslucency,
+                                  TextureWrapMode wrapMode,
+                                  TextureFilteringMode filteringMode,
+                                  bool generateMips) {
+    int textureWidth = (int)mipLevels[0].width;
+    int textureHeight = (int)mipLevels[0].height;
+    // Levels missing from mipLevels are generated after the given ones.
+    uint32_t givenMipLevelCount = mipLevelCount;
+    if (generateMips) {
+        mipLevelCount = textureMipLevelCount(textureWidth, textureHeight);
+    }
+
+    WGPUTextureDescriptor textureDescriptor = {
+        .dimension = WGPUTextureDimension_2D,
+        .format = WGPUTextureFormat_RGBA8Unorm,
+        .mipLevelCount = mipLevelCount,
+        .sampleCount = 1,
+        .size = {textureWidth, textureHeight, 1},
+        .usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
+        .viewFormatCount = 0,
+        .viewFormats = NULL,
+    };
+    if (givenMipLevelCount < mipLevelCount) {
+        textureDescriptor.usage |= WGPUTextureUsage_RenderAttachment;
+    }
+    WGPUTexture texture = wgpuDeviceCreateTexture(device, &textureDescriptor);
+    gpuMemoryTrack(texture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(
+                       textureDescriptor.size.width,
+                       textureDescriptor.size.height,
+                       textureDescriptor.size.depthOrArrayLayers,
+                       textureDescriptor.mipLevelCount, 4));
+
+    for (uint32_t level = 0; level < givenMipLevelCount; ++level) {
+        const TextureMipLevel *mipLevel = &mipLevels[level];
+        WGPUImageCopyTexture destination = {
+            .texture = texture,
+            .mipLevel = level,
+            .origin = {0, 0, 0},
+            .aspect = WGPUTextureAspect_All,
+        };
+        WGPUTextureDataLayout source = {
+            .offset = 0,
+            .bytesPerRow = mipLevel->bytesPerRow,
+            .rowsPerImage = mipLevel->height,
+        };
+        WGPUExtent3D size =
+            (WGPUExtent3D){mipLevel->width, mipLevel->height, 1};
+
+        wgpuQueueWriteTexture(queue, &destination, mipLevel->data,
+                              (size_t)mipLevel->bytesPerRow * mipLevel->height,
+                              &source, &size);
+    }
+
+    generateMipmaps(device, queue, objectCache, texture, 1, givenMipLevelCount,
+                    mipLevelCount);
+
+    WGPUTextureViewDescriptor textureViewDescriptor = {
+        .aspect = WGPUTextureAspect_All,
+        .baseArrayLayer = 0,
+        .arrayLayerCount = 1,
+        .baseMipLevel = 0,
+        .mipLevelCount = mipLevelCount,
+        .dimension = WGPUTextureViewDimension_2D,
+        .format = textureDescriptor.format,
     };
-    WGPUSampler sampler =
-        wgpuDeviceCreateSampler(device, &textureSamplerDescriptor);
+    WGPUTextureView view =
+        wgpuTextureCreateView(texture, &textureViewDescriptor);
+    WGPUSampler sampler = createSampler(device, objectCache, wrapMode,
+                                        filteringMode, mipLevelCount);
 
     return (TextureInfo){
         .texture = texture,
@@ -96,9 +431,111 @@ TextureInfo textureCreate(WGPUDevice device, WGPUQueue queue, char *path,
         .sampler = sampler,
         .width = textureWidth,
         .height = textureHeight,
+        .isArray = false,
+        .layerCount = 1,
+        .hasTranslucency = hasTranslucency,
     };
 }
 
+TextureInfo textureArrayCreate(WGPUDevice device, WGPUQueue queue,
+                               ObjectCache *objectCache, char **paths, int layerCount,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips) {
+    if (layerCount < 1) {
+        printf("Texture arrays need at least one layer\n");
+        exit(-1);
+    }
+
+    SDL_Surface *firstSurface = loadSurface(paths[0]);
+    int textureWidth = firstSurface->w;
+    int textureHeight = firstSurface->h;
+    uint32_t mipLevelCount =
+        generateMips ? textureMipLevelCount(textureWidth, textureHeight) : 1;
+    WGPUTextureDescriptor textureDescriptor = {
+        .dimension = WGPUTextureDimension_2D,
+        .format = WGPUTextureFormat_RGBA8Unorm,
+        .mipLevelCount = mipLevelCount,
+        .sampleCount = 1,
+        .size = {textureWidth, textureHeight, layerCount},
+        .usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
+        .viewFormatCount = 0,
+        .viewFormats = NULL,
+    };
+    if (generateMips) {
+        textureDescriptor.usage |= WGPUTextureUsage_RenderAttachment;
+    }
+    WGPUTexture texture = wgpuDeviceCreateTexture(device, &textureDescriptor);
+    gpuMemoryTrack(texture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(
+                       textureDescriptor.size.width,
+                       textureDescriptor.size.height,
+                       textureDescriptor.size.depthOrArrayLayers,
+                       textureDescriptor.mipLevelCount, 4));
+    loadTextureLayerData(queue, texture, firstSurface, 0);
+    bool hasTranslucency = surfaceHasTranslucency(firstSurface);
+    SDL_FreeSurface(firstSurface);
+
+    for (int i = 1; i < layerCount; ++i) {
+        SDL_Surface *textureSurface = loadSurface(paths[i]);
+
+        if (textureSurface->w != textureWidth ||
+            textureSurface->h != textureHeight) {
+            printf("Texture array layer %s is %dx%d, expected %dx%d\n",
+                   paths[i], textureSurface->w, textureSurface->h,
+                   textureWidth, textureHeight);
+            exit(-1);
+        }
+
+        loadTextureLayerData(queue, texture, textureSurface, i);
+        hasTranslucency =
+            hasTranslucency || surfaceHasTranslucency(textureSurface);
+        SDL_FreeSurface(textureSurface);
+    }
+
+    generateMipmaps(device, queue, objectCache, texture, layerCount, 1,
+                    mipLevelCount);
+
+    WGPUTextureViewDescriptor textureViewDescriptor = {
+        .aspect = WGPUTextureAspect_All,
+        .baseArrayLayer = 0,
+        .arrayLayerCount = layerCount,
+        .baseMipLevel = 0,
+        .mipLevelCount = mipLevelCount,
+        .dimension = WGPUTextureViewDimension_2DArray,
+        .format = textureDescriptor.format,
+    };
+    WGPUTextureView view =
+        wgpuTextureCreateView(texture, &textureViewDescriptor);
+    WGPUSampler sampler = createSampler(device, objectCache, wrapMode,
+                                        filteringMode, mipLevelCount);
+
+    return (TextureInfo){
+        .texture = texture,
+        .view = view,
+        .sampler = sampler,
+        .width = textureWidth,
+        .height = textureHeight,
+        .isArray = true,
+        .layerCount = layerCount,
+        .hasTranslucency = hasTranslucency,
+    };
+}
+
+uint32_t textureBucketSize(uint32_t size) {
+    if (size <= minTextureBucketSize) {
+        return minTextureBucketSize;
+    }
+
+    uint32_t powerOfTwo = minTextureBucketSize;
+    while (powerOfTwo <= size / 2) {
+        powerOfTwo *= 2;
+    }
+
+    uint32_t step = powerOfTwo / 4;
+    return (size + step - 1) / step * step;
+}
+
 DepthTextureInfo depthTextureCreate(WGPUDevice device,
                                     WGPUTextureFormat depthTextureFormat,
                                     uint32_t windowWidth,
@@ -115,6 +552,9 @@ DepthTextureInfo depthTextureCreate(WGPUDevice device,
     };
     WGPUTexture texture =
         wgpuDeviceCreateTexture(device, &depthTextureDescriptor);
+    // Depth24Plus is stored in 4 bytes by every backend.
+    gpuMemoryTrack(texture, GpuMemoryDepth,
+                   gpuMemoryTextureSize(windowWidth, windowHeight, 1, 1, 4));
     WGPUTextureViewDescriptor depthTextureViewDescriptor = {
         .aspect = WGPUTextureAspect_DepthOnly,
         .baseArrayLayer = 0,
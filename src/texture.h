@@ -5,8 +5,13 @@
 #include <SDL2/SDL_image.h>
 
 #include "../webgpu-headers/webgpu.h"
+#include "objectCache.h"
 
+// Loads an image as RGBA32, exiting if it can't be loaded.
 SDL_Surface *loadSurface(const char *path);
+// Like loadSurface, but returns NULL if the image can't be loaded, with the
+// reason in SDL_GetError.
+SDL_Surface *tryLoadSurface(const char *path);
 
 typedef struct {
     WGPUTexture texture;
@@ -21,6 +26,12 @@ typedef struct {
     WGPUSampler sampler;
     int width;
     int height;
+    // Texture arrays are viewed as texture_2d_array, even with one layer.
+    bool isArray;
+    int layerCount;
+    // Whether any texel is partly transparent. Fully transparent texels are
+    // discarded by the shader, so they don't count.
+    bool hasTranslucency;
 } TextureInfo;
 
 typedef enum {
@@ -33,12 +44,65 @@ typedef enum {
     TextureFilteringModeNearest,
 } TextureFilteringMode;
 
+// Texels of one mip level, stored as RGBA8 rows bytesPerRow apart.
+typedef struct {
+    const uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+} TextureMipLevel;
+
 void loadTextureData(WGPUQueue queue, WGPUTexture texture,
                      SDL_Surface *textureSurface);
+void loadTextureLayerData(WGPUQueue queue, WGPUTexture texture,
+                          SDL_Surface *textureSurface, uint32_t layer);
 
-TextureInfo textureCreate(WGPUDevice device, WGPUQueue queue, char *path,
+// Returns the number of mip levels from a width x height image down to 1x1.
+uint32_t textureMipLevelCount(uint32_t width, uint32_t height);
+
+// Textures take their samplers from objectCache, which may be NULL to create
+// a new sampler for every texture. With generateMips the full mip chain is
+// rendered on the GPU from the loaded image, so minified textures are
+// filtered instead of aliasing.
+TextureInfo textureCreate(WGPUDevice device, WGPUQueue queue,
+                          ObjectCache *objectCache, char *path,
                           TextureWrapMode wrapMode,
-                          TextureFilteringMode filteringMode);
+                          TextureFilteringMode filteringMode,
+                          bool generateMips);
+
+// Creates a texture from an RGBA32 surface. The surface is only read, so the
+// caller still owns it.
+TextureInfo textureCreateFromSurface(WGPUDevice device, WGPUQueue queue,
+                                     ObjectCache *objectCache,
+                                     SDL_Surface *textureSurface,
+                                     TextureWrapMode wrapMode,
+                                     TextureFilteringMode filteringMode,
+                                     bool generateMips);
+
+// Creates a texture from already decoded mip levels, starting with the full
+// size image. The data is only read, so the caller still owns it. With
+// generateMips, any levels missing from mipLevels are generated on the GPU.
+TextureInfo textureCreateFromMips(WGPUDevice device, WGPUQueue queue,
+                                  ObjectCache *objectCache,
+                                  const TextureMipLevel *mipLevels,
+                                  uint32_t mipLevelCount, bool hasTranslucency,
+                                  TextureWrapMode wrapMode,
+                                  TextureFilteringMode filteringMode,
+                                  bool generateMips);
+
+// Loads layerCount images into the layers of one texture array. Every image
+// must have the same size.
+TextureInfo textureArrayCreate(WGPUDevice device, WGPUQueue queue,
+                               ObjectCache *objectCache, char **paths, int layerCount,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips);
+
+// Rounds a render target dimension up to the size it is allocated with.
+// Buckets are a quarter of a power of two apart, so targets waste at most a
+// quarter of each dimension and resizing a window only reallocates them a few
+// times per doubling.
+uint32_t textureBucketSize(uint32_t size);
 
 DepthTextureInfo depthTextureCreate(WGPUDevice device,
                                     WGPUTextureFormat depthTextureFormat,
@@ -0,0 +1,204 @@
+#include "textureLoader.h"
+
+static TextureInfo createPlaceholder(Renderer *renderer) {
+    // New surfaces start out cleared, so the texel is transparent and sprites
+    // using the placeholder aren't drawn.
+    SDL_Surface *surface =
+        SDL_CreateRGBSurfaceWithFormat(0, 1, 1, 32, SDL_PIXELFORMAT_RGBA32);
+    TextureInfo placeholder = textureCreateFromSurface(
+        renderer->device, renderer->queue, &renderer->objectCache, surface,
+        TextureWrapModeClamp, TextureFilteringModeNearest, false);
+    SDL_FreeSurface(surface);
+
+    return placeholder;
+}
+
+TextureLoader textureLoaderCreate(Renderer *renderer, JobSystem *jobSystem,
+                                  int maxUploadsPerUpdate) {
+    return (TextureLoader){
+        .renderer = renderer,
+        .jobSystem = jobSystem,
+        .placeholder = createPlaceholder(renderer),
+        .maxUploadsPerUpdate = maxUploadsPerUpdate,
+    };
+}
+
+void textureLoaderDestroy(TextureLoader *textureLoader) {
+    textureLoaderWait(textureLoader, NULL);
+
+    for (int i = 0; i < textureLoader->loadCount; ++i) {
+        TextureLoad *load = textureLoader->loads[i];
+
+        // Failed loads still hold the placeholder, which is released below.
+        if (SDL_AtomicGet(&load->state) == TextureLoadStateReady) {
+            rendererReleaseTextureInfo(textureLoader->renderer,
+                                       load->textureInfo);
+        }
+        free(load->path);
+        free(load);
+    }
+
+    rendererReleaseTextureInfo(textureLoader->renderer,
+                               textureLoader->placeholder);
+    free(textureLoader->loads);
+    free(textureLoader->decodedLoads);
+    *textureLoader = (TextureLoader){0};
+}
+
+typedef struct {
+    TextureLoader *textureLoader;
+    TextureLoad *load;
+} DecodeJob;
+
+static void decodeTexture(void *data) {
+    DecodeJob *job = data;
+    TextureLoader *textureLoader = job->textureLoader;
+    TextureLoad *load = job->load;
+    free(job);
+
+    // Failures are reported by textureLoaderUpdate, exiting here would take
+    // the whole program down over one bad asset.
+    load->surface = tryLoadSurface(load->path);
+    SDL_AtomicSet(&load->state, TextureLoadStateDecoded);
+
+    SDL_AtomicLock(&textureLoader->decodedLock);
+    if (textureLoader->decodedCount >= textureLoader->decodedCapacity) {
+        textureLoader->decodedCapacity = textureLoader->decodedCapacity > 0
+                                             ? textureLoader->decodedCapacity * 2
+                                             : 64;
+        textureLoader->decodedLoads =
+            realloc(textureLoader->decodedLoads,
+                    textureLoader->decodedCapacity * sizeof(TextureLoad *));
+    }
+    textureLoader->decodedLoads[textureLoader->decodedCount++] = load;
+    SDL_AtomicUnlock(&textureLoader->decodedLock);
+
+    // Only count the decode as finished once the load can be uploaded, so
+    // waiting on the counter and then updating uploads it.
+    if (load->group) {
+        SDL_AtomicAdd(&load->group->decodeCounter.remaining, -1);
+    }
+    SDL_AtomicAdd(&textureLoader->pendingGroup.decodeCounter.remaining, -1);
+}
+
+TextureLoad *textureLoaderLoad(TextureLoader *textureLoader, const char *path,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips, TextureLoadGroup *group,
+                               TextureLoadCallback callback, void *userdata) {
+    TextureLoad *load = malloc(sizeof(TextureLoad));
+    *load = (TextureLoad){
+        .path = copyString(path),
+        .wrapMode = wrapMode,
+        .filteringMode = filteringMode,
+        .generateMips = generateMips,
+        .callback = callback,
+        .userdata = userdata,
+        .group = group,
+        .textureInfo = textureLoader->placeholder,
+    };
+    SDL_AtomicSet(&load->state, TextureLoadStateDecoding);
+
+    if (textureLoader->loadCount >= textureLoader->loadCapacity) {
+        textureLoader->loadCapacity = textureLoader->loadCapacity > 0
+                                          ? textureLoader->loadCapacity * 2
+                                          : 64;
+        textureLoader->loads =
+            realloc(textureLoader->loads,
+                    textureLoader->loadCapacity * sizeof(TextureLoad *));
+    }
+    textureLoader->loads[textureLoader->loadCount++] = load;
+
+    if (group) {
+        SDL_AtomicAdd(&group->remaining, 1);
+        SDL_AtomicAdd(&group->decodeCounter.remaining, 1);
+    }
+    SDL_AtomicAdd(&textureLoader->pendingGroup.remaining, 1);
+    SDL_AtomicAdd(&textureLoader->pendingGroup.decodeCounter.remaining, 1);
+
+    DecodeJob *job = malloc(sizeof(DecodeJob));
+    *job = (DecodeJob){
+        .textureLoader = textureLoader,
+        .load = load,
+    };
+    jobSystemSubmit(textureLoader->jobSystem, decodeTexture, job, NULL);
+
+    return load;
+}
+
+int textureLoaderUpdate(TextureLoader *textureLoader) {
+    // Take the loads to upload now, workers can keep adding to the rest.
+    SDL_AtomicLock(&textureLoader->decodedLock);
+    int uploadCount = textureLoader->decodedCount;
+    if (textureLoader->maxUploadsPerUpdate > 0 &&
+        uploadCount > textureLoader->maxUploadsPerUpdate) {
+        uploadCount = textureLoader->maxUploadsPerUpdate;
+    }
+
+    TextureLoad **uploads = NULL;
+    if (uploadCount > 0) {
+        uploads = malloc(uploadCount * sizeof(TextureLoad *));
+        memcpy(uploads, textureLoader->decodedLoads,
+               uploadCount * sizeof(TextureLoad *));
+        memmove(textureLoader->decodedLoads,
+                &textureLoader->decodedLoads[uploadCount],
+                (textureLoader->decodedCount - uploadCount) *
+                    sizeof(TextureLoad *));
+        textureLoader->decodedCount -= uploadCount;
+    }
+    SDL_AtomicUnlock(&textureLoader->decodedLock);
+
+    // The texture writes are only queued here, they all reach the GPU with
+    // the next submit.
+    Renderer *renderer = textureLoader->renderer;
+    int readyCount = 0;
+    for (int i = 0; i < uploadCount; ++i) {
+        TextureLoad *load = uploads[i];
+
+        if (load->surface) {
+            load->textureInfo = textureCreateFromSurface(
+                renderer->device, renderer->queue, &renderer->objectCache,
+                load->surface, load->wrapMode, load->filteringMode,
+                load->generateMips);
+            SDL_FreeSurface(load->surface);
+            load->surface = NULL;
+            SDL_AtomicSet(&load->state, TextureLoadStateReady);
+            ++readyCount;
+        } else {
+            printf("Failed to load file at path: %s\n", load->path);
+            SDL_AtomicSet(&load->state, TextureLoadStateFailed);
+
+            if (load->group) {
+                SDL_AtomicAdd(&load->group->failedCount, 1);
+            }
+            SDL_AtomicAdd(&textureLoader->pendingGroup.failedCount, 1);
+        }
+
+        if (load->callback) {
+            load->callback(load, load->userdata);
+        }
+
+        if (load->group) {
+            SDL_AtomicAdd(&load->group->remaining, -1);
+        }
+        SDL_AtomicAdd(&textureLoader->pendingGroup.remaining, -1);
+    }
+
+    free(uploads);
+
+    return readyCount;
+}
+
+void textureLoaderWait(TextureLoader *textureLoader, TextureLoadGroup *group) {
+    if (!group) {
+        group = &textureLoader->pendingGroup;
+    }
+
+    jobSystemWait(textureLoader->jobSystem, &group->decodeCounter);
+
+    // Every load of the group is decoded now, but loads from other groups may
+    // be ahead of them in the upload queue.
+    while (SDL_AtomicGet(&group->remaining) > 0) {
+        textureLoaderUpdate(textureLoader);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "jobs.h"
+#include "renderer.h"
+#include "texture.h"
+
+typedef enum {
+    // The image is being decoded on a worker.
+    TextureLoadStateDecoding,
+    // The image is decoded and waits for textureLoaderUpdate to upload it.
+    TextureLoadStateDecoded,
+    TextureLoadStateReady,
+    // The image couldn't be loaded, the load keeps using the placeholder.
+    TextureLoadStateFailed,
+} TextureLoadState;
+
+typedef struct TextureLoad TextureLoad;
+
+// Called on the thread running textureLoaderUpdate once load's texture is
+// ready or has failed to load, check load->state to tell them apart.
+typedef void (*TextureLoadCallback)(TextureLoad *load, void *userdata);
+
+// Tracks a set of loads so they can be waited on together. Must be zero
+// initialized before its first use.
+typedef struct {
+    // Loads of the group that haven't been uploaded or failed yet.
+    SDL_atomic_t remaining;
+    // Loads of the group that failed.
+    SDL_atomic_t failedCount;
+    // Decode jobs of the group that haven't finished yet.
+    JobCounter decodeCounter;
+} TextureLoadGroup;
+
+struct TextureLoad {
+    char *path;
+    TextureWrapMode wrapMode;
+    TextureFilteringMode filteringMode;
+    bool generateMips;
+    TextureLoadCallback callback;
+    void *userdata;
+    TextureLoadGroup *group;
+
+    SDL_atomic_t state;
+    // Set by the decode job and freed after the upload, NULL if decoding
+    // failed.
+    SDL_Surface *surface;
+    // The loader's placeholder until the state is TextureLoadStateReady, and
+    // for good if it becomes TextureLoadStateFailed.
+    TextureInfo textureInfo;
+};
+
+// Decodes images on a job system and uploads them on the thread that owns the
+// renderer, which is the only thread that may call these functions.
+typedef struct {
+    Renderer *renderer;
+    JobSystem *jobSystem;
+
+    // A transparent 1x1 texture used by loads until they're ready.
+    TextureInfo placeholder;
+
+    // Every load, so they can be freed with the loader.
+    TextureLoad **loads;
+    int loadCount;
+    int loadCapacity;
+
+    // Decoded loads waiting to be uploaded, filled by the workers.
+    SDL_SpinLock decodedLock;
+    TextureLoad **decodedLoads;
+    int decodedCount;
+    int decodedCapacity;
+    // Uploads done by each textureLoaderUpdate, or all of them if 0. Limiting
+    // it spreads the cost of large batches of loads over several frames.
+    int maxUploadsPerUpdate;
+
+    // Every load that hasn't been uploaded yet.
+    TextureLoadGroup pendingGroup;
+} TextureLoader;
+
+// Neither the renderer nor the job system are owned by the loader, they must
+// outlive it.
+TextureLoader textureLoaderCreate(Renderer *renderer, JobSystem *jobSystem,
+                                  int maxUploadsPerUpdate);
+// Waits for every load, then frees them and releases their textures once the
+// GPU is done with them.
+void textureLoaderDestroy(TextureLoader *textureLoader);
+
+// Starts loading the image at path in the background. The returned load is
+// owned by the loader. group and callback may be NULL.
+TextureLoad *textureLoaderLoad(TextureLoader *textureLoader, const char *path,
+                               TextureWrapMode wrapMode,
+                               TextureFilteringMode filteringMode,
+                               bool generateMips, TextureLoadGroup *group,
+                               TextureLoadCallback callback, void *userdata);
+
+// Uploads decoded images and calls their callbacks, including those of loads
+// that failed. Call it once per frame. Returns the number of textures that
+// became ready.
+int textureLoaderUpdate(TextureLoader *textureLoader);
+
+// Blocks until every load in group is ready or has failed, helping to decode
+// them meanwhile.
+// Passing NULL waits for every load of the loader.
+void textureLoaderWait(TextureLoader *textureLoader, TextureLoadGroup *group);
+
+#endif
@@ -0,0 +1,320 @@
+#include "tilemap.h"
+
+#include <math.h>
+
+// Matches TilemapParams in shader.wgsl.
+typedef struct {
+    float originX;
+    float originY;
+    float tileWidth;
+    float tileHeight;
+    float quadMinX;
+    float quadMinY;
+    float quadMaxX;
+    float quadMaxY;
+    float tileTextureWidth;
+    float tileTextureHeight;
+    float z;
+    uint32_t tilesetColumns;
+} TilemapParams;
+
+Tilemap tilemapCreate(int width, int height, char *tilesetPath,
+                      Renderer *renderer, TilemapOptions options) {
+    TextureInfo tileset = textureCreate(
+        renderer->device, renderer->queue, &renderer->objectCache, tilesetPath,
+        options.textureWrapMode, options.textureFilteringMode,
+        options.generateMips);
+
+    Tilemap tilemap =
+        tilemapCreateFromTexture(width, height, tileset, renderer, options);
+    tilemap.ownsTileset = true;
+
+    return tilemap;
+}
+
+Tilemap tilemapCreateFromTexture(int width, int height, TextureInfo tileset,
+                                 Renderer *renderer, TilemapOptions options) {
+    if (width <= 0 || height <= 0 || width > maxTilemapSize ||
+        height > maxTilemapSize) {
+        printf("Tilemaps must be between 1x1 and %dx%d tiles, not %dx%d\n",
+               maxTilemapSize, maxTilemapSize, width, height);
+        exit(-1);
+    }
+
+    if (options.tileTextureWidth <= 0 || options.tileTextureHeight <= 0 ||
+        options.tileTextureWidth > tileset.width ||
+        options.tileTextureHeight > tileset.height) {
+        printf("Tileset tiles of %dx%d don't fit in a %dx%d tileset\n",
+               options.tileTextureWidth, options.tileTextureHeight,
+               tileset.width, tileset.height);
+        exit(-1);
+    }
+
+    // Texture creation zeroes the tile ids, so the map starts out empty.
+    WGPUTextureDescriptor tileIdTextureDescriptor = {
+        .dimension = WGPUTextureDimension_2D,
+        .format = WGPUTextureFormat_R16Uint,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .size = {width, height, 1},
+        .usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
+        .viewFormatCount = 0,
+        .viewFormats = NULL,
+    };
+    WGPUTexture tileIdTexture =
+        wgpuDeviceCreateTexture(renderer->device, &tileIdTextureDescriptor);
+    gpuMemoryTrack(tileIdTexture, GpuMemoryTexture,
+                   gpuMemoryTextureSize(width, height, 1, 1, sizeof(uint16_t)));
+    WGPUTextureView tileIdView = wgpuTextureCreateView(
+        tileIdTexture, &(WGPUTextureViewDescriptor){
+                           .aspect = WGPUTextureAspect_All,
+                           .baseArrayLayer = 0,
+                           .arrayLayerCount = 1,
+                           .baseMipLevel = 0,
+                           .mipLevelCount = 1,
+                           .dimension = WGPUTextureViewDimension_2D,
+                           .format = tileIdTextureDescriptor.format,
+                       });
+
+    WGPUBuffer paramsBuffer = wgpuDeviceCreateBuffer(
+        renderer->device, &(WGPUBufferDescriptor){
+                              .nextInChain = NULL,
+                              .size = sizeof(TilemapParams),
+                              .usage = WGPUBufferUsage_CopyDst |
+                                       WGPUBufferUsage_Uniform,
+                              .mappedAtCreation = false,
+                          });
+    gpuMemoryTrack(paramsBuffer, GpuMemoryUniform, sizeof(TilemapParams));
+
+    // Create the tilemap's bind group:
+    WGPUBindGroupLayoutEntry bindGroupLayoutEntries[5] = {
+        (WGPUBindGroupLayoutEntry){
+            .binding = 0,
+            .visibility = WGPUShaderStage_Vertex,
+            .buffer =
+                (WGPUBufferBindingLayout){
+                    .type = WGPUBufferBindingType_Uniform,
+                    .minBindingSize = matrix4Components * sizeof(float),
+                },
+        },
+        (WGPUBindGroupLayoutEntry){
+            .binding = 1,
+            .visibility = WGPUShaderStage_Fragment,
+            .texture =
+                (WGPUTextureBindingLayout){
+                    .sampleType = WGPUTextureSampleType_Float,
+                    .viewDimension = WGPUTextureViewDimension_2D,
+                },
+        },
+        (WGPUBindGroupLayoutEntry){
+            .binding = 2,
+            .visibility = WGPUShaderStage_Fragment,
+            .sampler =
+                (WGPUSamplerBindingLayout){
+                    .type = WGPUSamplerBindingType_Filtering,
+                },
+        },
+        (WGPUBindGroupLayoutEntry){
+            .binding = 8,
+            .visibility = WGPUShaderStage_Fragment,
+            .texture =
+                (WGPUTextureBindingLayout){
+                    .sampleType = WGPUTextureSampleType_Uint,
+                    .viewDimension = WGPUTextureViewDimension_2D,
+                },
+        },
+        (WGPUBindGroupLayoutEntry){
+            .binding = 9,
+            .visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment,
+            .buffer =
+                (WGPUBufferBindingLayout){
+                    .type = WGPUBufferBindingType_Uniform,
+                    .minBindingSize = sizeof(TilemapParams),
+                },
+        },
+    };
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor = {
+        .nextInChain = NULL,
+        .entryCount = 5,
+        .entries = bindGroupLayoutEntries,
+    };
+    WGPUBindGroupLayout bindGroupLayout = objectCacheGetBindGroupLayout(
+        &renderer->objectCache, &bindGroupLayoutDescriptor);
+
+    WGPUBindGroupEntry bindings[5] = {
+        (WGPUBindGroupEntry){
+            .nextInChain = NULL,
+            .binding = 0,
+            .buffer = renderer->uniformBuffer,
+            .offset = 0,
+            .size = matrix4Components * sizeof(float),
+        },
+        (WGPUBindGroupEntry){
+            .nextInChain = NULL,
+            .binding = 1,
+            .textureView = tileset.view,
+        },
+        (WGPUBindGroupEntry){
+            .nextInChain = NULL,
+            .binding = 2,
+            .sampler = tileset.sampler,
+        },
+        (WGPUBindGroupEntry){
+            .nextInChain = NULL,
+            .binding = 8,
+            .textureView = tileIdView,
+        },
+        (WGPUBindGroupEntry){
+            .nextInChain = NULL,
+            .binding = 9,
+            .buffer = paramsBuffer,
+            .offset = 0,
+            .size = sizeof(TilemapParams),
+        },
+    };
+    WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(
+        renderer->device, &(WGPUBindGroupDescriptor){
+                              .nextInChain = NULL,
+                              .layout = bindGroupLayout,
+                              .entryCount = bindGroupLayoutDescriptor.entryCount,
+                              .entries = bindings,
+                          });
+
+    float tileWidth = options.tileWidth > 0.0f
+                          ? options.tileWidth
+                          : (float)options.tileTextureWidth;
+    float tileHeight = options.tileHeight > 0.0f
+                           ? options.tileHeight
+                           : (float)options.tileTextureHeight;
+
+    return (Tilemap){
+        .width = width,
+        .height = height,
+        .tiles = calloc((size_t)width * height, sizeof(uint16_t)),
+        .x = options.x,
+        .y = options.y,
+        .z = options.z,
+        .tileWidth = tileWidth,
+        .tileHeight = tileHeight,
+        .tileTextureWidth = options.tileTextureWidth,
+        .tileTextureHeight = options.tileTextureHeight,
+        .tilesetColumns = tileset.width / options.tileTextureWidth,
+        .tileIdTexture = tileIdTexture,
+        .tileIdView = tileIdView,
+        .paramsBuffer = paramsBuffer,
+        .bindGroup = bindGroup,
+        .tileset = tileset,
+    };
+}
+
+void tilemapDestroy(Tilemap *tilemap, Renderer *renderer) {
+    rendererReleaseBindGroup(renderer, tilemap->bindGroup);
+    rendererReleaseBuffer(renderer, tilemap->paramsBuffer);
+    rendererReleaseTextureView(renderer, tilemap->tileIdView);
+    rendererReleaseTexture(renderer, tilemap->tileIdTexture);
+
+    if (tilemap->ownsTileset) {
+        rendererReleaseTextureInfo(renderer, tilemap->tileset);
+    }
+
+    free(tilemap->tiles);
+    *tilemap = (Tilemap){0};
+}
+
+void tilemapSetTile(Tilemap *tilemap, Renderer *renderer, int x, int y,
+                    uint16_t tileId) {
+    tilemapSetTiles(tilemap, renderer, x, y, 1, 1, &tileId);
+}
+
+void tilemapSetTiles(Tilemap *tilemap, Renderer *renderer, int x, int y,
+                     int width, int height, const uint16_t *tileIds) {
+    // Skip the parts of the block outside the map.
+    int startX = x > 0 ? x : 0;
+    int startY = y > 0 ? y : 0;
+    int endX = x + width < tilemap->width ? x + width : tilemap->width;
+    int endY = y + height < tilemap->height ? y + height : tilemap->height;
+
+    if (startX >= endX || startY >= endY) {
+        return;
+    }
+
+    int copyWidth = endX - startX;
+    for (int row = startY; row < endY; ++row) {
+        memcpy(&tilemap->tiles[row * tilemap->width + startX],
+               &tileIds[(row - y) * width + (startX - x)],
+               copyWidth * sizeof(uint16_t));
+    }
+
+    // Upload the changed rows straight from the CPU copy.
+    size_t offset = ((size_t)startY * tilemap->width + startX) * sizeof(uint16_t);
+    size_t bytesPerRow = tilemap->width * sizeof(uint16_t);
+    int copyHeight = endY - startY;
+    WGPUImageCopyTexture destination = {
+        .texture = tilemap->tileIdTexture,
+        .mipLevel = 0,
+        .origin = {startX, startY, 0},
+        .aspect = WGPUTextureAspect_All,
+    };
+    WGPUTextureDataLayout source = {
+        .offset = 0,
+        .bytesPerRow = bytesPerRow,
+        .rowsPerImage = copyHeight,
+    };
+    WGPUExtent3D size = (WGPUExtent3D){copyWidth, copyHeight, 1};
+
+    wgpuQueueWriteTexture(
+        renderer->queue, &destination, (uint8_t *)tilemap->tiles + offset,
+        (copyHeight - 1) * bytesPerRow + copyWidth * sizeof(uint16_t), &source,
+        &size);
+}
+
+uint16_t tilemapGetTile(const Tilemap *tilemap, int x, int y) {
+    if (x < 0 || y < 0 || x >= tilemap->width || y >= tilemap->height) {
+        return tilemapEmptyTile;
+    }
+
+    return tilemap->tiles[y * tilemap->width + x];
+}
+
+void tilemapDraw(Tilemap *tilemap, Renderer *renderer) {
+    if (!renderer->hasRenderPass) {
+        return;
+    }
+
+    // Only cover the part of the map that's visible.
+    CameraRect visibleRect = rendererVisibleRect(renderer);
+    float left = fmaxf(tilemap->x, visibleRect.left);
+    float bottom = fmaxf(tilemap->y, visibleRect.bottom);
+    float right =
+        fminf(tilemap->x + tilemap->width * tilemap->tileWidth, visibleRect.right);
+    float top = fminf(tilemap->y + tilemap->height * tilemap->tileHeight,
+                      visibleRect.top);
+
+    if (left >= right || bottom >= top) {
+        return;
+    }
+
+    TilemapParams params = (TilemapParams){
+        .originX = tilemap->x,
+        .originY = tilemap->y,
+        .tileWidth = tilemap->tileWidth,
+        .tileHeight = tilemap->tileHeight,
+        .quadMinX = left,
+        .quadMinY = bottom,
+        .quadMaxX = right,
+        .quadMaxY = top,
+        .tileTextureWidth = (float)tilemap->tileTextureWidth,
+        .tileTextureHeight = (float)tilemap->tileTextureHeight,
+        .z = tilemap->z,
+        .tilesetColumns = (uint32_t)tilemap->tilesetColumns,
+    };
+    wgpuQueueWriteBuffer(renderer->queue, tilemap->paramsBuffer, 0, &params,
+                         sizeof(TilemapParams));
+
+    wgpuRenderPassEncoderSetPipeline(renderer->renderPass,
+                                     renderer->tilemapPipeline);
+    wgpuRenderPassEncoderSetBindGroup(renderer->renderPass, 0,
+                                      tilemap->bindGroup, 0, NULL);
+    wgpuRenderPassEncoderDraw(renderer->renderPass, 6, 1, 0, 0);
+}
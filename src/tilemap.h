@@ -0,0 +1,92 @@
+#ifndef TILEMAP_H
+#define TILEMAP_H
+
+#include "renderer.h"
+#include "texture.h"
+
+// Tile id of empty tiles. Other ids refer to tileset tiles, starting with 1
+// for the top left tile and going left to right, then top to bottom.
+#define tilemapEmptyTile 0
+
+// WebGPU guarantees textures up to this size, which bounds the tiles per axis.
+#define maxTilemapSize 8192
+
+typedef struct {
+    // Size of one tile in the tileset, in pixels.
+    int tileTextureWidth;
+    int tileTextureHeight;
+    // Size of one tile in the world, the tileset size if 0.
+    float tileWidth;
+    float tileHeight;
+
+    // Position of the map's bottom left corner.
+    float x;
+    float y;
+    float z;
+
+    TextureWrapMode textureWrapMode;
+    TextureFilteringMode textureFilteringMode;
+    // Generates mip levels for the tileset, which keeps maps seen zoomed out
+    // from aliasing. Ignored by tilemapCreateFromTexture, which uses the
+    // texture's own levels.
+    bool generateMips;
+} TilemapOptions;
+
+// A grid of tiles stored as ids in a texture. The visible part of the map is
+// drawn as a single quad and the fragment shader picks each pixel's tile, so
+// drawing costs the same no matter how many tiles the map has. Row 0 is the
+// bottom row of the map.
+typedef struct {
+    int width;
+    int height;
+    // CPU copy of the tile ids, width * height values stored row by row.
+    uint16_t *tiles;
+
+    float x;
+    float y;
+    float z;
+    float tileWidth;
+    float tileHeight;
+    int tileTextureWidth;
+    int tileTextureHeight;
+    int tilesetColumns;
+
+    WGPUTexture tileIdTexture;
+    WGPUTextureView tileIdView;
+    WGPUBuffer paramsBuffer;
+    WGPUBindGroup bindGroup;
+    TextureInfo tileset;
+    // Whether the tileset was loaded by the map and is released with it.
+    bool ownsTileset;
+} Tilemap;
+
+// Creates an empty map of width x height tiles.
+Tilemap tilemapCreate(int width, int height, char *tilesetPath,
+                      Renderer *renderer, TilemapOptions options);
+
+// Creates a map that draws from an existing tileset texture, such as an atlas
+// page. The texture's sampler is used, so the wrap and filtering options are
+// ignored.
+Tilemap tilemapCreateFromTexture(int width, int height, TextureInfo tileset,
+                                 Renderer *renderer, TilemapOptions options);
+
+// Releases the map's resources once the GPU is done with them. Tilesets passed
+// to tilemapCreateFromTexture still belong to the caller.
+void tilemapDestroy(Tilemap *tilemap, Renderer *renderer);
+
+// Both of these write the changed tiles to the GPU right away.
+void tilemapSetTile(Tilemap *tilemap, Renderer *renderer, int x, int y,
+                    uint16_t tileId);
+// Copies a width x height block of tile ids, stored row by row, to the map
+// starting at tile (x, y).
+void tilemapSetTiles(Tilemap *tilemap, Renderer *renderer, int x, int y,
+                     int width, int height, const uint16_t *tileIds);
+
+// Returns tilemapEmptyTile outside the map.
+uint16_t tilemapGetTile(const Tilemap *tilemap, int x, int y);
+
+// The covered area is written with the queue, so draw each map at most once
+// per frame.
+void tilemapDraw(Tilemap *tilemap, Renderer *renderer);
+
+#endif
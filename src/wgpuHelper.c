@@ -2,12 +2,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "unused.h"
 
 WGPUShaderModuleDescriptor loadWgsl(const char *name) {
     FILE *file;
+#ifdef _MSC_VER
     fopen_s(&file, name, "rb");
+#else
+    file = fopen(name, "rb");
+#endif
 
     if (!file) {
         printf("Unable to open %s\n", name);
@@ -50,8 +55,7 @@ void requestDeviceCallback(WGPURequestDeviceStatus status, WGPUDevice received,
 }
 
 void readBufferMap(WGPUBufferMapAsyncStatus status, void *userdata) {
-    UNUSED(status);
-    UNUSED(userdata);
+    *(WGPUBufferMapAsyncStatus *)userdata = status;
 }
 
 void logCallback(WGPULogLevel level, const char *msg, void *userdata) {
@@ -80,6 +84,23 @@ void logCallback(WGPULogLevel level, const char *msg, void *userdata) {
     printf("[%s] %s\n", level_str, msg);
 }
 
+uint64_t hashPointer(const void *pointer) {
+    uint64_t key = (uint64_t)(uintptr_t)pointer;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+
+    return key;
+}
+
+char *copyString(const char *string) {
+    size_t length = strlen(string) + 1;
+    char *copy = malloc(length);
+    memcpy(copy, string, length);
+
+    return copy;
+}
+
 void initializeLog(void) {
     wgpuSetLogCallback(logCallback, NULL);
     wgpuSetLogLevel(WGPULogLevel_Error);
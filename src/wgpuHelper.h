@@ -1,6 +1,8 @@
 #ifndef FRAMEWORK_H
 #define FRAMEWORK_H
 
+#include <inttypes.h>
+
 #include "../webgpu-headers/webgpu.h"
 #include "../wgpu.h"
 
@@ -14,8 +16,17 @@ void requestDeviceCallback(WGPURequestDeviceStatus status,
                              WGPUDevice received, const char *message,
                              void *userdata);
 
+// Stores the map status in userdata, which must point to a
+// WGPUBufferMapAsyncStatus.
 void readBufferMap(WGPUBufferMapAsyncStatus status, void *userdata);
 
+// Mixes the bits of a pointer, such as a WebGPU handle, into a hash. Handles
+// are heap pointers, so their low bits carry little information on their own.
+uint64_t hashPointer(const void *pointer);
+
+// Returns a heap allocated copy of a null terminated string.
+char *copyString(const char *string);
+
 void initializeLog(void);
 
 void printGlobalReport(WGPUGlobalReport report);